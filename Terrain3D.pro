@@ -17,6 +17,13 @@ TEMPLATE = app
 
 CONFIG += c++11
 
+# the branch-free row loops of rasterExpression.h are vectorized
+# by GCC and Clang at -O3 (by MSVC at /O2)
+gcc|clang {
+    QMAKE_CXXFLAGS_RELEASE -= -O2
+    QMAKE_CXXFLAGS_RELEASE += -O3
+}
+
 INCLUDEPATH += gis
 
 SOURCES += main.cpp \
@@ -25,7 +32,12 @@ SOURCES += main.cpp \
     gis/color.cpp \
     gis/gis.cpp \
     gis/gisIO.cpp \
+    gis/parallel.cpp \
+    gis/simdKernels.cpp \
     mainwindow.cpp \
+    terrainHeightmap.cpp \
+    terrainLOD.cpp \
+    terrainRenderer.cpp \
     viewer3D.cpp
 
 HEADERS += \
@@ -34,7 +46,13 @@ HEADERS += \
     gis/commonConstants.h \
     gis/color.h \
     gis/gis.h \
+    gis/parallel.h \
+    gis/rasterExpression.h \
+    gis/simdKernels.h \
     mainwindow.h \
+    terrainHeightmap.h \
+    terrainLOD.h \
+    terrainRenderer.h \
     viewer3D.h
 
 
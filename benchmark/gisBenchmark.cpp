@@ -0,0 +1,801 @@
+/*!
+    \file gisBenchmark.cpp
+
+    \abstract Micro-benchmark of the gis raster library
+
+    Times the main raster functions on synthetic DTMs of increasing size
+    (default 1024^2 to 4096^2, up to 16384^2 with --sizes) and thread counts,
+    and reports cells/second as JSON.
+    Each output is reduced to a checksum (number and sum of the valid values)
+    and compared with the reference file (gisReference.txt), so an optimization
+    can't silently change the results:
+        ./GIS_BENCHMARK --sizes 1024,2048 --threads 1,4 --reference gisReference.txt
+    --write-reference rewrites the reference file with the current results.
+    The exit code is 1 if a checksum differs from the reference.
+
+    This file is part of CRITERIA3D.
+*/
+
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "commonConstants.h"
+#include "gis.h"
+#include "parallel.h"
+#include "rasterExpression.h"
+
+#define BENCHMARK_CELLSIZE 10.
+#define BENCHMARK_XLL 600000.
+#define BENCHMARK_YLL 4900000.
+#define BENCHMARK_TOLERANCE 1e-6
+
+
+struct benchmarkChecksum
+{
+    double nrValues;
+    double sum;
+
+    benchmarkChecksum() : nrValues(0), sum(0) {}
+};
+
+
+struct benchmarkCase
+{
+    std::string name;
+    int maxSize;                    /*!< largest size, for the functions that don't scale linearly */
+    double (*run)(const gis::Crit3DRasterGrid& dtm, const std::string& fileName, benchmarkChecksum* checksum);
+};
+
+
+static void addChecksum(const gis::Crit3DRasterGrid& grid, benchmarkChecksum* checksum)
+{
+    for (int row = 0; row < grid.header->nrRows; row++)
+        for (int col = 0; col < grid.header->nrCols; col++)
+            if (grid.value[row][col] != grid.header->flag)
+            {
+                checksum->nrValues++;
+                checksum->sum += double(grid.value[row][col]);
+            }
+}
+
+
+static double secondsSince(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/*!
+ * \brief deterministic synthetic DTM: ridges and valleys, hashed roughness, one nodata hole
+ */
+static bool initializeSyntheticDtm(int size, gis::Crit3DRasterGrid* dtm)
+{
+    gis::Crit3DRasterHeader header;
+    header.nrRows = size;
+    header.nrCols = size;
+    header.cellSize = BENCHMARK_CELLSIZE;
+    header.flag = NODATA;
+    header.llCorner->x = BENCHMARK_XLL;
+    header.llCorner->y = BENCHMARK_YLL;
+    if (! dtm->initializeGrid(header)) return false;
+
+    double holeRow = size * 0.3;
+    double holeCol = size * 0.6;
+    double holeRadius = size * 0.05;
+
+    for (int row = 0; row < size; row++)
+        for (int col = 0; col < size; col++)
+        {
+            double dRow = row - holeRow;
+            double dCol = col - holeCol;
+            if (dRow * dRow + dCol * dCol < holeRadius * holeRadius)
+                continue;
+
+            // coordinates relative to a 1024 cells tile: same landscape at any size
+            double x = col * 1024. / size;
+            double y = row * 1024. / size;
+            unsigned hash = unsigned(row) * 73856093u ^ unsigned(col) * 19349663u;
+            hash = (hash ^ (hash >> 13)) * 1274126177u;
+            double noise = double(hash & 0xFFFF) / 65535. - 0.5;
+
+            dtm->value[row][col] = float(600. + 400. * sin(x * 0.011) * cos(y * 0.007)
+                                         + 120. * sin((x + y) * 0.037) + 4. * noise);
+        }
+
+    gis::updateMinMaxRasterGrid(dtm);
+    dtm->isLoaded = true;
+    return true;
+}
+
+
+static double runReadEsriGrid(const gis::Crit3DRasterGrid& dtm, const std::string& fileName, benchmarkChecksum* checksum)
+{
+    gis::Crit3DRasterGrid grid;
+    std::string error;
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::readEsriGrid(fileName, &grid, &error)) return NODATA;
+    double seconds = secondsSince(start);
+
+    // the statistics cache is filled while reading
+    if (! grid.isStatisticsUpdated || grid.nrValidCells != dtm.nrValidCells
+        || grid.minimum != dtm.minimum || grid.maximum != dtm.maximum)
+        return NODATA;
+
+    addChecksum(grid, checksum);
+    return seconds;
+}
+
+
+static double runMapEsriGrid(const gis::Crit3DRasterGrid& dtm, const std::string& fileName, benchmarkChecksum* checksum)
+{
+    gis::Crit3DRasterGrid grid;
+    std::string error;
+
+    // the map only: the statistics are computed at the first request
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::mapEsriGrid(fileName, &grid, &error)) return NODATA;
+    double seconds = secondsSince(start);
+
+    if (! gis::setMinMaxFromStatistics(&grid)) return NODATA;
+    if (grid.nrValidCells != dtm.nrValidCells || grid.minimum != dtm.minimum || grid.maximum != dtm.maximum)
+        return NODATA;
+
+    checksum->nrValues = double(grid.nrValidCells);
+    checksum->sum = double(grid.minimum) + double(grid.maximum);
+    return seconds;
+}
+
+
+static double runCopyMappedGrid(const gis::Crit3DRasterGrid& dtm, const std::string& fileName, benchmarkChecksum* checksum)
+{
+    // odd nrCols: the mapped grid is not padded, the copy is
+    gis::Crit3DRasterHeader header = *(dtm.header);
+    header.llCorner = new gis::Crit3DUtmPoint(dtm.header->llCorner->x, dtm.header->llCorner->y);
+    header.nrCols = dtm.header->nrCols - 1;
+
+    std::string oddFileName = fileName + "_odd";
+    std::string error;
+    bool isOk = gis::writeEsriGridBands(oddFileName, header, 256, [&](int firstRow, gis::Crit3DRasterGrid* band)
+    {
+        for (int row = 0; row < band->header->nrRows; row++)
+            for (int col = 0; col < band->header->nrCols; col++)
+                band->value[row][col] = dtm.value[firstRow + row][col];
+        return true;
+    }, &error);
+
+    gis::Crit3DRasterGrid mappedGrid, grid;
+    if (isOk) isOk = gis::mapEsriGrid(oddFileName, &mappedGrid, &error);
+
+    double seconds = NODATA;
+    if (isOk)
+    {
+        auto start = std::chrono::steady_clock::now();
+        isOk = grid.copyGrid(mappedGrid);
+        seconds = secondsSince(start);
+    }
+
+    // the copy must have the cells of the mapped grid
+    for (int row = 0; row < header.nrRows && isOk; row++)
+        for (int col = 0; col < header.nrCols; col++)
+            if (grid.value[row][col] != mappedGrid.value[row][col])
+            {
+                isOk = false;
+                break;
+            }
+
+    if (isOk) addChecksum(grid, checksum);
+
+    mappedGrid.freeGrid();
+    remove((oddFileName + ".hdr").c_str());
+    remove((oddFileName + ".flt").c_str());
+    return isOk ? seconds : NODATA;
+}
+
+
+static double runSlopeAspect(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    gis::Crit3DRasterGrid slopeMap, aspectMap;
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::computeSlopeAspectMaps(dtm, &slopeMap, &aspectMap)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(slopeMap, checksum);
+    addChecksum(aspectMap, checksum);
+    return seconds;
+}
+
+
+static double runUpdateMinMax(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    gis::Crit3DRasterGrid grid;
+    grid.copyGrid(dtm);
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::updateMinMaxRasterGrid(&grid)) return NODATA;
+    double seconds = secondsSince(start);
+
+    checksum->nrValues = double(grid.nrValidCells);
+    checksum->sum = double(grid.minimum) + double(grid.maximum);
+    return seconds;
+}
+
+
+static double runStatistics(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    gis::Crit3DRasterGrid grid;
+    grid.copyGrid(dtm);
+    grid.setStatisticsDirty();
+
+    auto start = std::chrono::steady_clock::now();
+    const gis::Crit3DRasterStatistics& statistics = grid.getStatistics(256);
+    double seconds = secondsSince(start);
+
+    // mean, standard deviation and mean histogram class
+    double sumClasses = 0;
+    for (size_t i = 0; i < statistics.histogram.size(); i++)
+        sumClasses += double(i) * double(statistics.histogram[i]);
+
+    checksum->nrValues = double(statistics.nrValidCells);
+    checksum->sum = statistics.mean + statistics.standardDeviation + sumClasses / statistics.nrValidCells;
+    return seconds;
+}
+
+
+static double runColorScaleWindows(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    gis::Crit3DRasterGrid grid;
+    grid.copyGrid(dtm);
+    grid.setStatisticsDirty();
+
+    // pyramid build and 100 windows of a pan and zoom (1/8 to 1/2 of the grid)
+    int nrRows = grid.header->nrRows;
+    int nrCols = grid.header->nrCols;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++)
+    {
+        int height = nrRows / 8 + (nrRows * 3 / 8) * (i % 10) / 9;
+        int width = nrCols / 8 + (nrCols * 3 / 8) * (i % 7) / 6;
+        int row0 = (nrRows - height) * i / 99;
+        int col0 = (nrCols - width) * (99 - i) / 99;
+        if (gis::updateColorScale(&grid, row0, col0, row0 + height - 1, col0 + width - 1))
+        {
+            checksum->nrValues++;
+            checksum->sum += double(grid.colorScale->minimum) + double(grid.colorScale->maximum);
+        }
+    }
+    return secondsSince(start);
+}
+
+
+/*!
+ * \brief minimum and maximum of the valid cells of a window, by scanning all its cells
+ */
+static bool getMinMaxScan(const gis::Crit3DRasterGrid& grid, int row0, int col0, int row1, int col1,
+                          float* minimum, float* maximum)
+{
+    *minimum = FLT_MAX;
+    *maximum = -FLT_MAX;
+    for (int row = row0; row <= row1; row++)
+        for (int col = col0; col <= col1; col++)
+            if (grid.value[row][col] != grid.header->flag)
+            {
+                *minimum = std::min(*minimum, grid.value[row][col]);
+                *maximum = std::max(*maximum, grid.value[row][col]);
+            }
+
+    return (*minimum <= *maximum);
+}
+
+
+static double runColorScaleWrites(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    gis::Crit3DRasterGrid grid;
+    grid.copyGrid(dtm);
+    gis::updateColorScale(&grid, 0, 0, grid.header->nrRows - 1, grid.header->nrCols - 1);
+
+    // 100 patches written through value (peaks, pits and nodata), each followed by
+    // setStatisticsDirty on its window and by a query of a window around it
+    int nrRows = grid.header->nrRows;
+    int nrCols = grid.header->nrCols;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++)
+    {
+        int height = 1 + (i * 37) % 61;
+        int width = 1 + (i * 53) % 67;
+        int row0 = (nrRows - height) * ((i * 61) % 100) / 99;
+        int col0 = (nrCols - width) * ((i * 29) % 100) / 99;
+        for (int row = row0; row < row0 + height; row++)
+            for (int col = col0; col < col0 + width; col++)
+            {
+                if (i % 3 == 0) grid.value[row][col] += 500.f;
+                else if (i % 3 == 1) grid.value[row][col] -= 500.f;
+                else if ((row + col) % 2 == 0) grid.value[row][col] = grid.header->flag;
+            }
+        grid.setStatisticsDirty(row0, col0, row0 + height - 1, col0 + width - 1);
+
+        int queryRow0 = std::max(row0 - 100, 0);
+        int queryCol0 = std::max(col0 - 100, 0);
+        int queryRow1 = std::min(row0 + height + 100, nrRows - 1);
+        int queryCol1 = std::min(col0 + width + 100, nrCols - 1);
+        if (gis::updateColorScale(&grid, queryRow0, queryCol0, queryRow1, queryCol1))
+        {
+            float minimum, maximum;
+            if (! getMinMaxScan(grid, queryRow0, queryCol0, queryRow1, queryCol1, &minimum, &maximum)) return NODATA;
+            if (grid.colorScale->minimum != minimum || grid.colorScale->maximum != maximum) return NODATA;
+
+            checksum->nrValues++;
+            checksum->sum += double(minimum) + double(maximum);
+        }
+    }
+    double seconds = secondsSince(start);
+
+    // the whole grid statistics see the same writes
+    float minimum, maximum;
+    gis::setMinMaxFromStatistics(&grid);
+    if (! getMinMaxScan(grid, 0, 0, nrRows - 1, nrCols - 1, &minimum, &maximum)) return NODATA;
+    if (grid.minimum != minimum || grid.maximum != maximum) return NODATA;
+
+    return seconds;
+}
+
+
+static double runMapAlgebra(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    gis::Crit3DRasterGrid outputMap;
+    outputMap.initializeGrid(dtm);
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::mapAlgebra(const_cast<gis::Crit3DRasterGrid*>(&dtm), 0.5f, &outputMap, operationProduct)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(outputMap, checksum);
+    return seconds;
+}
+
+
+static double runMapAlgebraGrids(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // dtm difference, same header: base = dtm * 0.25
+    gis::Crit3DRasterGrid baseMap, outputMap;
+    baseMap.initializeGrid(dtm);
+    outputMap.initializeGrid(dtm);
+    gis::mapAlgebra(const_cast<gis::Crit3DRasterGrid*>(&dtm), 0.25f, &baseMap, operationProduct);
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::mapAlgebra(const_cast<gis::Crit3DRasterGrid*>(&dtm), &baseMap, &outputMap, operationSubtract)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(outputMap, checksum);
+    return seconds;
+}
+
+
+static double runMapAlgebraAligned(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // dtm difference with a coarser base (cellsize x 2, shifted by a third of cell), bilinear alignment
+    gis::Crit3DRasterHeader header = *(dtm.header);
+    header.llCorner = new gis::Crit3DUtmPoint(dtm.header->llCorner->x + dtm.header->cellSize / 3,
+                                              dtm.header->llCorner->y + dtm.header->cellSize / 3);
+    header.nrRows /= 2;
+    header.nrCols /= 2;
+    header.cellSize *= 2;
+    gis::Crit3DRasterGrid baseMap, outputMap;
+    baseMap.initializeGrid(header);
+    gis::resampleGrid(dtm, &baseMap, resampleMean, 3);
+    outputMap.initializeGrid(dtm);
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::mapAlgebra(const_cast<gis::Crit3DRasterGrid*>(&dtm), &baseMap, &outputMap,
+                          operationSubtract, resampleBilinear)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(outputMap, checksum);
+    return seconds;
+}
+
+
+static double runRasterExpression(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // (dtm - base) * k + offset in one pass, base = dtm * 0.25
+    gis::Crit3DRasterGrid baseMap, outputMap;
+    baseMap.initializeGrid(dtm);
+    outputMap.initializeGrid(dtm);
+    gis::mapAlgebra(const_cast<gis::Crit3DRasterGrid*>(&dtm), 0.25f, &baseMap, operationProduct);
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::evaluateExpression((gis::raster(dtm) - gis::raster(baseMap)) * 0.5f + 10.f, &outputMap)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(outputMap, checksum);
+    return seconds;
+}
+
+
+static double runPrevailingMap(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // land use like input: integer classes
+    gis::Crit3DRasterGrid classMap;
+    classMap.initializeGrid(dtm);
+    for (int row = 0; row < dtm.header->nrRows; row++)
+        for (int col = 0; col < dtm.header->nrCols; col++)
+            if (dtm.value[row][col] != dtm.header->flag)
+                classMap.value[row][col] = floorf(dtm.value[row][col] / 100.f);
+
+    // output: cellsize x 4
+    gis::Crit3DRasterHeader header = *(dtm.header);
+    header.llCorner = new gis::Crit3DUtmPoint(dtm.header->llCorner->x, dtm.header->llCorner->y);
+    header.nrRows /= 4;
+    header.nrCols /= 4;
+    header.cellSize *= 4;
+    gis::Crit3DRasterGrid outputMap;
+    outputMap.initializeGrid(header);
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::prevailingMap(classMap, &outputMap)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(outputMap, checksum);
+    return seconds;
+}
+
+
+static double runResampleBilinear(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // output: cellsize x 1.5, shifted by a third of cell
+    gis::Crit3DRasterHeader header = *(dtm.header);
+    header.llCorner = new gis::Crit3DUtmPoint(dtm.header->llCorner->x + dtm.header->cellSize / 3,
+                                              dtm.header->llCorner->y + dtm.header->cellSize / 3);
+    header.nrRows = dtm.header->nrRows * 2 / 3;
+    header.nrCols = dtm.header->nrCols * 2 / 3;
+    header.cellSize *= 1.5;
+    gis::Crit3DRasterGrid outputMap;
+    outputMap.initializeGrid(header);
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::resampleGrid(dtm, &outputMap, resampleBilinear, 1)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(outputMap, checksum);
+    return seconds;
+}
+
+
+static double runTopographicDistance(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // station on the grid center (outside the nodata hole)
+    int row = dtm.header->nrRows / 2;
+    int col = dtm.header->nrCols / 2;
+    gis::Crit3DPoint station;
+    gis::getUtmXYFromRowCol(dtm, row, col, &(station.utm.x), &(station.utm.y));
+    station.z = double(dtm.value[row][col]);
+
+    gis::Crit3DRasterGrid distanceMap;
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::topographicDistanceMap(station, dtm, &distanceMap)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(distanceMap, checksum);
+    return seconds;
+}
+
+
+/*!
+ * \brief exact visibility of a cell: line of sight walked one cell for each row or column
+ */
+static bool isVisibleLineWalk(const gis::Crit3DRasterGrid& dtm, int observerRow, int observerCol, float observerZ,
+                              int row, int col)
+{
+    float cellSize = float(dtm.header->cellSize);
+    int dRow = row - observerRow;
+    int dCol = col - observerCol;
+    int nrSteps = std::max(abs(dRow), abs(dCol));
+    float maxSlope = -FLT_MAX;
+
+    for (int j = 1; j < nrSteps; j++)
+    {
+        int stepRow = int(floor(observerRow + double(dRow) * j / nrSteps + 0.5));
+        int stepCol = int(floor(observerCol + double(dCol) * j / nrSteps + 0.5));
+        float z = dtm.value[stepRow][stepCol];
+        if (z == dtm.header->flag) continue;
+
+        float stepDistance = cellSize * sqrtf(float(stepRow - observerRow) * float(stepRow - observerRow)
+                                              + float(stepCol - observerCol) * float(stepCol - observerCol));
+        maxSlope = std::max(maxSlope, (z - observerZ) / stepDistance);
+    }
+
+    float distance = cellSize * sqrtf(float(dRow) * float(dRow) + float(dCol) * float(dCol));
+    return (dtm.value[row][col] - observerZ) / distance >= maxSlope;
+}
+
+
+static double runViewshed(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // observer 2 m above the grid center, targets on the ground, no distance limit
+    gis::Crit3DUtmPoint observer;
+    gis::getUtmXYFromRowCol(dtm, dtm.header->nrRows / 2, dtm.header->nrCols / 2, &(observer.x), &(observer.y));
+
+    gis::Crit3DRasterGrid viewshedMap;
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::computeViewshed(dtm, observer, 2.f, 0.f, 0.f, &viewshedMap)) return NODATA;
+    double seconds = secondsSince(start);
+
+    // the sweep must agree with the line walk: cells on a 256 x 256 lattice and around the observer
+    int observerRow = dtm.header->nrRows / 2;
+    int observerCol = dtm.header->nrCols / 2;
+    float observerZ = dtm.value[observerRow][observerCol] + 2.f;
+    int step = std::max(dtm.header->nrRows / 256, 1);
+    for (int row = 0; row < dtm.header->nrRows; row++)
+        for (int col = 0; col < dtm.header->nrCols; col++)
+        {
+            bool isNear = (abs(row - observerRow) <= 32 && abs(col - observerCol) <= 32);
+            if ((row % step != 0 || col % step != 0) && ! isNear) continue;
+            if (dtm.value[row][col] == dtm.header->flag || (row == observerRow && col == observerCol)) continue;
+
+            float visible = isVisibleLineWalk(dtm, observerRow, observerCol, observerZ, row, col) ? 1.f : 0.f;
+            if (viewshedMap.value[row][col] != visible) return NODATA;
+        }
+
+    addChecksum(viewshedMap, checksum);
+    return seconds;
+}
+
+
+static double runViewshedCount(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // 16 x 16 observers 10 m above the terrain, visibility within 2 km
+    std::vector<gis::Crit3DUtmPoint> observers;
+    for (int i = 0; i < 16; i++)
+        for (int j = 0; j < 16; j++)
+        {
+            gis::Crit3DUtmPoint observer;
+            gis::getUtmXYFromRowCol(dtm, (2 * i + 1) * dtm.header->nrRows / 32,
+                                    (2 * j + 1) * dtm.header->nrCols / 32, &(observer.x), &(observer.y));
+            observers.push_back(observer);
+        }
+
+    gis::Crit3DRasterGrid countMap;
+
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::computeViewshedCount(dtm, observers, 10.f, 0.f, 2000.f, &countMap)) return NODATA;
+    double seconds = secondsSince(start);
+
+    addChecksum(countMap, checksum);
+    return seconds;
+}
+
+
+static double runLatLonToUtm(const gis::Crit3DRasterGrid& dtm, const std::string&, benchmarkChecksum* checksum)
+{
+    // one point for each cell, on a 1 x 1 degree window
+    int nrRows = dtm.header->nrRows;
+    int nrCols = dtm.header->nrCols;
+    double easting, northing;
+    int zoneNumber;
+    double sum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int row = 0; row < nrRows; row++)
+    {
+        double lat = 44. + double(row) / nrRows;
+        for (int col = 0; col < nrCols; col++)
+        {
+            double lon = 11. + double(col) / nrCols;
+            gis::latLonToUtm(lat, lon, &easting, &northing, &zoneNumber);
+            sum += (easting - 500000.) + (northing - 4900000.);
+        }
+    }
+    double seconds = secondsSince(start);
+
+    checksum->nrValues = double(nrRows) * nrCols;
+    checksum->sum = sum;
+    return seconds;
+}
+
+
+static std::vector<int> parseList(const std::string& text)
+{
+    std::vector<int> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (! item.empty()) values.push_back(atoi(item.c_str()));
+    return values;
+}
+
+
+static std::string referenceKey(const std::string& name, int size)
+{
+    return name + " " + std::to_string(size);
+}
+
+
+static bool readReference(const std::string& fileName, std::map<std::string, benchmarkChecksum>& reference)
+{
+    std::ifstream file(fileName);
+    if (! file.is_open()) return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::stringstream stream(line);
+        std::string name;
+        int size;
+        benchmarkChecksum checksum;
+        if (stream >> name >> size >> checksum.nrValues >> checksum.sum)
+            reference[referenceKey(name, size)] = checksum;
+    }
+    return true;
+}
+
+
+static bool isEqualChecksum(const benchmarkChecksum& checksum, const benchmarkChecksum& reference, double tolerance)
+{
+    if (checksum.nrValues != reference.nrValues) return false;
+
+    double scale = std::max(fabs(reference.sum), 1.);
+    return fabs(checksum.sum - reference.sum) <= tolerance * scale;
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes = {1024, 2048, 4096};
+    std::vector<int> nrThreads = {1, gis::getNrThreads()};
+    if (nrThreads[1] == 1) nrThreads.pop_back();
+    std::string referenceFileName = "gisReference.txt";
+    std::string outputFileName = "";
+    std::string tmpPath = ".";
+    double tolerance = BENCHMARK_TOLERANCE;
+    bool isWriteReference = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--sizes" && hasValue) sizes = parseList(argv[++i]);
+        else if (arg == "--threads" && hasValue) nrThreads = parseList(argv[++i]);
+        else if (arg == "--reference" && hasValue) referenceFileName = argv[++i];
+        else if (arg == "--output" && hasValue) outputFileName = argv[++i];
+        else if (arg == "--tmp" && hasValue) tmpPath = argv[++i];
+        else if (arg == "--tolerance" && hasValue) tolerance = atof(argv[++i]);
+        else if (arg == "--write-reference") isWriteReference = true;
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--sizes 1024,2048] [--threads 1,4] [--reference file]"
+                      << " [--write-reference] [--tolerance 1e-6] [--output file.json] [--tmp path]\n";
+            return 2;
+        }
+    }
+
+    // topographicDistanceMap still reads a part of each line of sight: limited size
+    std::vector<benchmarkCase> cases = {
+        {"readEsriGrid", 16384, runReadEsriGrid},
+        {"mapEsriGrid", 16384, runMapEsriGrid},
+        {"copyMappedGrid", 16384, runCopyMappedGrid},
+        {"computeSlopeAspectMaps", 16384, runSlopeAspect},
+        {"updateMinMaxRasterGrid", 16384, runUpdateMinMax},
+        {"getStatistics", 16384, runStatistics},
+        {"updateColorScale", 16384, runColorScaleWindows},
+        {"updateColorScaleWrites", 16384, runColorScaleWrites},
+        {"mapAlgebra", 16384, runMapAlgebra},
+        {"mapAlgebraGrids", 16384, runMapAlgebraGrids},
+        {"mapAlgebraAligned", 16384, runMapAlgebraAligned},
+        {"evaluateExpression", 16384, runRasterExpression},
+        {"prevailingMap", 16384, runPrevailingMap},
+        {"resampleGrid", 16384, runResampleBilinear},
+        {"topographicDistanceMap", 2048, runTopographicDistance},
+        {"computeViewshed", 16384, runViewshed},
+        {"computeViewshedCount", 16384, runViewshedCount},
+        {"latLonToUtm", 16384, runLatLonToUtm}
+    };
+
+    std::map<std::string, benchmarkChecksum> reference;
+    if (! isWriteReference && ! readReference(referenceFileName, reference))
+        std::cerr << "Warning: reference file " << referenceFileName << " not found, results not checked\n";
+
+    std::ostringstream json;
+    json.precision(10);
+    json << "{\n  \"results\": [";
+
+    std::ostringstream newReference;
+    newReference.precision(17);
+    newReference << "# gis benchmark reference: function size nrValues sum\n"
+                 << "# written by GIS_BENCHMARK --write-reference\n";
+
+    int nrFailed = 0;
+    bool isFirst = true;
+    for (int size : sizes)
+    {
+        gis::Crit3DRasterGrid dtm;
+        if (! initializeSyntheticDtm(size, &dtm))
+        {
+            std::cerr << "Error: synthetic DTM " << size << " not allocated\n";
+            return 1;
+        }
+
+        std::string fileName = tmpPath + "/gisBenchmark_" + std::to_string(size);
+        std::string error;
+        if (! gis::writeEsriGrid(fileName, &dtm, &error))
+        {
+            std::cerr << "Error in write " << fileName << ": " << error << "\n";
+            return 1;
+        }
+
+        for (const benchmarkCase& myCase : cases)
+        {
+            if (size > myCase.maxSize) continue;
+
+            for (int threads : nrThreads)
+            {
+                gis::setNrThreads(threads);
+                benchmarkChecksum checksum;
+                double seconds = myCase.run(dtm, fileName, &checksum);
+                if (seconds == NODATA)
+                {
+                    std::cerr << "Error in " << myCase.name << " size " << size << "\n";
+                    nrFailed++;
+                    continue;
+                }
+
+                std::string key = referenceKey(myCase.name, size);
+                std::string check = "unchecked";
+                if (reference.count(key) > 0)
+                {
+                    check = isEqualChecksum(checksum, reference[key], tolerance) ? "ok" : "failed";
+                    if (check == "failed")
+                    {
+                        std::cerr << "Checksum failed: " << key << " threads " << threads << "\n";
+                        nrFailed++;
+                    }
+                }
+                if (isWriteReference && threads == nrThreads[0])
+                    newReference << key << " " << checksum.nrValues << " " << checksum.sum << "\n";
+
+                json << (isFirst ? "\n" : ",\n");
+                isFirst = false;
+                json << "    {\"function\": \"" << myCase.name << "\", \"size\": " << size
+                     << ", \"threads\": " << threads << ", \"seconds\": " << seconds
+                     << ", \"cellsPerSecond\": " << double(size) * size / std::max(seconds, 1e-9)
+                     << ", \"check\": \"" << check << "\"}";
+            }
+        }
+
+        remove((fileName + ".hdr").c_str());
+        remove((fileName + ".flt").c_str());
+    }
+    gis::setNrThreads(0);
+
+    json << "\n  ],\n  \"failed\": " << nrFailed << "\n}\n";
+
+    if (isWriteReference)
+    {
+        std::ofstream file(referenceFileName);
+        file << newReference.str();
+    }
+
+    if (outputFileName.empty())
+        std::cout << json.str();
+    else
+    {
+        std::ofstream file(outputFileName);
+        file << json.str();
+    }
+
+    return (nrFailed > 0) ? 1 : 0;
+}
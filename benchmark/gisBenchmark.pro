@@ -0,0 +1,42 @@
+#-----------------------------------------------------------
+#
+# Terrain-3D gis benchmark
+# cells/second of the gis raster functions on synthetic DTMs,
+# checked against the reference checksums (gisReference.txt)
+#
+# ./GIS_BENCHMARK --sizes 1024,2048,4096 --threads 1,4 --reference gisReference.txt
+#
+#-----------------------------------------------------------
+
+QT       -= core gui
+
+TARGET = GIS_BENCHMARK
+TEMPLATE = app
+
+CONFIG += c++11 console thread
+CONFIG -= qt app_bundle
+
+# as in Terrain3D.pro: -O3 to vectorize the rasterExpression.h row loops
+gcc|clang {
+    QMAKE_CXXFLAGS_RELEASE -= -O2
+    QMAKE_CXXFLAGS_RELEASE += -O3
+}
+
+INCLUDEPATH += ../gis
+
+SOURCES += gisBenchmark.cpp \
+    ../gis/color.cpp \
+    ../gis/gis.cpp \
+    ../gis/gisIO.cpp \
+    ../gis/parallel.cpp \
+    ../gis/simdKernels.cpp
+
+HEADERS += \
+    ../gis/commonConstants.h \
+    ../gis/color.h \
+    ../gis/gis.h \
+    ../gis/parallel.h \
+    ../gis/rasterExpression.h \
+    ../gis/simdKernels.h
+
+OTHER_FILES += gisReference.txt
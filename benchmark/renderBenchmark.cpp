@@ -0,0 +1,343 @@
+/*!
+    \file renderBenchmark.cpp
+
+    \abstract Headless benchmark of the terrain rendering
+
+    Renders offscreen (QOffscreenSurface and framebuffer object, no window),
+    so it runs without a GPU, e.g. on Mesa llvmpipe:
+        QT_QPA_PLATFORM=offscreen ./RENDER_BENCHMARK [dataPath] [outputFile.json]
+
+    For each DTM (the DEMs in dataPath, their bilinear upscaling and synthetic
+    fractal DTMs of increasing size) and each rendering mode (mesh, heightmap)
+    it measures: geometry and mesh build times, upload time and the frame times
+    of a scripted camera orbit (p50, p99), reported as JSON.
+*/
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#include <QGuiApplication>
+#include <QSurfaceFormat>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFile>
+#include <QTextStream>
+
+#include "commonConstants.h"
+#include "color.h"
+#include "gis.h"
+#include "syntheticDtm.h"
+#include "geometry.h"
+#include "terrainRenderer.h"
+
+#define BENCHMARK_WIDTH 1280
+#define BENCHMARK_HEIGHT 720
+#define BENCHMARK_NR_FRAMES 120
+#define BENCHMARK_ELEVATION 60.f
+
+
+/*!
+ * \brief bilinear upscaling of a DTM: cellSize / factor, nodata where a corner is nodata
+ */
+static bool upscaleGrid(const gis::Crit3DRasterGrid& dtm, int factor, gis::Crit3DRasterGrid* outputGrid)
+{
+    if (! dtm.isLoaded || factor < 1) return false;
+
+    gis::Crit3DRasterHeader header;
+    header.nrRows = dtm.header->nrRows * factor;
+    header.nrCols = dtm.header->nrCols * factor;
+    header.cellSize = dtm.header->cellSize / factor;
+    header.flag = dtm.header->flag;
+    header.llCorner->x = dtm.header->llCorner->x;
+    header.llCorner->y = dtm.header->llCorner->y;
+    if (! outputGrid->initializeGrid(header)) return false;
+
+    float flag = dtm.header->flag;
+    for (int row = 0; row < header.nrRows; row++)
+    {
+        float y = (row + 0.5f) / factor - 0.5f;
+        int row0 = std::min(std::max(int(floorf(y)), 0), dtm.header->nrRows - 1);
+        int row1 = std::min(row0 + 1, dtm.header->nrRows - 1);
+        float dy = std::min(std::max(y - row0, 0.f), 1.f);
+
+        for (int col = 0; col < header.nrCols; col++)
+        {
+            float x = (col + 0.5f) / factor - 0.5f;
+            int col0 = std::min(std::max(int(floorf(x)), 0), dtm.header->nrCols - 1);
+            int col1 = std::min(col0 + 1, dtm.header->nrCols - 1);
+            float dx = std::min(std::max(x - col0, 0.f), 1.f);
+
+            float z00 = dtm.value[row0][col0];
+            float z01 = dtm.value[row0][col1];
+            float z10 = dtm.value[row1][col0];
+            float z11 = dtm.value[row1][col1];
+            if (z00 == flag || z01 == flag || z10 == flag || z11 == flag)
+                outputGrid->value[row][col] = flag;
+            else
+                outputGrid->value[row][col] = (z00 * (1 - dx) + z01 * dx) * (1 - dy)
+                                            + (z10 * (1 - dx) + z11 * dx) * dy;
+        }
+    }
+
+    gis::updateMinMaxRasterGrid(outputGrid);
+    return true;
+}
+
+
+static double percentile(std::vector<double> values, double p)
+{
+    if (values.empty()) return NODATA;
+
+    std::sort(values.begin(), values.end());
+    size_t index = size_t(ceil(p * values.size())) - 1;
+    return values[std::min(index, values.size() - 1)];
+}
+
+
+static double elapsedMs(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() * 1e-6;
+}
+
+
+/*!
+ * \brief scripted camera orbit as in Crit3DOpenGLWidget::paintGL:
+ * full turn around the vertical axis, distance between 0.5 and 1 times the default
+ */
+static QMatrix4x4 orbitModelView(const Crit3DGeometry &geometry, int frame)
+{
+    float angle = 360.f * frame / BENCHMARK_NR_FRAMES;
+    float zoom = geometry.defaultDistance() * (0.75f + 0.25f * cosf(angle * float(DEG_TO_RAD)));
+
+    QMatrix4x4 camera;
+    camera.translate(0, 0, -zoom);
+
+    QMatrix4x4 world;
+    world.rotate(-BENCHMARK_ELEVATION, 1, 0, 0);
+    world.rotate(angle, 0, 0, 1);
+
+    return camera * world;
+}
+
+
+static QJsonObject benchmarkMode(Crit3DGeometry &geometry, bool isHeightmapMode, QOpenGLFunctions *f)
+{
+    QJsonObject result;
+    result["mode"] = isHeightmapMode ? "heightmap" : "mesh";
+
+    Crit3DTerrainRenderer renderer;
+    QElapsedTimer timer;
+
+    // upload: vertex buffer and tile quadtree, textures in heightmap mode
+    renderer.setHeightmapMode(isHeightmapMode);
+    f->glFinish();
+    timer.start();
+    bool isOk = renderer.initialize(&geometry) && renderer.isHeightmapMode() == isHeightmapMode;
+    f->glFinish();
+    result["uploadMs"] = elapsedMs(timer);
+
+    if (! isOk)
+    {
+        result["error"] = "initialization failed";
+        renderer.clear();
+        return result;
+    }
+
+    renderer.setViewport(BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+    f->glViewport(0, 0, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+
+    // first frame: index buffers of the mesh mode are built on demand
+    timer.start();
+    f->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    renderer.render(orbitModelView(geometry, 0), geometry.magnify());
+    f->glFinish();
+    result["firstFrameMs"] = elapsedMs(timer);
+
+    std::vector<double> frameTimes;
+    double sumTiles = 0;
+    for (int frame = 0; frame < BENCHMARK_NR_FRAMES; frame++)
+    {
+        QMatrix4x4 modelView = orbitModelView(geometry, frame);
+
+        timer.start();
+        f->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderer.render(modelView, geometry.magnify());
+        f->glFinish();
+        frameTimes.push_back(elapsedMs(timer));
+
+        sumTiles += renderer.nrDrawnTiles();
+    }
+
+    result["frameP50Ms"] = percentile(frameTimes, 0.5);
+    result["frameP99Ms"] = percentile(frameTimes, 0.99);
+    if (! isHeightmapMode)
+        result["meanTiles"] = sumTiles / BENCHMARK_NR_FRAMES;
+
+    renderer.clear();
+    return result;
+}
+
+
+static QJsonObject benchmarkDtm(const std::string &name, gis::Crit3DRasterGrid &dtm, QOpenGLFunctions *f)
+{
+    QJsonObject result;
+    result["dtm"] = QString::fromStdString(name);
+    result["rows"] = dtm.header->nrRows;
+    result["cols"] = dtm.header->nrCols;
+
+    gis::Crit3DRasterGrid slopeMap, aspectMap;
+    gis::Crit3DColorGrid shadedColors;
+    Crit3DGeometry geometry;
+    QElapsedTimer timer;
+
+    if (! gis::computeSlopeAspectMaps(dtm, &slopeMap, &aspectMap))
+    {
+        result["error"] = "slope and aspect failed";
+        return result;
+    }
+    setDefaultDTMScale(dtm.colorScale);
+
+    // geometry build: frame and shaded colors, as MainWindow::initializeGeometry
+    timer.start();
+    if (! buildTerrainGeometry(dtm, slopeMap, aspectMap, &shadedColors, &geometry))
+    {
+        result["error"] = "geometry failed";
+        return result;
+    }
+    result["geometryBuildMs"] = elapsedMs(timer);
+
+    // heightmap mode first: the mesh is not built
+    QJsonArray modes;
+    modes.append(benchmarkMode(geometry, true, f));
+
+    // mesh build: vertices, needed only by the mesh mode
+    timer.start();
+    if (! buildTerrainMesh(&geometry))
+    {
+        result["error"] = "mesh failed";
+        return result;
+    }
+    result["meshBuildMs"] = elapsedMs(timer);
+    result["vertices"] = double(geometry.vertexCount());
+
+    modes.append(benchmarkMode(geometry, false, f));
+    result["modes"] = modes;
+
+    return result;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setDepthBufferSize(24);
+    QSurfaceFormat::setDefaultFormat(format);
+
+    QGuiApplication app(argc, argv);
+
+    QString dataPath = (argc > 1) ? QString(argv[1]) : QString("DATA");
+    QString outputFileName = (argc > 2) ? QString(argv[2]) : QString();
+
+    QOpenGLContext context;
+    context.setFormat(format);
+    if (! context.create())
+    {
+        QTextStream(stderr) << "Error: OpenGL 3.3 context not available\n";
+        return 1;
+    }
+
+    QOffscreenSurface surface;
+    surface.setFormat(context.format());
+    surface.create();
+    if (! context.makeCurrent(&surface))
+    {
+        QTextStream(stderr) << "Error: offscreen surface not available\n";
+        return 1;
+    }
+
+    QOpenGLFramebufferObject fbo(BENCHMARK_WIDTH, BENCHMARK_HEIGHT, QOpenGLFramebufferObject::CombinedDepthStencil);
+    fbo.bind();
+    QOpenGLFunctions *f = context.functions();
+
+    QJsonObject report;
+    report["renderer"] = QString(reinterpret_cast<const char*>(f->glGetString(GL_RENDERER)));
+    report["width"] = BENCHMARK_WIDTH;
+    report["height"] = BENCHMARK_HEIGHT;
+    report["frames"] = BENCHMARK_NR_FRAMES;
+
+    const char* dtmNames[] = {"DEM_Ravone", "DEM_Fontanafredda_10m"};
+    const int scaleFactors[] = {1, 2, 4};
+
+    QJsonArray results;
+    for (const char* dtmName : dtmNames)
+    {
+        std::string fileName = (dataPath + "/" + dtmName).toStdString();
+        std::string error;
+        gis::Crit3DRasterGrid dtm;
+        if (! gis::mapEsriGrid(fileName, &dtm, &error))
+        {
+            QTextStream(stderr) << "Error in load DTM " << QString::fromStdString(fileName)
+                                << ": " << QString::fromStdString(error) << "\n";
+            return 1;
+        }
+        gis::setMinMaxFromStatistics(&dtm);
+
+        for (int factor : scaleFactors)
+        {
+            std::string name = std::string(dtmName) + "_x" + std::to_string(factor);
+            if (factor == 1)
+            {
+                results.append(benchmarkDtm(name, dtm, f));
+                continue;
+            }
+
+            gis::Crit3DRasterGrid scaledDtm;
+            if (upscaleGrid(dtm, factor, &scaledDtm))
+                results.append(benchmarkDtm(name, scaledDtm, f));
+        }
+    }
+
+    // synthetic fractal DTMs: 10 m cells, some nodata holes
+    const int syntheticSizes[] = {1024, 2048, 4096};
+    for (int size : syntheticSizes)
+    {
+        gis::Crit3DSyntheticDtmSettings settings;
+        settings.nrRows = size;
+        settings.nrCols = size;
+        settings.nodataFraction = 0.02f;
+
+        gis::Crit3DRasterGrid dtm;
+        if (gis::computeSyntheticDtm(settings, &dtm))
+            results.append(benchmarkDtm("synthetic_" + std::to_string(size), dtm, f));
+    }
+    report["results"] = results;
+
+    fbo.release();
+    context.doneCurrent();
+
+    QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (outputFileName.isEmpty())
+    {
+        QTextStream(stdout) << json;
+        return 0;
+    }
+
+    QFile outputFile(outputFileName);
+    if (! outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        QTextStream(stderr) << "Error: cannot write " << outputFileName << "\n";
+        return 1;
+    }
+    outputFile.write(json);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#-----------------------------------------------------------
+#
+# Terrain-3D render benchmark
+# headless (offscreen) rendering of the terrain: mesh build,
+# upload and frame times, reported as JSON
+#
+# run without display:
+# QT_QPA_PLATFORM=offscreen ./RENDER_BENCHMARK ../DATA benchmark.json
+#
+#-----------------------------------------------------------
+
+QT       += core gui
+greaterThan(QT_MAJOR_VERSION, 5): QT += opengl
+
+TARGET = RENDER_BENCHMARK
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += .. ../gis
+
+SOURCES += renderBenchmark.cpp \
+    ../geometry.cpp \
+    ../gis/color.cpp \
+    ../gis/gis.cpp \
+    ../gis/gisIO.cpp \
+    ../gis/parallel.cpp \
+    ../gis/simdKernels.cpp \
+    ../gis/syntheticDtm.cpp \
+    ../terrainHeightmap.cpp \
+    ../terrainLOD.cpp \
+    ../terrainRenderer.cpp
+
+HEADERS += \
+    ../geometry.h \
+    ../gis/commonConstants.h \
+    ../gis/color.h \
+    ../gis/gis.h \
+    ../gis/parallel.h \
+    ../gis/simdKernels.h \
+    ../gis/syntheticDtm.h \
+    ../terrainHeightmap.h \
+    ../terrainLOD.h \
+    ../terrainRenderer.h
@@ -0,0 +1,75 @@
+/*!
+    \file syntheticDtmTool.cpp
+
+    \abstract Write a synthetic fractal DTM (ESRI grid) of any size
+
+    The grid is computed and written band by band, so 50000 x 50000 grids
+    need only bandRows x nrCols cells of memory:
+        ./SYNTHETIC_DTM output --rows 50000 --cols 50000 --seed 7 --roughness 0.55 --nodata 0.02
+
+    This file is part of CRITERIA3D.
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "gis.h"
+#include "syntheticDtm.h"
+
+#define DEFAULT_BAND_ROWS 256
+
+
+int main(int argc, char *argv[])
+{
+    gis::Crit3DSyntheticDtmSettings settings;
+    int bandRows = DEFAULT_BAND_ROWS;
+    std::string fileName = "";
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--rows" && hasValue) settings.nrRows = atoi(argv[++i]);
+        else if (arg == "--cols" && hasValue) settings.nrCols = atoi(argv[++i]);
+        else if (arg == "--cellsize" && hasValue) settings.cellSize = atof(argv[++i]);
+        else if (arg == "--xll" && hasValue) settings.xllCorner = atof(argv[++i]);
+        else if (arg == "--yll" && hasValue) settings.yllCorner = atof(argv[++i]);
+        else if (arg == "--seed" && hasValue) settings.seed = unsigned(strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--minimum" && hasValue) settings.minimumElevation = float(atof(argv[++i]));
+        else if (arg == "--relief" && hasValue) settings.relief = float(atof(argv[++i]));
+        else if (arg == "--feature" && hasValue) settings.featureSize = atof(argv[++i]);
+        else if (arg == "--roughness" && hasValue) settings.roughness = float(atof(argv[++i]));
+        else if (arg == "--nodata" && hasValue) settings.nodataFraction = float(atof(argv[++i]));
+        else if (arg == "--band" && hasValue) bandRows = atoi(argv[++i]);
+        else if (arg[0] != '-' && fileName.empty()) fileName = arg;
+        else
+        {
+            fileName = "";
+            break;
+        }
+    }
+
+    if (fileName.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " outputFile (without extension)\n"
+                  << "    [--rows 1000] [--cols 1000] [--cellsize 10] [--xll 600000] [--yll 4900000]\n"
+                  << "    [--seed 1] [--minimum 0] [--relief 1500] [--feature 10000]\n"
+                  << "    [--roughness 0.5] [--nodata 0] [--band " << DEFAULT_BAND_ROWS << "]\n";
+        return 2;
+    }
+
+    std::string error;
+    auto start = std::chrono::steady_clock::now();
+    if (! gis::writeSyntheticDtm(fileName, settings, bandRows, &error))
+    {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << fileName << ": " << settings.nrRows << " x " << settings.nrCols << " cells in "
+              << seconds << " s (" << double(settings.nrRows) * settings.nrCols / seconds << " cells/s)\n";
+    return 0;
+}
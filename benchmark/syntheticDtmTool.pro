@@ -0,0 +1,35 @@
+#-----------------------------------------------------------
+#
+# Terrain-3D synthetic DTM generator
+# reproducible fractal DTMs of any size (ESRI grid),
+# written band by band
+#
+# ./SYNTHETIC_DTM output --rows 50000 --cols 50000 --seed 7 --nodata 0.02
+#
+#-----------------------------------------------------------
+
+QT       -= core gui
+
+TARGET = SYNTHETIC_DTM
+TEMPLATE = app
+
+CONFIG += c++11 console thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../gis
+
+SOURCES += syntheticDtmTool.cpp \
+    ../gis/color.cpp \
+    ../gis/gis.cpp \
+    ../gis/gisIO.cpp \
+    ../gis/parallel.cpp \
+    ../gis/simdKernels.cpp \
+    ../gis/syntheticDtm.cpp
+
+HEADERS += \
+    ../gis/commonConstants.h \
+    ../gis/color.h \
+    ../gis/gis.h \
+    ../gis/parallel.h \
+    ../gis/simdKernels.h \
+    ../gis/syntheticDtm.h
@@ -1,5 +1,7 @@
+#include "parallel.h"
 #include "geometry.h"
 
+
 Crit3DGeometry::Crit3DGeometry()
 {
     this->clear();
@@ -16,8 +18,17 @@ void Crit3DGeometry::clear()
     m_magnify = 1;
     m_artifactSlope = 60;
 
+    m_nrRows = 0;
+    m_nrCols = 0;
+    m_cellSize = 0;
+    m_xFirst = 0;
+    m_yFirst = 0;
+
+    m_dtm = nullptr;
+    m_colors = nullptr;
+    m_drapedColors.clear();
     m_vertices.clear();
-    m_colors.clear();
+    m_vertexIndex.clear();
 }
 
 
@@ -34,50 +45,300 @@ void Crit3DGeometry::setDimension(float dx, float dy)
     m_dy = dy;
 }
 
-void Crit3DGeometry::addTriangle(const gis::Crit3DPoint &p1, const gis::Crit3DPoint &p2, const gis::Crit3DPoint &p3,
-                                 const Crit3DColor &c1, const Crit3DColor &c2, const Crit3DColor &c3)
+/*!
+ * \brief set the DTM grid
+ * \param xFirst, yFirst   utm coordinates of the cell (0, 0)
+ */
+void Crit3DGeometry::setGrid(int nrRows, int nrCols, float cellSize, float xFirst, float yFirst)
 {
-    addVertex(p1);
-    addVertexColor(c1);
-    addVertex(p2);
-    addVertexColor(c2);
-    addVertex(p3);
-    addVertexColor(c3);
+    m_nrRows = nrRows;
+    m_nrCols = nrCols;
+    m_cellSize = cellSize;
+    m_xFirst = xFirst - m_xCenter;
+    m_yFirst = yFirst - m_yCenter;
 }
 
-void Crit3DGeometry::addVertex(const gis::Crit3DPoint &v)
+/*!
+ * \brief set the rasters of heights and displayed colors: they must outlive the geometry
+ */
+void Crit3DGeometry::setRasters(const gis::Crit3DRasterGrid *dtm, const gis::Crit3DColorGrid *colors)
 {
-    m_vertices.push_back(v.utm.x - m_xCenter);
-    m_vertices.push_back(v.utm.y - m_yCenter);
-    m_vertices.push_back((v.z - m_zCenter) * m_magnify);
+    m_dtm = dtm;
+    m_colors = colors;
+}
 
+/*!
+ * \brief allocate the mesh: one vertex for each valid cell, all cells start as nodata
+ */
+void Crit3DGeometry::setVertexCount(long nrVertices)
+{
+    m_vertices.resize(size_t(nrVertices));
+    m_vertexIndex.assign(size_t(m_nrRows) * size_t(m_nrCols), NODATA_VERTEX);
 }
 
-void Crit3DGeometry::addVertexColor(const Crit3DColor &color)
+/*!
+ * \brief set the shared vertex of the cell (row, col)
+ * different vertices can be set concurrently
+ */
+void Crit3DGeometry::setVertex(GLuint index, int row, int col, const gis::Crit3DPoint &v, const Crit3DColor &color)
 {
-    m_colors.push_back(color.red);
-    m_colors.push_back(color.green);
-    m_colors.push_back(color.blue);
+    Crit3DVertex &vertex = m_vertices[index];
+    vertex.x = GLfloat(v.utm.x - m_xCenter);
+    vertex.y = GLfloat(v.utm.y - m_yCenter);
+    vertex.z = GLfloat(v.z - m_zCenter);
+    vertex.red = GLubyte(color.red);
+    vertex.green = GLubyte(color.green);
+    vertex.blue = GLubyte(color.blue);
+    vertex.alpha = 255;
+
+    m_vertexIndex[size_t(row) * size_t(m_nrCols) + size_t(col)] = index;
+}
+
+/*!
+ * \brief append the triangle strips between two rows of vertex indices
+ * each quad is split on the diagonal upper[i] - lower[i+1], strip order
+ * lower[i], upper[i], lower[i+1], upper[i+1] ...
+ * quads with a missing corner are appended as single triangles
+ * \param upper, lower     vertex indices (NODATA_VERTEX = missing)
+ * \param nrSamples        number of vertices of each row
+ * \param indices          strips separated by PRIMITIVE_RESTART_INDEX
+ */
+void Crit3DGeometry::appendStrips(const GLuint *upper, const GLuint *lower, int nrSamples, std::vector<GLuint> &indices)
+{
+    bool isStripOpen = false;
+
+    for (int i = 0; i < nrSamples - 1; i++)
+    {
+        GLuint i1 = upper[i];
+        GLuint i2 = lower[i];
+        GLuint i3 = lower[i+1];
+        GLuint i4 = upper[i+1];
+
+        if (i1 != NODATA_VERTEX && i2 != NODATA_VERTEX && i3 != NODATA_VERTEX && i4 != NODATA_VERTEX)
+        {
+            if (! isStripOpen)
+            {
+                indices.push_back(i2);
+                indices.push_back(i1);
+                isStripOpen = true;
+            }
+            indices.push_back(i3);
+            indices.push_back(i4);
+            continue;
+        }
+
+        if (isStripOpen)
+        {
+            indices.push_back(PRIMITIVE_RESTART_INDEX);
+            isStripOpen = false;
+        }
+
+        if (i1 != NODATA_VERTEX && i3 != NODATA_VERTEX)
+        {
+            if (i2 != NODATA_VERTEX)
+            {
+                indices.push_back(i1);
+                indices.push_back(i2);
+                indices.push_back(i3);
+                indices.push_back(PRIMITIVE_RESTART_INDEX);
+            }
+            if (i4 != NODATA_VERTEX)
+            {
+                indices.push_back(i3);
+                indices.push_back(i4);
+                indices.push_back(i1);
+                indices.push_back(PRIMITIVE_RESTART_INDEX);
+            }
+        }
+    }
+
+    if (isStripOpen)
+        indices.push_back(PRIMITIVE_RESTART_INDEX);
 }
 
 void Crit3DGeometry::setVertexColor(int i, const Crit3DColor &color)
 {
-    if (i > vertexCount()) return;
+    if (i >= vertexCount()) return;
 
-    m_colors[i*3] = color.red;
-    m_colors[i*3+1] = color.green;
-    m_colors[i*3+2] = color.blue;
+    m_vertices[unsigned(i)].red = color.red;
+    m_vertices[unsigned(i)].green = color.green;
+    m_vertices[unsigned(i)].blue = color.blue;
 }
 
 
+/*!
+ * \brief set the vertical exaggeration: vertices keep the unscaled z,
+ * the factor is applied by the vertex shader
+ */
 void Crit3DGeometry::setMagnify(float magnify)
 {
-    float ratio = magnify / m_magnify;
+    m_magnify = magnify;
+}
+
+
+/*!
+ * \brief build the terrain geometry of a DTM: center, dimension, magnify and shaded colors.
+ * The mesh is not built (see buildTerrainMesh): the heightmap renderer draws the rasters directly.
+ * dtm and shadedColors must outlive the geometry.
+ * used by the main window and by the render benchmark
+ */
+bool buildTerrainGeometry(gis::Crit3DRasterGrid &dtm, const gis::Crit3DRasterGrid &slopeMap,
+                          const gis::Crit3DRasterGrid &aspectMap, gis::Crit3DColorGrid *shadedColors,
+                          Crit3DGeometry *geometry)
+{
+    if (! dtm.isLoaded)
+        return false;
+
+    geometry->clear();
+
+    // set center
+    double xCenter, yCenter;
+    gis::getUtmXYFromRowCol(dtm, dtm.header->nrRows / 2, dtm.header->nrCols / 2, &xCenter, &yCenter);
+    gis::setMinMaxFromStatistics(&dtm);
+    float zCenter = (dtm.maximum + dtm.minimum) * 0.5f;
+    geometry->setCenter(float(xCenter), float(yCenter), zCenter);
+
+    // set dimension
+    float dx = float(dtm.header->nrCols * dtm.header->cellSize);
+    float dy = float(dtm.header->nrRows * dtm.header->cellSize);
+    float dz = dtm.maximum + dtm.minimum;
+    geometry->setDimension(dx, dy);
+
+    // set magnify
+    float magnify = ((dx + dy) * 0.5f) / (dz * 10.f);
+    geometry->setMagnify(std::min(5.f, std::max(1.f, magnify)));
+
+    double xFirst, yFirst;
+    gis::getUtmXYFromRowCol(dtm, 0, 0, &xFirst, &yFirst);
+    geometry->setGrid(dtm.header->nrRows, dtm.header->nrCols, float(dtm.header->cellSize), float(xFirst), float(yFirst));
+
+    // shaded colors: computed once for each cell
+    if (! gis::computeShadedColorGrid(dtm, slopeMap, aspectMap, float(geometry->artifactSlope()), shadedColors))
+        return false;
 
-    for (int i = 0; i < vertexCount(); i++)
+    geometry->setRasters(&dtm, shadedColors);
+    return true;
+}
+
+
+/*!
+ * \brief build the mesh of the geometry: one shared vertex for each valid cell of the DTM,
+ * with the displayed colors; the triangles are built by the level of detail renderer.
+ * Needed only by the mesh renderer (16 bytes for each valid cell, 4 bytes for each cell)
+ */
+bool buildTerrainMesh(Crit3DGeometry *geometry)
+{
+    const gis::Crit3DRasterGrid *dtm = geometry->dtm();
+    const gis::Crit3DColorGrid *colors = geometry->colors();
+    if (dtm == nullptr || colors == nullptr || ! dtm->isLoaded)
+        return false;
+
+    int nrRows = dtm->header->nrRows;
+    int nrCols = dtm->header->nrCols;
+
+    // first pass: valid cells of each row, i.e. index of the first vertex of each row
+    std::vector<long> firstVertex(size_t(nrRows) + 1, 0);
+    gis::parallelFor(0, nrRows, 16, [&](int firstRow, int lastRow)
     {
-        m_vertices[i*3+2] *= ratio;
+        for (int row = firstRow; row < lastRow; row++)
+        {
+            long nrValid = 0;
+            for (int col = 0; col < nrCols; col++)
+                if (dtm->value[row][col] != dtm->header->flag)
+                    nrValid++;
+            firstVertex[size_t(row) + 1] = nrValid;
+        }
+    });
+    for (int row = 0; row < nrRows; row++)
+        firstVertex[size_t(row) + 1] += firstVertex[size_t(row)];
+
+    // second pass: row blocks fill the exactly sized vertex buffer concurrently
+    geometry->setVertexCount(firstVertex[size_t(nrRows)]);
+    gis::parallelFor(0, nrRows, 16, [&](int firstRow, int lastRow)
+    {
+        double x, y;
+        for (int row = firstRow; row < lastRow; row++)
+        {
+            GLuint index = GLuint(firstVertex[size_t(row)]);
+            for (int col = 0; col < nrCols; col++)
+            {
+                float z = dtm->value[row][col];
+                if (z == dtm->header->flag) continue;
+
+                gis::getUtmXYFromRowCol(*dtm, row, col, &x, &y);
+                const unsigned char* rgba = colors->getRGBA(row, col);
+                geometry->setVertex(index++, row, col, gis::Crit3DPoint(x, y, z), Crit3DColor(rgba[0], rgba[1], rgba[2]));
+            }
+        }
+    });
+
+    return true;
+}
+
+
+/*!
+ * \brief drape a visibility map (e.g. a viewshed) on the terrain: the cells with value 0
+ * are darkened and tinted blue, the others keep the shaded colors (draped colors of the geometry).
+ * With visibilityMap = nullptr the shaded colors are restored.
+ * The vertex colors of the mesh, if built, are updated too: the colors must be uploaded
+ * again (Crit3DOpenGLWidget::updateColors)
+ */
+bool drapeVisibilityMap(const gis::Crit3DRasterGrid *visibilityMap, const gis::Crit3DColorGrid &shadedColors,
+                        Crit3DGeometry *geometry)
+{
+    int nrRows = geometry->nrRows();
+    int nrCols = geometry->nrCols();
+    if (shadedColors.nrRows != nrRows || shadedColors.nrCols != nrCols)
+        return false;
+    if (visibilityMap != nullptr && (visibilityMap->header->nrRows != nrRows || visibilityMap->header->nrCols != nrCols))
+        return false;
+
+    gis::Crit3DColorGrid *drapedColors = geometry->drapedColors();
+    if (visibilityMap == nullptr)
+    {
+        drapedColors->clear();
+        geometry->setColors(&shadedColors);
+    }
+    else
+    {
+        *drapedColors = shadedColors;
+        geometry->setColors(drapedColors);
     }
 
-    m_magnify = magnify;
+    gis::parallelFor(0, nrRows, 16, [&](int firstRow, int lastRow)
+    {
+        for (int row = firstRow; row < lastRow; row++)
+            for (int col = 0; col < nrCols; col++)
+            {
+                const unsigned char* rgba = shadedColors.getRGBA(row, col);
+                if (rgba[3] == 0) continue;
+
+                Crit3DColor color(rgba[0], rgba[1], rgba[2]);
+
+                if (visibilityMap != nullptr)
+                {
+                    float value = visibilityMap->value[row][col];
+                    if (value != visibilityMap->header->flag && value <= 0)
+                    {
+                        color.red = short(color.red * 0.4f);
+                        color.green = short(color.green * 0.4f);
+                        color.blue = short(std::min(color.blue * 0.4f + 80.f, 255.f));
+
+                        unsigned char* draped = drapedColors->getRGBA(row, col);
+                        draped[0] = (unsigned char)(color.red);
+                        draped[1] = (unsigned char)(color.green);
+                        draped[2] = (unsigned char)(color.blue);
+                    }
+                }
+
+                if (geometry->isMeshBuilt())
+                {
+                    GLuint index = geometry->vertexIndex(row, col);
+                    if (index != NODATA_VERTEX)
+                        geometry->setVertexColor(int(index), color);
+                }
+            }
+    });
+
+    return true;
 }
@@ -11,6 +11,24 @@
         #include "gis.h"
     #endif
 
+    /*! restart index of the triangle strips (GL_PRIMITIVE_RESTART_FIXED_INDEX for GLuint) */
+    #define PRIMITIVE_RESTART_INDEX 0xFFFFFFFF
+    /*! vertex index of a nodata cell */
+    #define NODATA_VERTEX PRIMITIVE_RESTART_INDEX
+
+    /*!
+     * \brief packed vertex (16 bytes): position and RGBA color interleaved in one buffer
+     */
+    struct Crit3DVertex
+    {
+        GLfloat x, y, z;
+        GLubyte red, green, blue, alpha;
+    };
+
+    /*!
+     * \brief terrain of a DTM: frame (center, dimension, magnify), rasters of heights and
+     * displayed colors (not owned) and the mesh of the mesh renderer, built on demand (buildTerrainMesh)
+     */
     class Crit3DGeometry
     {
     public:
@@ -18,32 +36,50 @@
 
         void clear();
 
-        const GLfloat *getVertices() const { return m_vertices.data(); }
-        const GLubyte *getColors() const { return m_colors.data(); }
+        const gis::Crit3DRasterGrid *dtm() const { return m_dtm; }
+        const gis::Crit3DColorGrid *colors() const { return m_colors; }
+        gis::Crit3DColorGrid *drapedColors() { return &m_drapedColors; }
+        bool isMeshBuilt() const { return ! m_vertexIndex.empty(); }
+
+        const Crit3DVertex *getVertices() const { return m_vertices.data(); }
 
-        long dataCount() const { return long(m_vertices.size()); }
-        long vertexCount() const { return long(m_vertices.size()) / 3; }
+        long vertexCount() const { return long(m_vertices.size()); }
         float defaultDistance() const { return std::max(m_dx, m_dy); }
         float magnify() const { return m_magnify; }
+        float zCenter() const { return m_zCenter; }
         int artifactSlope() const { return m_artifactSlope; }
 
+        int nrRows() const { return m_nrRows; }
+        int nrCols() const { return m_nrCols; }
+        float getX(int col) const { return m_xFirst + col * m_cellSize; }
+        float getY(int row) const { return m_yFirst - row * m_cellSize; }
+        GLuint vertexIndex(int row, int col) const { return m_vertexIndex[size_t(row) * size_t(m_nrCols) + size_t(col)]; }
+
         void setMagnify(float magnify);
         void setArtifactSlope(int artifactSlope){ m_artifactSlope = artifactSlope; }
         void setCenter(float x, float y, float z);
         void setDimension(float dx, float dy);
+        void setGrid(int nrRows, int nrCols, float cellSize, float xFirst, float yFirst);
+        void setRasters(const gis::Crit3DRasterGrid *dtm, const gis::Crit3DColorGrid *colors);
+        void setColors(const gis::Crit3DColorGrid *colors) { m_colors = colors; }
 
-        void addTriangle(const gis::Crit3DPoint &p1, const gis::Crit3DPoint &p2, const gis::Crit3DPoint &p3,
-                         const Crit3DColor &c1, const Crit3DColor &c2, const Crit3DColor &c3);
-
+        void setVertexCount(long nrVertices);
+        void setVertex(GLuint index, int row, int col, const gis::Crit3DPoint &v, const Crit3DColor &color);
         void setVertexColor(int i, const Crit3DColor &color);
 
+        static void appendStrips(const GLuint *upper, const GLuint *lower, int nrSamples, std::vector<GLuint> &indices);
+
     private:
+        const gis::Crit3DRasterGrid *m_dtm;
+        const gis::Crit3DColorGrid *m_colors;
+        gis::Crit3DColorGrid m_drapedColors;
 
-        void addVertex(const gis::Crit3DPoint &v);
-        void addVertexColor(const Crit3DColor &color);
+        std::vector<Crit3DVertex> m_vertices;
+        std::vector<GLuint> m_vertexIndex;
 
-        std::vector<GLfloat> m_vertices;
-        std::vector<GLubyte> m_colors;
+        int m_nrRows, m_nrCols;
+        float m_cellSize;
+        float m_xFirst, m_yFirst;
 
         float m_dx, m_dy;
         float m_xCenter, m_yCenter, m_zCenter;
@@ -51,5 +87,14 @@
         int m_artifactSlope;
     };
 
+    bool buildTerrainGeometry(gis::Crit3DRasterGrid &dtm, const gis::Crit3DRasterGrid &slopeMap,
+                              const gis::Crit3DRasterGrid &aspectMap, gis::Crit3DColorGrid *shadedColors,
+                              Crit3DGeometry *geometry);
+
+    bool buildTerrainMesh(Crit3DGeometry *geometry);
+
+    bool drapeVisibilityMap(const gis::Crit3DRasterGrid *visibilityMap, const gis::Crit3DColorGrid &shadedColors,
+                            Crit3DGeometry *geometry);
+
 
 #endif // GEOMETRY_H
@@ -26,10 +26,20 @@
 
 #include <math.h>
 #include <malloc.h>
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <queue>
 
 #include "commonConstants.h"
 #include "gis.h"
+#include "parallel.h"
+#include "rasterExpression.h"
+#include "simdKernels.h"
 
 namespace gis
 {
@@ -172,44 +182,226 @@ namespace gis
                 (myHeader1.nrRows == myHeader2.nrRows));
     }
 
+    Crit3DRasterStatistics::Crit3DRasterStatistics()
+    {
+        nrValidCells = 0;
+        minimum = NODATA;
+        maximum = NODATA;
+        mean = NODATA;
+        standardDeviation = NODATA;
+    }
+
+    Crit3DRasterBandStatistics::Crit3DRasterBandStatistics()
+    {
+        nrValidCells = 0;
+        minimum = NODATA;
+        maximum = NODATA;
+        mean = 0;
+        sumSquaredDeviations = 0;
+        isUpdated = false;
+        isHistogramUpdated = false;
+        isNormalized = true;
+    }
+
     Crit3DRasterGrid::Crit3DRasterGrid()
     {
         isLoaded = false;
+        isStatisticsUpdated = false;
         timeString = "";
         header = new Crit3DRasterHeader();
         colorScale = new Crit3DColorScale();
         minimum = NODATA;
         maximum = NODATA;
+        nrValidCells = 0;
         value = nullptr;
+        data = nullptr;
+        rowStride = 0;
+        mappedFile = nullptr;
+        mappedSize = 0;
+    }
+
+
+    /*!
+     * \brief allocate and free the cell buffer, aligned to RASTER_ALIGNMENT bytes
+     */
+    static float* allocateRasterBuffer(size_t nrValues)
+    {
+        void* buffer = nullptr;
+    #ifdef _WIN32
+        buffer = _aligned_malloc(nrValues * sizeof(float), RASTER_ALIGNMENT);
+    #else
+        if (posix_memalign(&buffer, RASTER_ALIGNMENT, nrValues * sizeof(float)) != 0)
+            buffer = nullptr;
+    #endif
+        return static_cast<float*>(buffer);
+    }
+
+    static void freeRasterBuffer(float* buffer)
+    {
+    #ifdef _WIN32
+        _aligned_free(buffer);
+    #else
+        ::free(buffer);
+    #endif
+    }
+
+
+    /*!
+     * \brief count, minimum, maximum and sums of the deviations from shift of the valid cells of a row
+     * SIMD kernel, scalar path for the last columns
+     */
+    static size_t rowStatistics(const float* row, int nrCols, float flag, float shift,
+                                float* minimum, float* maximum, double* sum, double* sumSquares)
+    {
+        size_t nrValid = 0;
+        int firstCol = computeRowStatistics(row, nrCols, flag, shift, &nrValid, minimum, maximum, sum, sumSquares);
+
+        for (int col = firstCol; col < nrCols; col++)
+        {
+            float value = row[col];
+            if (value == flag) continue;
+
+            nrValid++;
+            *minimum = std::min(*minimum, value);
+            *maximum = std::max(*maximum, value);
+            double deviation = double(value - shift);
+            *sum += deviation;
+            *sumSquares += deviation * deviation;
+        }
+
+        return nrValid;
+    }
+
+
+    /*!
+     * \brief statistics of the rows [firstRow, lastRow) of a band
+     * the deviations are summed from the first valid value, so that the sum of squares
+     * does not cancel out on large values with a small variance
+     */
+    static void computeBandStatistics(const Crit3DRasterGrid& myGrid, int firstRow, int lastRow,
+                                      Crit3DRasterBandStatistics* band)
+    {
+        float flag = myGrid.header->flag;
+        int nrCols = myGrid.header->nrCols;
+
+        float shift = 0;
+        bool isFound = false;
+        for (int row = firstRow; row < lastRow && ! isFound; row++)
+            for (int col = 0; col < nrCols; col++)
+                if (myGrid.value[row][col] != flag)
+                {
+                    shift = myGrid.value[row][col];
+                    isFound = true;
+                    break;
+                }
+
+        size_t nrValid = 0;
+        float minimum = FLT_MAX;
+        float maximum = -FLT_MAX;
+        double sum = 0, sumSquares = 0;
+        if (isFound)
+        {
+            for (int row = firstRow; row < lastRow; row++)
+                nrValid += rowStatistics(myGrid.value[row], nrCols, flag, shift, &minimum, &maximum, &sum, &sumSquares);
+        }
+
+        band->nrValidCells = nrValid;
+        if (nrValid == 0)
+        {
+            band->minimum = NODATA;
+            band->maximum = NODATA;
+            band->mean = 0;
+            band->sumSquaredDeviations = 0;
+        }
+        else
+        {
+            band->minimum = minimum;
+            band->maximum = maximum;
+            band->mean = shift + sum / nrValid;
+            band->sumSquaredDeviations = std::max(sumSquares - sum * sum / nrValid, 0.);
+        }
+        band->isUpdated = true;
+        band->isHistogramUpdated = false;
+    }
+
+
+    static void computeBandHistogram(const Crit3DRasterGrid& myGrid, int firstRow, int lastRow,
+                                     float minimum, float maximum, int nrClasses, Crit3DRasterBandStatistics* band)
+    {
+        band->histogram.assign(size_t(nrClasses), 0);
+
+        float flag = myGrid.header->flag;
+        double scale = (maximum > minimum) ? nrClasses / double(maximum - minimum) : 0;
+        for (int row = firstRow; row < lastRow; row++)
+        {
+            const float* rowValue = myGrid.value[row];
+            for (int col = 0; col < myGrid.header->nrCols; col++)
+            {
+                if (rowValue[col] == flag) continue;
+
+                int index = std::min(int((rowValue[col] - minimum) * scale), nrClasses - 1);
+                band->histogram[size_t(index)]++;
+            }
+        }
+        band->isHistogramUpdated = true;
+    }
+
+
+    /*!
+     * \brief minimum, maximum and nrValidCells of the grid (and of its color scale) from the statistics cache:
+     * as updateMinMaxRasterGrid, without scanning the bands not marked by setStatisticsDirty
+     * \return false if there are no valid cells
+     */
+    bool setMinMaxFromStatistics(Crit3DRasterGrid* myGrid)
+    {
+        const Crit3DRasterStatistics& statistics = myGrid->getStatistics();
+
+        myGrid->nrValidCells = statistics.nrValidCells;
+        if (statistics.nrValidCells == 0) return false;
+
+        myGrid->minimum = statistics.minimum;
+        myGrid->maximum = statistics.maximum;
+        myGrid->colorScale->minimum = statistics.minimum;
+        myGrid->colorScale->maximum = statistics.maximum;
+        return true;
     }
 
 
     void Crit3DRasterGrid::setConstantValue(float initValue)
     {
-        for (int row = 0; row < this->header->nrRows; row++)
-            for (int col = 0; col < header->nrCols; col++)
-                value[row][col] = initValue;
+        std::fill(data, data + size_t(header->nrRows) * size_t(rowStride), initValue);
 
         this->minimum = initValue;
         this->maximum = initValue;
+        this->setStatisticsDirty();
     }
 
 
+    /*!
+     * \brief allocate the grid as a single aligned block;
+     * each row starts on an aligned address (rowStride >= nrCols)
+     * and value[row] points to the start of the row
+     */
     bool Crit3DRasterGrid::initializeGrid()
     {
-        this->value = (float **) calloc(unsigned(this->header->nrRows), sizeof(float *));
+        const int floatsPerAlignment = RASTER_ALIGNMENT / int(sizeof(float));
+        this->rowStride = ((this->header->nrCols + floatsPerAlignment - 1) / floatsPerAlignment) * floatsPerAlignment;
 
-        for (int row = 0; row < this->header->nrRows; row++)
+        size_t nrValues = size_t(this->header->nrRows) * size_t(this->rowStride);
+        this->data = allocateRasterBuffer(std::max(nrValues, size_t(1)));
+        this->value = (float **) calloc(std::max(unsigned(this->header->nrRows), 1u), sizeof(float *));
+
+        if (this->data == nullptr || this->value == nullptr)
         {
-            this->value[row] = (float *) calloc(unsigned(this->header->nrCols), sizeof(float));
-            if (this->value[row] == nullptr)
-            {
-                // Memory error: file too big
-                this->freeGrid();
-                return false;
-            }
+            // Memory error: file too big
+            this->freeGrid();
+            return false;
         }
 
+        for (int row = 0; row < this->header->nrRows; row++)
+            this->value[row] = this->data + size_t(row) * size_t(this->rowStride);
+
+        this->setStatisticsDirty();
         return true;
     }
 
@@ -265,13 +457,25 @@ namespace gis
         *(this->header) = *(initGrid.header);
         *(this->colorScale) = *(initGrid.colorScale);
 
-        this->initializeGrid();
+        if (! this->initializeGrid()) return false;
 
-        for (int row = 0; row < this->header->nrRows; row++)
-            for (int col = 0; col < this->header->nrCols; col++)
-                    this->value[row][col] = initGrid.value[row][col];
+        // same rowStride: the whole block is copied at once
+        // (a memory-mapped grid is not padded: it is copied by rows)
+        if (initGrid.rowStride == this->rowStride)
+            memcpy(this->data, initGrid.data, size_t(this->header->nrRows) * size_t(this->rowStride) * sizeof(float));
+        else
+        {
+            for (int row = 0; row < this->header->nrRows; row++)
+                memcpy(this->value[row], initGrid.value[row], size_t(this->header->nrCols) * sizeof(float));
+        }
+
+        // same cells: the statistics cache is copied, not recomputed
+        this->statistics = initGrid.statistics;
+        this->bandStatistics = initGrid.bandStatistics;
+        this->isStatisticsUpdated = initGrid.isStatisticsUpdated;
+        this->pyramid = initGrid.pyramid;
 
-        gis::updateMinMaxRasterGrid(this);
+        setMinMaxFromStatistics(this);
         this->isLoaded = true;
         return true;
     }
@@ -285,12 +489,25 @@ namespace gis
         this->minimum = initValue;
         this->maximum = initValue;
 
-        for (int row = 0; row < this->header->nrRows; row++)
-            for (int col = 0; col < this->header->nrCols; col++)
-                if (initGrid.value[row][col] != initGrid.header->flag)
-                    this->value[row][col] = initValue;
+        // the statistics of each band are computed while its rows are in cache
+        this->setStatisticsDirty();
+        int nrBands = int(this->bandStatistics.size());
+        parallelFor(0, nrBands, 1, [&](int firstBand, int lastBand)
+        {
+            for (int i = firstBand; i < lastBand; i++)
+            {
+                int firstRow = i * RASTER_STATISTICS_ROWS;
+                int lastRow = std::min(firstRow + RASTER_STATISTICS_ROWS, this->header->nrRows);
+                for (int row = firstRow; row < lastRow; row++)
+                    for (int col = 0; col < this->header->nrCols; col++)
+                        if (initGrid.value[row][col] != initGrid.header->flag)
+                            this->value[row][col] = initValue;
+
+                computeBandStatistics(*this, firstRow, lastRow, &(this->bandStatistics[size_t(i)]));
+            }
+        });
 
-        return gis::updateMinMaxRasterGrid(this);
+        return setMinMaxFromStatistics(this);
     }
 
 
@@ -312,26 +529,42 @@ namespace gis
     {
         if (value != nullptr)
         {
-            for (int myRow = 0; myRow < header->nrRows; myRow++)
-                if (value[myRow] != nullptr) ::free(value[myRow]);
-            if (header->nrRows != 0) ::free(value);
+            ::free(value);
+            value = nullptr;
+        }
+        if (mappedFile != nullptr)
+        {
+            unmapFile(mappedFile, mappedSize);
+            mappedFile = nullptr;
+            mappedSize = 0;
         }
+        else if (data != nullptr)
+        {
+            freeRasterBuffer(data);
+        }
+        data = nullptr;
+        rowStride = 0;
 
         timeString = "";
 
         minimum = NODATA;
         maximum = NODATA;
+        nrValidCells = 0;
         header->nrRows = 0;
         header->nrCols = 0;
         isLoaded = false;
+
+        statistics = Crit3DRasterStatistics();
+        bandStatistics.clear();
+        isStatisticsUpdated = false;
+        pyramid.clear();
     }
 
 
     void Crit3DRasterGrid::emptyGrid()
     {
-        for (int myRow = 0; myRow < header->nrRows; myRow++)
-            for (int myCol = 0; myCol < header->nrCols; myCol++)
-                value[myRow][myCol] = header->flag;
+        std::fill(data, data + size_t(header->nrRows) * size_t(rowStride), header->flag);
+        setStatisticsDirty();
     }
 
     Crit3DRasterGrid::~Crit3DRasterGrid()
@@ -359,211 +592,596 @@ namespace gis
     }
 
 
-    bool updateMinMaxRasterGrid(Crit3DRasterGrid* myGrid)
+    /*!
+     * \brief mark as changed the bands of rows of the window: their statistics are recomputed
+     * by the next getStatistics; the blocks of the window are updated in the pyramid, if built.
+     * It has to be called after writing cells through value; the functions of gis do it.
+     */
+    void Crit3DRasterGrid::setStatisticsDirty(int row0, int col0, int row1, int col1)
     {
-        float myValue;
-        bool isFirstValue = true;
-        float minimum = NODATA;
-        float maximum = NODATA;
+        isStatisticsUpdated = false;
+        pyramid.update(*this, row0, col0, row1, col1);
+        if (bandStatistics.empty()) return;
 
-        for (int myRow = 0; myRow < myGrid->header->nrRows; myRow++)
-            for (int myCol = 0; myCol < myGrid->header->nrCols; myCol++)
-            {
-                myValue = myGrid->value[myRow][myCol];
-                if (myValue != myGrid->header->flag)
-                {
-                    if (isFirstValue)
-                    {
-                        minimum = myValue;
-                        maximum = myValue;
-                        isFirstValue = false;
-                    }
-                    else
-                    {
-                        if (myValue < minimum) minimum = myValue;
-                        else if (myValue > maximum) maximum = myValue;
-                    }
-                }
-            }
+        int firstBand = std::max(std::min(row0, row1), 0) / RASTER_STATISTICS_ROWS;
+        int lastBand = std::min(std::max(row0, row1) / RASTER_STATISTICS_ROWS, int(bandStatistics.size()) - 1);
+        for (int i = firstBand; i <= lastBand; i++)
+        {
+            bandStatistics[size_t(i)].isUpdated = false;
+            bandStatistics[size_t(i)].isHistogramUpdated = false;
+        }
+    }
 
-        /*!  no values */
-        if (isFirstValue) return(false);
 
-        myGrid->maximum = maximum;
-        myGrid->minimum = minimum;
-        myGrid->colorScale->maximum = myGrid->maximum;
-        myGrid->colorScale->minimum = myGrid->minimum;
-        return(true);
+    void Crit3DRasterGrid::setStatisticsDirty(const Crit3DRasterWindow& myWindow)
+    {
+        setStatisticsDirty(myWindow.v[0].row, myWindow.v[0].col, myWindow.v[1].row, myWindow.v[1].col);
     }
 
-    bool updateColorScale(Crit3DRasterGrid* myGrid, const Crit3DRasterWindow& myWindow)
+
+    void Crit3DRasterGrid::setStatisticsDirty()
     {
-        return updateColorScale(myGrid, myWindow.v[0].row, myWindow.v[0].col, myWindow.v[1].row, myWindow.v[1].col);
+        isStatisticsUpdated = false;
+        pyramid.clear();
+
+        size_t nrBands = size_t((header->nrRows + RASTER_STATISTICS_ROWS - 1) / RASTER_STATISTICS_ROWS);
+        if (bandStatistics.size() != nrBands)
+        {
+            bandStatistics.assign(nrBands, Crit3DRasterBandStatistics());
+            return;
+        }
+
+        for (size_t i = 0; i < nrBands; i++)
+        {
+            bandStatistics[i].isUpdated = false;
+            bandStatistics[i].isHistogramUpdated = false;
+        }
     }
 
-    bool updateColorScale(Crit3DRasterGrid* myGrid, int row0, int col0, int row1, int col1)
-    {
-        float myValue;
-        bool isFirstValue = true;
-        float minimum = NODATA;
-        float maximum = NODATA;
 
-        if (row0 > row1)
+    /*!
+     * \brief statistics of a band of the cache (rows of a mapped file are checked first)
+     */
+    static void scanBand(Crit3DRasterGrid* myGrid, int band)
+    {
+        int firstRow = band * RASTER_STATISTICS_ROWS;
+        int lastRow = std::min(firstRow + RASTER_STATISTICS_ROWS, myGrid->header->nrRows);
+        Crit3DRasterBandStatistics* bandStatistics = &(myGrid->bandStatistics[size_t(band)]);
+        if (! bandStatistics->isNormalized)
         {
-            int tmp = row0;
-            row0 = row1;
-            row1 = tmp;
+            for (int row = firstRow; row < lastRow; row++)
+                normalizeRasterRow(myGrid->value[row], myGrid->header->nrCols, myGrid->header->flag);
+            bandStatistics->isNormalized = true;
         }
-        row0 = std::max(row0, int(0));
-        col0 = std::max(col0, int(0));
-        row1 = std::min(row1, myGrid->header->nrRows-1);
-        col1 = std::min(col1, myGrid->header->nrCols-1);
 
-        for (int myRow = row0; myRow <= row1; myRow++)
-            for (int myCol = col0; myCol <= col1; myCol++)
+        computeBandStatistics(*myGrid, firstRow, lastRow, bandStatistics);
+    }
+
+
+    /*!
+     * \brief statistics of the valid cells, cached by bands of RASTER_STATISTICS_ROWS rows:
+     * only the bands marked by setStatisticsDirty are scanned (in parallel), then the bands are merged
+     * (pairwise update of mean and squared deviations, Chan et al.)
+     * The bands of a mapped file are checked for NaN and infinite values at their first scan.
+     * \param nrHistogramClasses   0: the histogram is not computed
+     * The histogram of the unchanged bands is kept while minimum and maximum do not change.
+     */
+    const Crit3DRasterStatistics& Crit3DRasterGrid::getStatistics(int nrHistogramClasses)
+    {
+        size_t nrBands = size_t((header->nrRows + RASTER_STATISTICS_ROWS - 1) / RASTER_STATISTICS_ROWS);
+        if (bandStatistics.size() != nrBands)
+            setStatisticsDirty();
+
+        if (! isStatisticsUpdated)
+        {
+            std::vector<int> dirtyBands;
+            for (size_t i = 0; i < nrBands; i++)
+                if (! bandStatistics[i].isUpdated)
+                    dirtyBands.push_back(int(i));
+
+            parallelFor(0, int(dirtyBands.size()), 1, [&](int first, int last)
             {
-                myValue = myGrid->value[myRow][myCol];
-                if (myValue != myGrid->header->flag)
+                for (int i = first; i < last; i++)
                 {
-                    if (isFirstValue)
-                    {
-                        minimum = myValue;
-                        maximum = myValue;
-                        isFirstValue = false;
-                    }
-                    else
-                    {
-                        if (myValue < minimum) minimum = myValue;
-                        else if (myValue > maximum) maximum = myValue;
-                    }
+                    scanBand(this, dirtyBands[size_t(i)]);
+                }
+            });
+
+            size_t nrValid = 0;
+            float minValue = NODATA;
+            float maxValue = NODATA;
+            double mean = 0, sumSquaredDeviations = 0;
+            for (size_t i = 0; i < nrBands; i++)
+            {
+                const Crit3DRasterBandStatistics& band = bandStatistics[i];
+                if (band.nrValidCells == 0) continue;
+
+                if (nrValid == 0)
+                {
+                    minValue = band.minimum;
+                    maxValue = band.maximum;
                 }
+                else
+                {
+                    minValue = std::min(minValue, band.minimum);
+                    maxValue = std::max(maxValue, band.maximum);
+                }
+
+                size_t nrTotal = nrValid + band.nrValidCells;
+                double delta = band.mean - mean;
+                mean += delta * band.nrValidCells / nrTotal;
+                sumSquaredDeviations += band.sumSquaredDeviations
+                                        + delta * delta * (double(nrValid) * band.nrValidCells / nrTotal);
+                nrValid = nrTotal;
             }
 
-        myGrid->colorScale->maximum = maximum;
-        myGrid->colorScale->minimum = minimum;
-        //  no values
-        if (isFirstValue) return(false);
+            // histogram classes depend on minimum and maximum
+            if (minValue != statistics.minimum || maxValue != statistics.maximum)
+            {
+                statistics.histogram.clear();
+                for (size_t i = 0; i < nrBands; i++)
+                    bandStatistics[i].isHistogramUpdated = false;
+            }
 
-        return(true);
-    }
+            statistics.nrValidCells = nrValid;
+            statistics.minimum = minValue;
+            statistics.maximum = maxValue;
+            statistics.mean = (nrValid > 0) ? mean : NODATA;
+            statistics.standardDeviation = (nrValid > 0) ? sqrt(sumSquaredDeviations / nrValid) : NODATA;
+            isStatisticsUpdated = true;
+        }
 
+        if (nrHistogramClasses > 0)
+        {
+            bool isNewClasses = (statistics.histogram.size() != size_t(nrHistogramClasses));
+            std::vector<int> dirtyBands;
+            for (size_t i = 0; i < nrBands; i++)
+                if (isNewClasses || ! bandStatistics[i].isHistogramUpdated)
+                    dirtyBands.push_back(int(i));
 
-    double computeDistancePoint(Crit3DUtmPoint* p0, Crit3DUtmPoint *p1)
-    {
-            double dx, dy;
+            if (! dirtyBands.empty())
+            {
+                parallelFor(0, int(dirtyBands.size()), 1, [&](int first, int last)
+                {
+                    for (int i = first; i < last; i++)
+                    {
+                        int firstRow = dirtyBands[size_t(i)] * RASTER_STATISTICS_ROWS;
+                        int lastRow = std::min(firstRow + RASTER_STATISTICS_ROWS, header->nrRows);
+                        computeBandHistogram(*this, firstRow, lastRow, statistics.minimum, statistics.maximum,
+                                             nrHistogramClasses, &(bandStatistics[size_t(dirtyBands[size_t(i)])]));
+                    }
+                });
 
-            dx = p1->x - p0->x;
-            dy = p1->y - p0->y;
+                statistics.histogram.assign(size_t(nrHistogramClasses), 0);
+                for (size_t i = 0; i < nrBands; i++)
+                    for (size_t j = 0; j < statistics.histogram.size(); j++)
+                        statistics.histogram[j] += bandStatistics[i].histogram[j];
+            }
+        }
 
-            return sqrt((dx * dx)+(dy * dy));
+        return statistics;
     }
 
 
-    float computeDistance(float x1, float y1, float x2, float y2)
+    /*!
+     * \brief compute the statistics of a band of RASTER_STATISTICS_ROWS rows now,
+     * e.g. while its rows are in cache after reading them: the next getStatistics only merges it
+     */
+    void Crit3DRasterGrid::updateBandStatistics(int band)
     {
-            float dx, dy;
-
-            dx = x2 - x1;
-            dy = y2 - y1;
+        size_t nrBands = size_t((header->nrRows + RASTER_STATISTICS_ROWS - 1) / RASTER_STATISTICS_ROWS);
+        if (bandStatistics.size() != nrBands)
+            setStatisticsDirty();
 
-            return sqrtf((dx * dx)+(dy * dy));
+        scanBand(this, band);
+        isStatisticsUpdated = false;
     }
 
-    void getRowColFromXY(const Crit3DRasterGrid& myGrid, double myX, double myY, int *row, int *col)
-    {
-        *row = (myGrid.header->nrRows - 1) - (int)floor((myY - myGrid.header->llCorner->y) / myGrid.header->cellSize);
-        *col = (int)floor((myX - myGrid.header->llCorner->x) / myGrid.header->cellSize);
-    }
 
-    void getRowColFromXY(const Crit3DRasterHeader& myHeader, double myX, double myY, int *row, int *col)
+    /*!
+     * \brief recompute minimum, maximum and nrValidCells after the cells have changed
+     * (parallel, on the statistics cache)
+     * \return false if there are no valid cells
+     */
+    bool updateMinMaxRasterGrid(Crit3DRasterGrid* myGrid)
     {
-        *row = (myHeader.nrRows - 1) - (int)floor((myY - myHeader.llCorner->y) / myHeader.cellSize);
-        *col = (int)floor((myX - myHeader.llCorner->x) / myHeader.cellSize);
+        myGrid->setStatisticsDirty();
+        return setMinMaxFromStatistics(myGrid);
     }
 
-    void getRowColFromXY(const Crit3DRasterHeader& myHeader, const Crit3DUtmPoint& p, int *row, int *col)
+    Crit3DRasterPyramid::Crit3DRasterPyramid()
     {
-        *row = (myHeader.nrRows - 1) - (int)floor((p.y - myHeader.llCorner->y) / myHeader.cellSize);
-        *col = (int)floor((p.x - myHeader.llCorner->x) / myHeader.cellSize);
     }
 
-    void getRowColFromXY(const Crit3DRasterHeader& myHeader, const Crit3DUtmPoint& p, Crit3DRasterCell* v)
-    {
-        v->row = (myHeader.nrRows - 1) - (int)floor((p.y - myHeader.llCorner->y) / myHeader.cellSize);
-        v->col = (int)floor((p.x - myHeader.llCorner->x) / myHeader.cellSize);
-    }
 
-    void getRowColFromLatLon(const Crit3DGridHeader& latLonHeader, const Crit3DGeoPoint& p, int* myRow, int* myCol)
+    void Crit3DRasterPyramid::clear()
     {
-        *myRow = (latLonHeader.nrRows - 1) - (int)floor((p.latitude - latLonHeader.llCorner->latitude) / latLonHeader.dy);
-        *myCol = (int)floor((p.longitude - latLonHeader.llCorner->longitude) / latLonHeader.dx);
+        myLevels.clear();
     }
 
-    bool isOutOfGridRowCol(int myRow, int myCol, const Crit3DRasterGrid& myGrid)
-    {
-
-        if ((myRow < 0) || (myRow >= myGrid.header->nrRows) || (myCol < 0) || (myCol >= myGrid.header->nrCols)) return true;
-        else return false;
-    }
 
-    void getUtmXYFromRowColSinglePrecision(const Crit3DRasterGrid& myGrid,
-        int myRow, int myCol, float* myX, float* myY)
+    /*!
+     * \brief build all the levels of the pyramid: one pass on the cells, then on the blocks
+     * \return false if the grid is not allocated
+     */
+    bool Crit3DRasterPyramid::initialize(const Crit3DRasterGrid& myGrid)
     {
-            *myX = (float)(myGrid.header->llCorner->x + myGrid.header->cellSize * (float(myCol) + 0.5));
-            *myY = (float)(myGrid.header->llCorner->y + myGrid.header->cellSize * (float(myGrid.header->nrRows - myRow) - 0.5));
-    }
+        clear();
+        if (myGrid.value == nullptr || myGrid.header->nrRows < 1 || myGrid.header->nrCols < 1)
+            return false;
 
-    void getUtmXYFromRowColSinglePrecision(const Crit3DRasterHeader& myHeader, int myRow, int myCol, float* myX, float* myY)
-    {
-            *myX = (float)(myHeader.llCorner->x + myHeader.cellSize * (float(myCol) + 0.5));
-            *myY = (float)(myHeader.llCorner->y + myHeader.cellSize * (float(myHeader.nrRows - myRow) - 0.5));
-    }
+        int nrBlockRows = (myGrid.header->nrRows + RASTER_PYRAMID_BLOCK - 1) / RASTER_PYRAMID_BLOCK;
+        int nrBlockCols = (myGrid.header->nrCols + RASTER_PYRAMID_BLOCK - 1) / RASTER_PYRAMID_BLOCK;
+        while (true)
+        {
+            pyramidLevel level;
+            level.nrRows = nrBlockRows;
+            level.nrCols = nrBlockCols;
+            level.minimum.resize(size_t(nrBlockRows) * size_t(nrBlockCols));
+            level.maximum.resize(size_t(nrBlockRows) * size_t(nrBlockCols));
+            myLevels.push_back(level);
+
+            if (nrBlockRows == 1 && nrBlockCols == 1) break;
+            nrBlockRows = (nrBlockRows + 1) / 2;
+            nrBlockCols = (nrBlockCols + 1) / 2;
+        }
 
-    void getUtmXYFromRowCol(const Crit3DRasterGrid& myGrid,
-        int myRow, int myCol, double* myX, double* myY)
-    {
-            *myX = myGrid.header->llCorner->x + myGrid.header->cellSize * (myCol + 0.5);
-            *myY = myGrid.header->llCorner->y + myGrid.header->cellSize * (myGrid.header->nrRows - myRow - 0.5);
-    }
+        for (int level = 0; level < nrLevels(); level++)
+            updateBlocks(myGrid, level, 0, 0, nrRows(level) - 1, nrCols(level) - 1);
 
-    void getUtmXYFromRowCol(const Crit3DRasterHeader& myHeader, int myRow, int myCol, double* myX, double* myY)
-    {
-            *myX = myHeader.llCorner->x + myHeader.cellSize * (myCol + 0.5);
-            *myY = myHeader.llCorner->y + myHeader.cellSize * (myHeader.nrRows - myRow - 0.5);
+        return true;
     }
 
-    void getLatLonFromRowCol(const Crit3DGridHeader& latLonHeader, int myRow, int myCol, double* lat, double* lon)
-    {
-            *lon = latLonHeader.llCorner->longitude + latLonHeader.dx * (myCol + 0.5);
-            *lat = latLonHeader.llCorner->latitude + latLonHeader.dy * (latLonHeader.nrRows - myRow - 0.5);
-    }
 
-    void getLatLonFromRowCol(const Crit3DGridHeader& latLonHeader, const Crit3DRasterCell& v, Crit3DGeoPoint* p)
+    /*!
+     * \brief update the blocks of the cells [row0, row1] x [col0, col1] in all the levels
+     * (nothing if the pyramid is not built; it is cleared if the grid size has changed)
+     */
+    void Crit3DRasterPyramid::update(const Crit3DRasterGrid& myGrid, int row0, int col0, int row1, int col1)
     {
-            p->longitude = latLonHeader.llCorner->longitude + latLonHeader.dx * (v.col + 0.5);
-            p->latitude = latLonHeader.llCorner->latitude + latLonHeader.dy * (latLonHeader.nrRows - v.row - 0.5);
-    }
+        if (! isLoaded()) return;
 
-    float getValueFromXY(const Crit3DRasterGrid& myGrid, double x, double y)
-    {
-        int myRow, myCol;
+        if (nrRows(0) != (myGrid.header->nrRows + RASTER_PYRAMID_BLOCK - 1) / RASTER_PYRAMID_BLOCK
+            || nrCols(0) != (myGrid.header->nrCols + RASTER_PYRAMID_BLOCK - 1) / RASTER_PYRAMID_BLOCK)
+        {
+            clear();
+            return;
+        }
 
-        if (gis::isOutOfGridXY(x, y, myGrid.header)) return myGrid.header->flag ;
-        getRowColFromXY(myGrid, x, y, &myRow, &myCol);
-        return myGrid.value[myRow][myCol];
+        if (row0 > row1) std::swap(row0, row1);
+        if (col0 > col1) std::swap(col0, col1);
+        row0 = std::max(row0, 0);
+        col0 = std::max(col0, 0);
+        row1 = std::min(row1, myGrid.header->nrRows - 1);
+        col1 = std::min(col1, myGrid.header->nrCols - 1);
+        if (row0 > row1 || col0 > col1) return;
+
+        row0 /= RASTER_PYRAMID_BLOCK;
+        col0 /= RASTER_PYRAMID_BLOCK;
+        row1 /= RASTER_PYRAMID_BLOCK;
+        col1 /= RASTER_PYRAMID_BLOCK;
+        for (int level = 0; level < nrLevels(); level++)
+        {
+            updateBlocks(myGrid, level, row0, col0, row1, col1);
+            row0 /= 2;
+            col0 /= 2;
+            row1 /= 2;
+            col1 /= 2;
+        }
     }
 
-    float Crit3DRasterGrid::getFastValueXY(double x, double y) const
+
+    /*!
+     * \brief minimum and maximum of the blocks [row0, row1] x [col0, col1] of a level:
+     * from the cells (level 0) or from the 2 x 2 blocks of the previous level, parallel by rows of blocks
+     */
+    void Crit3DRasterPyramid::updateBlocks(const Crit3DRasterGrid& myGrid, int level, int row0, int col0, int row1, int col1)
     {
-        int myRow, myCol;
+        pyramidLevel& current = myLevels[size_t(level)];
 
-        myRow = (header->nrRows-1) - int((y - header->llCorner->y) / header->cellSize);
-        myCol = int((x - header->llCorner->x) / header->cellSize);
-        return getValueFromRowCol(myRow, myCol);
-    }
+        parallelFor(row0, row1 + 1, 4, [&](int firstRow, int lastRow)
+        {
+            for (int row = firstRow; row < lastRow; row++)
+                for (int col = col0; col <= col1; col++)
+                {
+                    float minValue = FLT_MAX;
+                    float maxValue = -FLT_MAX;
 
-    float Crit3DRasterGrid::getValueFromRowCol(int myRow, int myCol) const
-    {
+                    if (level == 0)
+                    {
+                        int lastCellRow = std::min((row + 1) * RASTER_PYRAMID_BLOCK, myGrid.header->nrRows);
+                        int lastCellCol = std::min((col + 1) * RASTER_PYRAMID_BLOCK, myGrid.header->nrCols);
+                        float flag = myGrid.header->flag;
+                        for (int cellRow = row * RASTER_PYRAMID_BLOCK; cellRow < lastCellRow; cellRow++)
+                        {
+                            const float* rowValue = myGrid.value[cellRow];
+                            for (int cellCol = col * RASTER_PYRAMID_BLOCK; cellCol < lastCellCol; cellCol++)
+                            {
+                                bool isValid = (rowValue[cellCol] != flag);
+                                minValue = std::min(minValue, isValid ? rowValue[cellCol] : minValue);
+                                maxValue = std::max(maxValue, isValid ? rowValue[cellCol] : maxValue);
+                            }
+                        }
+                    }
+                    else
+                    {
+                        int lastChildRow = std::min(row * 2 + 2, nrRows(level - 1));
+                        int lastChildCol = std::min(col * 2 + 2, nrCols(level - 1));
+                        for (int childRow = row * 2; childRow < lastChildRow; childRow++)
+                            for (int childCol = col * 2; childCol < lastChildCol; childCol++)
+                            {
+                                minValue = std::min(minValue, minimum(level - 1, childRow, childCol));
+                                maxValue = std::max(maxValue, maximum(level - 1, childRow, childCol));
+                            }
+                    }
+
+                    size_t index = size_t(row) * size_t(current.nrCols) + size_t(col);
+                    current.minimum[index] = minValue;
+                    current.maximum[index] = maxValue;
+                }
+        });
+    }
+
+
+    /*!
+     * \brief add the valid cells of the window in the block (row, col) of a level:
+     * blocks inside the window are taken whole, blocks on its border are split in their children
+     * unless they can't change the current minimum and maximum; the level 0 blocks on the border
+     * are only collected in borderBlocks, and scanned by getMinMax when the whole blocks are added
+     */
+    void Crit3DRasterPyramid::addMinMax(const Crit3DRasterGrid& myGrid, int level, int row, int col,
+                                        int row0, int col0, int row1, int col1,
+                                        float* myMinimum, float* myMaximum, std::vector<int>& borderBlocks) const
+    {
+        float blockMinimum = minimum(level, row, col);
+        float blockMaximum = maximum(level, row, col);
+        if (blockMinimum > blockMaximum) return;
+        if (blockMinimum >= *myMinimum && blockMaximum <= *myMaximum) return;
+
+        int size = blockSize(level);
+        int firstRow = row * size;
+        int firstCol = col * size;
+        int lastRow = std::min(firstRow + size, myGrid.header->nrRows) - 1;
+        int lastCol = std::min(firstCol + size, myGrid.header->nrCols) - 1;
+        if (lastRow < row0 || firstRow > row1 || lastCol < col0 || firstCol > col1) return;
+
+        if (firstRow >= row0 && lastRow <= row1 && firstCol >= col0 && lastCol <= col1)
+        {
+            *myMinimum = std::min(*myMinimum, blockMinimum);
+            *myMaximum = std::max(*myMaximum, blockMaximum);
+            return;
+        }
+
+        if (level == 0)
+        {
+            borderBlocks.push_back(row * nrCols(0) + col);
+            return;
+        }
+
+        for (int childRow = row * 2; childRow < std::min(row * 2 + 2, nrRows(level - 1)); childRow++)
+            for (int childCol = col * 2; childCol < std::min(col * 2 + 2, nrCols(level - 1)); childCol++)
+                addMinMax(myGrid, level - 1, childRow, childCol, row0, col0, row1, col1,
+                          myMinimum, myMaximum, borderBlocks);
+    }
+
+
+    /*!
+     * \brief minimum and maximum of the valid cells of the window [row0, row1] x [col0, col1]
+     * (cell indexes in any order, clipped to the grid); the cost depends on the window border,
+     * not on its area: the blocks along the border at each level, and the cells of the level 0
+     * border blocks (up to RASTER_PYRAMID_BLOCK for each border cell), scanned last and only
+     * if their block can still change the result
+     * \return false if the pyramid is not built or there are no valid cells in the window
+     */
+    bool Crit3DRasterPyramid::getMinMax(const Crit3DRasterGrid& myGrid, int row0, int col0, int row1, int col1,
+                                        float* myMinimum, float* myMaximum) const
+    {
+        if (! isLoaded()) return false;
+
+        if (row0 > row1) std::swap(row0, row1);
+        if (col0 > col1) std::swap(col0, col1);
+        row0 = std::max(row0, 0);
+        col0 = std::max(col0, 0);
+        row1 = std::min(row1, myGrid.header->nrRows - 1);
+        col1 = std::min(col1, myGrid.header->nrCols - 1);
+
+        float minValue = FLT_MAX;
+        float maxValue = -FLT_MAX;
+        if (row0 > row1 || col0 > col1) return false;
+
+        std::vector<int> borderBlocks;
+        addMinMax(myGrid, nrLevels() - 1, 0, 0, row0, col0, row1, col1, &minValue, &maxValue, borderBlocks);
+
+        // border blocks, checked again against the whole blocks inside the window
+        float flag = myGrid.header->flag;
+        int size = blockSize(0);
+        for (int block : borderBlocks)
+        {
+            int row = block / nrCols(0);
+            int col = block % nrCols(0);
+            if (minimum(0, row, col) >= minValue && maximum(0, row, col) <= maxValue) continue;
+
+            int lastRow = std::min(row * size + size - 1, row1);
+            int lastCol = std::min(col * size + size - 1, col1);
+            for (int cellRow = std::max(row * size, row0); cellRow <= lastRow; cellRow++)
+                for (int cellCol = std::max(col * size, col0); cellCol <= lastCol; cellCol++)
+                {
+                    float value = myGrid.value[cellRow][cellCol];
+                    if (value == flag) continue;
+                    minValue = std::min(minValue, value);
+                    maxValue = std::max(maxValue, value);
+                }
+        }
+
+        if (minValue > maxValue) return false;
+
+        *myMinimum = minValue;
+        *myMaximum = maxValue;
+        return true;
+    }
+
+
+    /*!
+     * \brief min/max pyramid of the grid, built at the first call
+     */
+    const Crit3DRasterPyramid& Crit3DRasterGrid::getPyramid()
+    {
+        if (! pyramid.isLoaded())
+            pyramid.initialize(*this);
+
+        return pyramid;
+    }
+
+
+    bool updateColorScale(Crit3DRasterGrid* myGrid, const Crit3DRasterWindow& myWindow)
+    {
+        return updateColorScale(myGrid, myWindow.v[0].row, myWindow.v[0].col, myWindow.v[1].row, myWindow.v[1].col);
+    }
+
+    /*!
+     * \brief stretch the color scale to the valid cells of a window, with the min/max pyramid of the grid
+     */
+    bool updateColorScale(Crit3DRasterGrid* myGrid, int row0, int col0, int row1, int col1)
+    {
+        float minimum, maximum;
+        if (! myGrid->getPyramid().getMinMax(*myGrid, row0, col0, row1, col1, &minimum, &maximum))
+        {
+            //  no values
+            myGrid->colorScale->minimum = NODATA;
+            myGrid->colorScale->maximum = NODATA;
+            return false;
+        }
+
+        myGrid->colorScale->minimum = minimum;
+        myGrid->colorScale->maximum = maximum;
+        return true;
+    }
+
+
+    double computeDistancePoint(Crit3DUtmPoint* p0, Crit3DUtmPoint *p1)
+    {
+            double dx, dy;
+
+            dx = p1->x - p0->x;
+            dy = p1->y - p0->y;
+
+            return sqrt((dx * dx)+(dy * dy));
+    }
+
+
+    float computeDistance(float x1, float y1, float x2, float y2)
+    {
+            float dx, dy;
+
+            dx = x2 - x1;
+            dy = y2 - y1;
+
+            return sqrtf((dx * dx)+(dy * dy));
+    }
+
+    void getRowColFromXY(const Crit3DRasterGrid& myGrid, double myX, double myY, int *row, int *col)
+    {
+        *row = (myGrid.header->nrRows - 1) - (int)floor((myY - myGrid.header->llCorner->y) / myGrid.header->cellSize);
+        *col = (int)floor((myX - myGrid.header->llCorner->x) / myGrid.header->cellSize);
+    }
+
+    void getRowColFromXY(const Crit3DRasterHeader& myHeader, double myX, double myY, int *row, int *col)
+    {
+        *row = (myHeader.nrRows - 1) - (int)floor((myY - myHeader.llCorner->y) / myHeader.cellSize);
+        *col = (int)floor((myX - myHeader.llCorner->x) / myHeader.cellSize);
+    }
+
+    void getRowColFromXY(const Crit3DRasterHeader& myHeader, const Crit3DUtmPoint& p, int *row, int *col)
+    {
+        *row = (myHeader.nrRows - 1) - (int)floor((p.y - myHeader.llCorner->y) / myHeader.cellSize);
+        *col = (int)floor((p.x - myHeader.llCorner->x) / myHeader.cellSize);
+    }
+
+    void getRowColFromXY(const Crit3DRasterHeader& myHeader, const Crit3DUtmPoint& p, Crit3DRasterCell* v)
+    {
+        v->row = (myHeader.nrRows - 1) - (int)floor((p.y - myHeader.llCorner->y) / myHeader.cellSize);
+        v->col = (int)floor((p.x - myHeader.llCorner->x) / myHeader.cellSize);
+    }
+
+    void getRowColFromLatLon(const Crit3DGridHeader& latLonHeader, const Crit3DGeoPoint& p, int* myRow, int* myCol)
+    {
+        *myRow = (latLonHeader.nrRows - 1) - (int)floor((p.latitude - latLonHeader.llCorner->latitude) / latLonHeader.dy);
+        *myCol = (int)floor((p.longitude - latLonHeader.llCorner->longitude) / latLonHeader.dx);
+    }
+
+    bool isOutOfGridRowCol(int myRow, int myCol, const Crit3DRasterGrid& myGrid)
+    {
+
+        if ((myRow < 0) || (myRow >= myGrid.header->nrRows) || (myCol < 0) || (myCol >= myGrid.header->nrCols)) return true;
+        else return false;
+    }
+
+    void getUtmXYFromRowColSinglePrecision(const Crit3DRasterGrid& myGrid,
+        int myRow, int myCol, float* myX, float* myY)
+    {
+            *myX = (float)(myGrid.header->llCorner->x + myGrid.header->cellSize * (float(myCol) + 0.5));
+            *myY = (float)(myGrid.header->llCorner->y + myGrid.header->cellSize * (float(myGrid.header->nrRows - myRow) - 0.5));
+    }
+
+    void getUtmXYFromRowColSinglePrecision(const Crit3DRasterHeader& myHeader, int myRow, int myCol, float* myX, float* myY)
+    {
+            *myX = (float)(myHeader.llCorner->x + myHeader.cellSize * (float(myCol) + 0.5));
+            *myY = (float)(myHeader.llCorner->y + myHeader.cellSize * (float(myHeader.nrRows - myRow) - 0.5));
+    }
+
+    void getUtmXYFromRowCol(const Crit3DRasterGrid& myGrid,
+        int myRow, int myCol, double* myX, double* myY)
+    {
+            *myX = myGrid.header->llCorner->x + myGrid.header->cellSize * (myCol + 0.5);
+            *myY = myGrid.header->llCorner->y + myGrid.header->cellSize * (myGrid.header->nrRows - myRow - 0.5);
+    }
+
+    void getUtmXYFromRowCol(const Crit3DRasterHeader& myHeader, int myRow, int myCol, double* myX, double* myY)
+    {
+            *myX = myHeader.llCorner->x + myHeader.cellSize * (myCol + 0.5);
+            *myY = myHeader.llCorner->y + myHeader.cellSize * (myHeader.nrRows - myRow - 0.5);
+    }
+
+    void getLatLonFromRowCol(const Crit3DGridHeader& latLonHeader, int myRow, int myCol, double* lat, double* lon)
+    {
+            *lon = latLonHeader.llCorner->longitude + latLonHeader.dx * (myCol + 0.5);
+            *lat = latLonHeader.llCorner->latitude + latLonHeader.dy * (latLonHeader.nrRows - myRow - 0.5);
+    }
+
+    void getLatLonFromRowCol(const Crit3DGridHeader& latLonHeader, const Crit3DRasterCell& v, Crit3DGeoPoint* p)
+    {
+            p->longitude = latLonHeader.llCorner->longitude + latLonHeader.dx * (v.col + 0.5);
+            p->latitude = latLonHeader.llCorner->latitude + latLonHeader.dy * (latLonHeader.nrRows - v.row - 0.5);
+    }
+
+    float getValueFromXY(const Crit3DRasterGrid& myGrid, double x, double y)
+    {
+        int myRow, myCol;
+
+        if (gis::isOutOfGridXY(x, y, myGrid.header)) return myGrid.header->flag ;
+        getRowColFromXY(myGrid, x, y, &myRow, &myCol);
+        return myGrid.value[myRow][myCol];
+    }
+
+    /*!
+     * \brief row and col of getFastValueXY (not checked on the grid limits)
+     */
+    static inline void getFastRowColFromXY(const Crit3DRasterHeader& header, double x, double y, int* row, int* col)
+    {
+        *row = (header.nrRows-1) - int((y - header.llCorner->y) / header.cellSize);
+        *col = int((x - header.llCorner->x) / header.cellSize);
+    }
+
+    float Crit3DRasterGrid::getFastValueXY(double x, double y) const
+    {
+        int myRow, myCol;
+
+        getFastRowColFromXY(*header, x, y, &myRow, &myCol);
+        return getValueFromRowCol(myRow, myCol);
+    }
+
+    float Crit3DRasterGrid::getValueFromRowCol(int myRow, int myCol) const
+    {
         if (myRow < 0 || myRow > (header->nrRows - 1) || myCol < 0 || myCol > header->nrCols - 1)
             return header->flag;
         else
@@ -841,141 +1459,502 @@ namespace gis
     }
 
 
-    bool computeSlopeAspectMaps(const gis::Crit3DRasterGrid& dtm,
-                                gis::Crit3DRasterGrid* slopeMap, gis::Crit3DRasterGrid* aspectMap)
+    /*!
+     * \brief value of the cell (row pointer, col), flag if outside the grid
+     */
+    static inline float neighbourValue(const float* rowValue, int col, int nrCols, float flag)
     {
-        if (! dtm.isLoaded) return false;
+        if (rowValue == nullptr || col < 0 || col >= nrCols)
+            return flag;
+        return rowValue[col];
+    }
+
 
+    /*!
+     * \brief scalar slope and aspect of a valid cell, with any neighbours missing
+     * \param dtmRows  rows -1, 0, +1 (nullptr outside the grid)
+     */
+    static void computeSlopeAspectCell(const float* dtmRows[3], int myCol, int nrCols, float flag, double cellSize,
+                                       float* slopeValue, float* aspectValue)
+    {
         double dz_dx, dz_dy;
         double slope, aspect;
         double z, dz;
         double zNorth, zSouth, zEast, zWest;
         int i, nr;
 
-        slopeMap->initializeGrid(dtm);
-        aspectMap->initializeGrid(dtm);
+        z = dtmRows[1][myCol];
 
-        for (int myRow = 0; myRow < dtm.header->nrRows; myRow++)
-            for (int myCol = 0; myCol < dtm.header->nrCols; myCol++)
+        /*! compute dz/dy */
+        nr = 0;
+        dz = 0;
+        for (i=-1; i <=1; i++)
+        {
+            zNorth = neighbourValue(dtmRows[0], myCol+i, nrCols, flag);
+            zSouth = neighbourValue(dtmRows[2], myCol+i, nrCols, flag);
+            if (zNorth != flag)
             {
-                z = dtm.value[myRow][myCol];
-                if (z != dtm.header->flag)
-                {
-                    /*! compute dz/dy */
-                    nr = 0;
-                    dz = 0;
-                    for (i=-1; i <=1; i++)
-                    {
-                        zNorth = dtm.getValueFromRowCol(myRow-1, myCol+i);
-                        zSouth = dtm.getValueFromRowCol(myRow+1, myCol+i);
-                        if (zNorth != dtm.header->flag)
-                        {
-                            dz += zNorth - z;
-                            nr++;
-                        }
-                        if (zSouth != dtm.header->flag)
-                        {
-                            dz += z - zSouth;
-                            nr++;
-                        }
-                    }
-                    if (nr == 0)
-                        dz_dy = EPSILON;
-                    else
-                        dz_dy = dz / (nr * dtm.header->cellSize);
+                dz += zNorth - z;
+                nr++;
+            }
+            if (zSouth != flag)
+            {
+                dz += z - zSouth;
+                nr++;
+            }
+        }
+        if (nr == 0)
+            dz_dy = EPSILON;
+        else
+            dz_dy = dz / (nr * cellSize);
 
-                    /*! compute dz/dx */
-                    nr = 0;
-                    dz = 0;
-                    for (i=-1; i <=1; i++)
-                    {
-                        zWest = dtm.getValueFromRowCol(myRow+i, myCol-1);
-                        zEast = dtm.getValueFromRowCol(myRow+i, myCol+1);
-                        if (zWest != dtm.header->flag)
-                        {
-                            dz += zWest - z;
-                            nr++;
-                        }
-                        if (zEast != dtm.header->flag)
-                        {
-                            dz += z - zEast;
-                            nr++;
-                        }
-                    }
-                    if (nr == 0)
-                        dz_dx = EPSILON;
-                    else
-                        dz_dx = dz / (nr * dtm.header->cellSize);
+        /*! compute dz/dx */
+        nr = 0;
+        dz = 0;
+        for (i=-1; i <=1; i++)
+        {
+            zWest = neighbourValue(dtmRows[i+1], myCol-1, nrCols, flag);
+            zEast = neighbourValue(dtmRows[i+1], myCol+1, nrCols, flag);
+            if (zWest != flag)
+            {
+                dz += zWest - z;
+                nr++;
+            }
+            if (zEast != flag)
+            {
+                dz += z - zEast;
+                nr++;
+            }
+        }
+        if (nr == 0)
+            dz_dx = EPSILON;
+        else
+            dz_dx = dz / (nr * cellSize);
 
-                    /*! slope in degrees */
-                    slope = atan(sqrt(dz_dx * dz_dx + dz_dy * dz_dy)) * RAD_TO_DEG;
-                    slopeMap->value[myRow][myCol] = float(slope);
+        /*! slope in degrees */
+        slope = atan(sqrt(dz_dx * dz_dx + dz_dy * dz_dy)) * RAD_TO_DEG;
+        *slopeValue = float(slope);
 
-                    /*! avoid arctan to infinite */
-                    if (dz_dx == 0.) dz_dx = EPSILON;
+        /*! avoid arctan to infinite */
+        if (dz_dx == 0.) dz_dx = EPSILON;
 
-                    /*! compute with zero to east */
-                    aspect = 0.0;
-                    if (dz_dx > 0)
-                        aspect = atan(dz_dy / dz_dx);
-                    else if (dz_dx < 0)
-                        aspect = PI + atan(dz_dy / dz_dx);
+        /*! compute with zero to east */
+        aspect = 0.0;
+        if (dz_dx > 0)
+            aspect = atan(dz_dy / dz_dx);
+        else if (dz_dx < 0)
+            aspect = PI + atan(dz_dy / dz_dx);
 
-                    /*! convert to zero from north and to degrees */
-                    aspect += (PI / 2.);
-                    aspect *= RAD_TO_DEG;
+        /*! convert to zero from north and to degrees */
+        aspect += (PI / 2.);
+        aspect *= RAD_TO_DEG;
 
-                    aspectMap->value[myRow][myCol] = float(aspect);
-                }
-            }
+        *aspectValue = float(aspect);
+    }
 
-        gis::updateMinMaxRasterGrid(slopeMap);
-        gis::updateMinMaxRasterGrid(aspectMap);
 
-        aspectMap->isLoaded = true;
-        slopeMap->isLoaded = true;
+    Crit3DTerrainDerivatives::Crit3DTerrainDerivatives()
+    {
+        slope = nullptr;
+        aspect = nullptr;
+        hillshade = nullptr;
+        profileCurvature = nullptr;
+        planCurvature = nullptr;
+        maximum = nullptr;
+        minimum = nullptr;
 
-        return true;
+        sunAzimuth = 315;
+        sunElevation = 45;
     }
 
 
-    bool mapAlgebra(gis::Crit3DRasterGrid* myMap1, float myValue,
-                    gis::Crit3DRasterGrid* myMapOut, operationType myOperation)
+    static void computeTerrainDerivativesRows(const gis::Crit3DRasterGrid& dtm, const Crit3DTerrainDerivatives& products,
+                                              int firstRow, int lastRow)
     {
-        if (myMapOut == nullptr || myMap1 == nullptr) return false;
-        if (! (*(myMap1->header) == *(myMapOut->header))) return false;
+        int nrRows = dtm.header->nrRows;
+        int nrCols = dtm.header->nrCols;
+        float flag = dtm.header->flag;
+        double cellSize = dtm.header->cellSize;
 
-        for (int myRow=0; myRow<myMapOut->header->nrRows; myRow++)
-            for (int myCol=0; myCol<myMapOut->header->nrCols; myCol++)
+        bool isSlopeAspectNeeded = (products.slope != nullptr || products.aspect != nullptr || products.hillshade != nullptr);
+        bool isCurvatureNeeded = (products.profileCurvature != nullptr || products.planCurvature != nullptr);
+        bool isWindowNeeded = (isCurvatureNeeded || products.maximum != nullptr || products.minimum != nullptr);
+
+        // slope and aspect rows are needed by the hillshade also when not requested
+        std::vector<float> slopeBuffer, aspectBuffer;
+        if (products.slope == nullptr) slopeBuffer.resize(size_t(nrCols));
+        if (products.aspect == nullptr) aspectBuffer.resize(size_t(nrCols));
+        std::vector<unsigned char> isComputed(size_t(nrCols), 0);
+
+        double zenith = (90. - products.sunElevation) * DEG_TO_RAD;
+        double cosZenith = cos(zenith);
+        double sinZenith = sin(zenith);
+        double sunAzimuth = products.sunAzimuth * DEG_TO_RAD;
+
+        for (int myRow = firstRow; myRow < lastRow; myRow++)
+        {
+            // rows -1, 0, +1: nullptr outside the grid
+            const float* dtmRows[3];
+            dtmRows[0] = (myRow > 0) ? dtm.value[myRow-1] : nullptr;
+            dtmRows[1] = dtm.value[myRow];
+            dtmRows[2] = (myRow < nrRows-1) ? dtm.value[myRow+1] : nullptr;
+
+            float* slopeRow = (products.slope != nullptr) ? products.slope->value[myRow] : slopeBuffer.data();
+            float* aspectRow = (products.aspect != nullptr) ? products.aspect->value[myRow] : aspectBuffer.data();
+
+            // interior cells with a valid 3x3 window: vectorized kernel
+            if (isSlopeAspectNeeded)
+            {
+                std::fill(isComputed.begin(), isComputed.end(), 0);
+                if (dtmRows[0] != nullptr && dtmRows[2] != nullptr)
+                    computeSlopeAspectInterior(dtmRows[0], dtmRows[1], dtmRows[2], nrCols, flag, cellSize,
+                                               slopeRow, aspectRow, isComputed.data());
+            }
+
+            for (int myCol = 0; myCol < nrCols; myCol++)
             {
-                if (myMap1->value[myRow][myCol] != myMap1->header->flag)
+                float z = dtmRows[1][myCol];
+                if (z == flag) continue;
+
+                // border and nodata-adjacent cells
+                if (isSlopeAspectNeeded && ! isComputed[unsigned(myCol)])
+                    computeSlopeAspectCell(dtmRows, myCol, nrCols, flag, cellSize, &slopeRow[myCol], &aspectRow[myCol]);
+
+                if (products.hillshade != nullptr)
                 {
-                    if (myOperation == operationMin)
-                        myMapOut->value[myRow][myCol] = std::min(myMap1->value[myRow][myCol], myValue);
-                    else if (myOperation == operationMax)
-                        myMapOut->value[myRow][myCol] = std::max(myMap1->value[myRow][myCol], myValue);
-                    else if (myOperation == operationSum)
-                        myMapOut->value[myRow][myCol] = (myMap1->value[myRow][myCol] + myValue);
-                    else if (myOperation == operationSubtract)
-                        myMapOut->value[myRow][myCol] = (myMap1->value[myRow][myCol] - myValue);
-                    else if (myOperation == operationProduct)
-                        myMapOut->value[myRow][myCol] = (myMap1->value[myRow][myCol] * myValue);
-                    else if (myOperation == operationDivide)
+                    double slope = slopeRow[myCol] * DEG_TO_RAD;
+                    double aspect = aspectRow[myCol] * DEG_TO_RAD;
+                    double shade = cosZenith * cos(slope) + sinZenith * sin(slope) * cos(sunAzimuth - aspect);
+                    products.hillshade->value[myRow][myCol] = float(255. * std::max(shade, 0.));
+                }
+
+                if (! isWindowNeeded) continue;
+
+                /*! 3x3 window: w[0] = NW ... w[4] = z ... w[8] = SE */
+                float w[9];
+                bool isFullWindow = true;
+                for (int r = 0; r < 3; r++)
+                    for (int c = 0; c < 3; c++)
                     {
-                        if (myValue != 0)
-                            myMapOut->value[myRow][myCol] = (myMap1->value[myRow][myCol] / myValue);
-                        else
-                            return false;
+                        w[r*3 + c] = neighbourValue(dtmRows[r], myCol + c - 1, nrCols, flag);
+                        if (w[r*3 + c] == flag) isFullWindow = false;
                     }
+
+                /*! same tests of isStrictMaximum and isMinimum */
+                bool isMaximum = true;
+                bool isMinimum = true;
+                for (int i = 0; i < 9; i++)
+                {
+                    if (i == 4 || w[i] == flag) continue;
+                    if (z <= w[i]) isMaximum = false;
+                    if (z > w[i]) isMinimum = false;
                 }
-            }
+                if (products.maximum != nullptr)
+                    products.maximum->value[myRow][myCol] = isMaximum ? 1 : 0;
+                if (products.minimum != nullptr)
+                    products.minimum->value[myRow][myCol] = isMinimum ? 1 : 0;
 
-        return true;
+                /*! curvatures (Zevenbergen & Thorne, 1987): only on a full window */
+                if (isCurvatureNeeded && isFullWindow)
+                {
+                    double L2 = cellSize * cellSize;
+                    double D = ((w[3] + w[5]) * 0.5 - w[4]) / L2;
+                    double E = ((w[1] + w[7]) * 0.5 - w[4]) / L2;
+                    double F = (-w[0] + w[2] + w[6] - w[8]) / (4. * L2);
+                    double G = (-w[3] + w[5]) / (2. * cellSize);
+                    double H = (w[1] - w[7]) / (2. * cellSize);
+                    double G2H2 = G*G + H*H;
+
+                    double profile = 0, plan = 0;
+                    if (G2H2 > 0)
+                    {
+                        profile = -2. * (D*G*G + E*H*H + F*G*H) / G2H2;
+                        plan = 2. * (D*H*H + E*G*G - F*G*H) / G2H2;
+                    }
+                    if (products.profileCurvature != nullptr)
+                        products.profileCurvature->value[myRow][myCol] = float(profile);
+                    if (products.planCurvature != nullptr)
+                        products.planCurvature->value[myRow][myCol] = float(plan);
+                }
+            }
+        }
     }
 
 
     /*!
-     * \brief return true if value(row, col) > all values of neighbours
+     * \brief compute in a single pass on the DTM the requested terrain products:
+     * each 3x3 window is read once for all of them.
+     * Slope and aspect are the same of computeSlopeAspectMaps, the extremum flags
+     * are the same of isStrictMaximum and isMinimum, curvatures are computed
+     * only on cells with a full valid window. Rows are computed in parallel.
+     * \param dtm          Crit3DRasterGrid
+     * \param products     output grids (nullptr = not requested) and hillshade light
+     * \return true on success, false otherwise
+     */
+    bool computeTerrainDerivatives(const gis::Crit3DRasterGrid& dtm, Crit3DTerrainDerivatives* products)
+    {
+        if (! dtm.isLoaded || products == nullptr) return false;
+
+        Crit3DRasterGrid* outputMaps[7] = {products->slope, products->aspect, products->hillshade,
+                                           products->profileCurvature, products->planCurvature,
+                                           products->maximum, products->minimum};
+
+        for (int i = 0; i < 7; i++)
+            if (outputMaps[i] != nullptr)
+                outputMaps[i]->initializeGrid(dtm);
+
+        const Crit3DTerrainDerivatives& requested = *products;
+        parallelFor(0, dtm.header->nrRows, 16, [&](int firstRow, int lastRow)
+                    { computeTerrainDerivativesRows(dtm, requested, firstRow, lastRow); });
+
+        for (int i = 0; i < 7; i++)
+            if (outputMaps[i] != nullptr)
+            {
+                gis::updateMinMaxRasterGrid(outputMaps[i]);
+                outputMaps[i]->isLoaded = true;
+            }
+
+        return true;
+    }
+
+
+    /*!
+     * \brief compute slope and aspect maps [degrees]
+     * the interior cells with a fully valid 3x3 window use the SIMD kernel
+     * computeSlopeAspectInterior (see simdKernels.cpp for its maximum error),
+     * the other cells the scalar path. Rows are computed in parallel:
+     * results don't depend on the number of threads.
+     */
+    bool computeSlopeAspectMaps(const gis::Crit3DRasterGrid& dtm,
+                                gis::Crit3DRasterGrid* slopeMap, gis::Crit3DRasterGrid* aspectMap)
+    {
+        Crit3DTerrainDerivatives products;
+        products.slope = slopeMap;
+        products.aspect = aspectMap;
+
+        return computeTerrainDerivatives(dtm, &products);
+    }
+
+
+    /*!
+     * \brief compute slope and aspect of a DTM file by horizontal bands,
+     * without loading the whole grid (see streamEsriGrid)
+     * \param dtmFileName      string name file (without extension)
+     * \param slopeFileName    string name file of the output slope map
+     * \param aspectFileName   string name file of the output aspect map
+     * \param bandRows         number of rows of each band
+     * \param myError          string pointer
+     * \return true on success, false otherwise
+     */
+    bool computeSlopeAspectMaps(std::string dtmFileName, std::string slopeFileName, std::string aspectFileName,
+                                int bandRows, std::string* myError)
+    {
+        std::vector<std::string> outputFileNames;
+        outputFileNames.push_back(slopeFileName);
+        outputFileNames.push_back(aspectFileName);
+
+        return streamEsriGrid(dtmFileName, outputFileNames, bandRows, 1,
+                              [](const Crit3DRasterGrid& dtmBand, std::vector<Crit3DRasterGrid*>& outputBands)
+                              { return computeSlopeAspectMaps(dtmBand, outputBands[0], outputBands[1]); },
+                              myError);
+    }
+
+
+    Crit3DColorGrid::Crit3DColorGrid()
+    {
+        nrRows = 0;
+        nrCols = 0;
+        isLoaded = false;
+    }
+
+
+    void Crit3DColorGrid::initialize(int myNrRows, int myNrCols)
+    {
+        nrRows = myNrRows;
+        nrCols = myNrCols;
+        rgba.assign(size_t(nrRows) * size_t(nrCols) * 4, 0);
+        isLoaded = false;
+    }
+
+
+    void Crit3DColorGrid::clear()
+    {
+        nrRows = 0;
+        nrCols = 0;
+        rgba.clear();
+        isLoaded = false;
+    }
+
+
+    /*!
+     * \brief compute the shaded colors of a DTM in one parallel pass:
+     * color of the DTM color scale, darkened on the slopes facing north and
+     * lightened on the slopes facing south, proportionally to the slope.
+     * Cells steeper than artifactSlope are blended with white.
+     * \param myDtm            DTM with its color scale
+     * \param slopeMap         slope [degrees]
+     * \param aspectMap        aspect [degrees]
+     * \param artifactSlope    [degrees]
+     * \param colorGrid        [output] RGBA colors, alpha = 0 on nodata
+     * \return true on success, false if the maps are not loaded or have different sizes
+     */
+    bool computeShadedColorGrid(const Crit3DRasterGrid& myDtm, const Crit3DRasterGrid& slopeMap,
+                                const Crit3DRasterGrid& aspectMap, float artifactSlope, Crit3DColorGrid* colorGrid)
+    {
+        if (! myDtm.isLoaded || ! slopeMap.isLoaded || ! aspectMap.isLoaded) return false;
+
+        int nrRows = myDtm.header->nrRows;
+        int nrCols = myDtm.header->nrCols;
+        if (slopeMap.header->nrRows != nrRows || slopeMap.header->nrCols != nrCols
+            || aspectMap.header->nrRows != nrRows || aspectMap.header->nrCols != nrCols)
+            return false;
+
+        colorGrid->initialize(nrRows, nrCols);
+
+        float slopeAmplification = 120.f / std::max(slopeMap.maximum, 1.f);
+
+        parallelFor(0, nrRows, 16, [&](int firstRow, int lastRow)
+        {
+            for (int row = firstRow; row < lastRow; row++)
+            {
+                const float* dtmRow = myDtm.value[row];
+                const float* slopeRow = slopeMap.value[row];
+                const float* aspectRow = aspectMap.value[row];
+
+                for (int col = 0; col < nrCols; col++)
+                {
+                    if (dtmRow[col] == myDtm.header->flag) continue;
+
+                    Crit3DColor* color = myDtm.colorScale->getColor(dtmRow[col]);
+                    int red = color->red;
+                    int green = color->green;
+                    int blue = color->blue;
+
+                    float aspect = aspectRow[col];
+                    float slope = slopeRow[col];
+                    if (aspect != aspectMap.header->flag && slope != slopeMap.header->flag)
+                    {
+                        float shadow = -cos(aspect * float(DEG_TO_RAD)) * std::max(5.f, slope * slopeAmplification);
+                        red = std::min(255, std::max(0, int(red + shadow)));
+                        green = std::min(255, std::max(0, int(green + shadow)));
+                        blue = std::min(255, std::max(0, int(blue + shadow)));
+                        if (slope > artifactSlope)
+                        {
+                            red = std::min(255, std::max(0, int((red + 256) / 2)));
+                            green = std::min(255, std::max(0, int((green + 256) / 2)));
+                            blue = std::min(255, std::max(0, int((blue + 256) / 2)));
+                        }
+                    }
+
+                    unsigned char* rgba = colorGrid->getRGBA(row, col);
+                    rgba[0] = (unsigned char)(red);
+                    rgba[1] = (unsigned char)(green);
+                    rgba[2] = (unsigned char)(blue);
+                    rgba[3] = 255;
+                }
+            }
+        });
+
+        colorGrid->isLoaded = true;
+        return true;
+    }
+
+
+    /*!
+     * \brief boundaryMap = 1 where isBoundary, 0 on the other valid cells
+     */
+    bool computeBoundaryMap(const Crit3DRasterGrid& myGrid, Crit3DRasterGrid* boundaryMap)
+    {
+        if (! myGrid.isLoaded) return false;
+
+        boundaryMap->initializeGrid(myGrid);
+
+        for (int row = 0; row < myGrid.header->nrRows; row++)
+            for (int col = 0; col < myGrid.header->nrCols; col++)
+                if (myGrid.value[row][col] != myGrid.header->flag)
+                    boundaryMap->value[row][col] = isBoundary(myGrid, row, col) ? 1 : 0;
+
+        gis::updateMinMaxRasterGrid(boundaryMap);
+        boundaryMap->isLoaded = true;
+
+        return true;
+    }
+
+
+    bool computeBoundaryMap(std::string inputFileName, std::string outputFileName, int bandRows, std::string* myError)
+    {
+        std::vector<std::string> outputFileNames(1, outputFileName);
+
+        return streamEsriGrid(inputFileName, outputFileNames, bandRows, 1,
+                              [](const Crit3DRasterGrid& inputBand, std::vector<Crit3DRasterGrid*>& outputBands)
+                              { return computeBoundaryMap(inputBand, outputBands[0]); },
+                              myError);
+    }
+
+
+    bool mapAlgebra(std::string inputFileName, float myValue, std::string outputFileName, operationType myOperation,
+                    int bandRows, std::string* myError)
+    {
+        std::vector<std::string> outputFileNames(1, outputFileName);
+
+        return streamEsriGrid(inputFileName, outputFileNames, bandRows, 0,
+                              [myValue, myOperation](const Crit3DRasterGrid& inputBand, std::vector<Crit3DRasterGrid*>& outputBands)
+                              { return mapAlgebra(const_cast<Crit3DRasterGrid*>(&inputBand), myValue, outputBands[0], myOperation); },
+                              myError);
+    }
+
+
+    bool mapAlgebra(gis::Crit3DRasterGrid* myMap1, float myValue,
+                    gis::Crit3DRasterGrid* myMapOut, operationType myOperation)
+    {
+        if (myMapOut == nullptr || myMap1 == nullptr) return false;
+        if (! (*(myMap1->header) == *(myMapOut->header))) return false;
+        if (myOperation == operationDivide && myValue == 0) return false;
+
+        float flag = myMap1->header->flag;
+        int nrCols = myMapOut->header->nrCols;
+
+        for (int myRow=0; myRow<myMapOut->header->nrRows; myRow++)
+        {
+            const float* inRow = myMap1->value[myRow];
+            float* outRow = myMapOut->value[myRow];
+
+            switch(myOperation)
+            {
+            case operationMin:
+                for (int myCol=0; myCol<nrCols; myCol++)
+                    if (inRow[myCol] != flag) outRow[myCol] = std::min(inRow[myCol], myValue);
+                break;
+            case operationMax:
+                for (int myCol=0; myCol<nrCols; myCol++)
+                    if (inRow[myCol] != flag) outRow[myCol] = std::max(inRow[myCol], myValue);
+                break;
+            case operationSum:
+                for (int myCol=0; myCol<nrCols; myCol++)
+                    if (inRow[myCol] != flag) outRow[myCol] = inRow[myCol] + myValue;
+                break;
+            case operationSubtract:
+                for (int myCol=0; myCol<nrCols; myCol++)
+                    if (inRow[myCol] != flag) outRow[myCol] = inRow[myCol] - myValue;
+                break;
+            case operationProduct:
+                for (int myCol=0; myCol<nrCols; myCol++)
+                    if (inRow[myCol] != flag) outRow[myCol] = inRow[myCol] * myValue;
+                break;
+            case operationDivide:
+                for (int myCol=0; myCol<nrCols; myCol++)
+                    if (inRow[myCol] != flag) outRow[myCol] = inRow[myCol] / myValue;
+                break;
+            }
+        }
+
+        myMapOut->setStatisticsDirty();
+        return true;
+    }
+
+
+    /*!
+     * \brief return true if value(row, col) > all values of neighbours
      * \param myGrid Crit3DRasterGrid
      * \param row
      * \param col
@@ -1089,87 +2068,478 @@ namespace gis
     }
 
 
-    float prevailingValue(const std::vector<float> valueList)
+    /*!
+     * \brief counter of the values for the mode: open addressing hash table sized once
+     * (at least twice the maximum number of values), cleared by the list of the used slots.
+     * Ties go to the value added first, as prevailingValue.
+     */
+    class modeCounter
     {
-        std::vector <float> values;
-        std::vector <unsigned int> counters;
-        float prevailing;
-        unsigned int i, j, maxCount;
-        bool isFound;
+    public:
+        explicit modeCounter(int maxValues)
+        {
+            size_t size = 16;
+            while (size < size_t(maxValues) * 2) size *= 2;
+            mask = size - 1;
+            values.resize(size);
+            counts.assign(size, 0);
+            usedSlots.reserve(size);
+        }
+
+        void clear()
+        {
+            for (unsigned int i = 0; i < usedSlots.size(); i++)
+                counts[usedSlots[i]] = 0;
+            usedSlots.clear();
+        }
 
-        values.push_back(valueList[0]);
-        counters.push_back(1);
-        for (i = 1; i < valueList.size(); i++)
+        void add(float value, int count)
         {
-            isFound = false;
-            j = 0;
-            while ((j < values.size()) && (!isFound))
+            // +0 and -0 are equal: same hash
+            float key = value + 0.f;
+            uint32_t bits;
+            memcpy(&bits, &key, sizeof(bits));
+
+            size_t slot = (bits * 2654435761u) & mask;
+            while (counts[slot] != 0)
             {
-                if (valueList[i] == values[j])
+                if (values[slot] == value)
                 {
-                    isFound = true;
-                    counters[j]++;
+                    counts[slot] += count;
+                    return;
                 }
-                j++;
+                slot = (slot + 1) & mask;
+            }
+
+            values[slot] = value;
+            counts[slot] = count;
+            usedSlots.push_back(slot);
+        }
+
+        float mode() const
+        {
+            // used slots are in order of insertion: the first maximum wins the ties
+            size_t prevailing = usedSlots[0];
+            for (unsigned int i = 1; i < usedSlots.size(); i++)
+                if (counts[usedSlots[i]] > counts[prevailing])
+                    prevailing = usedSlots[i];
+
+            return values[prevailing];
+        }
+
+    private:
+        size_t mask;
+        std::vector<float> values;
+        std::vector<int> counts;
+        std::vector<size_t> usedSlots;
+    };
+
+
+    float prevailingValue(const std::vector<float> valueList)
+    {
+        if (valueList.empty()) return NODATA;
+
+        modeCounter counter(int(valueList.size()));
+        for (unsigned int i = 0; i < valueList.size(); i++)
+            counter.add(valueList[i], 1);
+
+        return counter.mode();
+    }
+
+
+    /*!
+     * \brief index tables of one axis (rows or columns) of the output grid,
+     * computed once and shared by all the output cells
+     */
+    struct resampleAxis
+    {
+        int nrSamples;                      /*!< sub-samples for each output cell */
+        std::vector<int> nrRuns;            /*!< runs of sub-samples in the same input cell, for each output cell */
+        std::vector<int> runIndex;          /*!< input index of each run (nrSamples for each output cell) */
+        std::vector<int> runLength;         /*!< sub-samples of each run */
+        std::vector<int> nearest;           /*!< input index of each output cell center, -1 outside */
+        std::vector<int> neighbours;        /*!< 4 input indexes around each center, clamped on the borders */
+        std::vector<float> fraction;        /*!< [0-1] position of each center between neighbours 1 and 2 */
+        std::vector<float> cubicWeights;    /*!< 4 weights of the cubic convolution (Catmull-Rom) */
+    };
+
+
+    /*!
+     * \brief interpolation tables of the output cell i
+     * \param position     position of the cell center in input cells, from the first cell center
+     */
+    static void setAxisInterpolation(resampleAxis& axis, int i, double position, int nrInput)
+    {
+        int first = int(floor(position));
+        float t = float(position - first);
+
+        for (int k = 0; k < 4; k++)
+            axis.neighbours[size_t(i) * 4 + size_t(k)] = std::min(std::max(first - 1 + k, 0), nrInput - 1);
+
+        axis.fraction[size_t(i)] = t;
+
+        float* w = &(axis.cubicWeights[size_t(i) * 4]);
+        w[0] = ((-0.5f * t + 1.f) * t - 0.5f) * t;
+        w[1] = (1.5f * t - 2.5f) * t * t + 1.f;
+        w[2] = ((-1.5f * t + 2.f) * t + 0.5f) * t;
+        w[3] = (0.5f * t - 0.5f) * t * t;
+    }
+
+
+    static void resizeAxis(resampleAxis& axis, int nrOutput, int dim)
+    {
+        axis.nrSamples = 2 * dim + 1;
+        axis.nrRuns.assign(size_t(nrOutput), 0);
+        axis.runIndex.resize(size_t(nrOutput) * size_t(axis.nrSamples));
+        axis.runLength.resize(size_t(nrOutput) * size_t(axis.nrSamples));
+        axis.nearest.resize(size_t(nrOutput));
+        axis.neighbours.resize(size_t(nrOutput) * 4);
+        axis.fraction.resize(size_t(nrOutput));
+        axis.cubicWeights.resize(size_t(nrOutput) * 4);
+    }
+
+
+    /*!
+     * \brief add a sub-sample of the output cell i: the sub-samples of a cell are added
+     * in order, so the ones in the same input cell are consecutive
+     * \param index    input index of the sub-sample, -1 outside the input grid
+     */
+    static void addAxisSample(resampleAxis& axis, int i, int index)
+    {
+        if (index < 0) return;
+
+        size_t first = size_t(i) * size_t(axis.nrSamples);
+        int& nrRuns = axis.nrRuns[size_t(i)];
+        if (nrRuns > 0 && axis.runIndex[first + size_t(nrRuns - 1)] == index)
+        {
+            axis.runLength[first + size_t(nrRuns - 1)]++;
+            return;
+        }
+
+        axis.runIndex[first + size_t(nrRuns)] = index;
+        axis.runLength[first + size_t(nrRuns)] = 1;
+        nrRuns++;
+    }
+
+
+    /*!
+     * \brief column tables: sub-samples at (i * cellSize / nrSamples) from the cell center,
+     * computed as isOutOfGridXY and getRowColFromXY
+     */
+    static void initializeColAxis(const Crit3DRasterHeader& input, const Crit3DRasterHeader& output, int dim, resampleAxis& axis)
+    {
+        resizeAxis(axis, output.nrCols, dim);
+        double step = output.cellSize / axis.nrSamples;
+        double xMin = input.llCorner->x;
+        double xMax = input.llCorner->x + (input.nrCols * input.cellSize);
+
+        for (int col = 0; col < output.nrCols; col++)
+        {
+            double x = output.llCorner->x + output.cellSize * (col + 0.5);
+            for (int i = -dim; i <= dim; i++)
+            {
+                double sampleX = x + (i * step);
+                bool isOut = (sampleX < xMin || sampleX >= xMax);
+                addAxisSample(axis, col, isOut ? -1 : int(floor((sampleX - xMin) / input.cellSize)));
             }
 
-            if (!isFound)
+            bool isOut = (x < xMin || x >= xMax);
+            axis.nearest[size_t(col)] = isOut ? -1 : int(floor((x - xMin) / input.cellSize));
+            setAxisInterpolation(axis, col, (x - xMin) / input.cellSize - 0.5, input.nrCols);
+        }
+    }
+
+
+    static void initializeRowAxis(const Crit3DRasterHeader& input, const Crit3DRasterHeader& output, int dim, resampleAxis& axis)
+    {
+        resizeAxis(axis, output.nrRows, dim);
+        double step = output.cellSize / axis.nrSamples;
+        double yMin = input.llCorner->y;
+        double yMax = input.llCorner->y + (input.nrRows * input.cellSize);
+
+        for (int row = 0; row < output.nrRows; row++)
+        {
+            double y = output.llCorner->y + output.cellSize * (output.nrRows - row - 0.5);
+            for (int j = -dim; j <= dim; j++)
             {
-                values.push_back(valueList[i]);
-                counters.push_back(1);
+                double sampleY = y + (j * step);
+                bool isOut = (sampleY < yMin || sampleY >= yMax);
+                addAxisSample(axis, row, isOut ? -1 : (input.nrRows - 1) - int(floor((sampleY - yMin) / input.cellSize)));
             }
+
+            bool isOut = (y < yMin || y >= yMax);
+            axis.nearest[size_t(row)] = isOut ? -1 : (input.nrRows - 1) - int(floor((y - yMin) / input.cellSize));
+            setAxisInterpolation(axis, row, (yMax - y) / input.cellSize - 0.5, input.nrRows);
         }
+    }
+
 
-        maxCount = counters[0];
-        prevailing = values[0];
-         for (i = 1; i < values.size(); i++)
-            if (counters[i] > maxCount)
+    /*!
+     * \brief bilinear interpolation on the valid cells among the 4 nearest centers
+     * (nodata if the cell containing the center is nodata or outside the input grid)
+     */
+    static float bilinearValue(const Crit3DRasterGrid& inputMap, const resampleAxis& rowAxis, const resampleAxis& colAxis,
+                               int row, int col, float flag)
+    {
+        const int* rows = &(rowAxis.neighbours[size_t(row) * 4]);
+        const int* cols = &(colAxis.neighbours[size_t(col) * 4]);
+        float ty = rowAxis.fraction[size_t(row)];
+        float tx = colAxis.fraction[size_t(col)];
+        float rowWeight[2] = {1 - ty, ty};
+        float colWeight[2] = {1 - tx, tx};
+
+        float sum = 0, sumWeight = 0;
+        for (int r = 0; r < 2; r++)
+            for (int c = 0; c < 2; c++)
             {
-                maxCount = counters[i];
-                prevailing = values[i];
+                float value = inputMap.value[rows[r + 1]][cols[c + 1]];
+                if (value == inputMap.header->flag) continue;
+
+                float weight = rowWeight[r] * colWeight[c];
+                sum += value * weight;
+                sumWeight += weight;
             }
 
-        return(prevailing);
+        if (sumWeight <= 0) return flag;
+        return sum / sumWeight;
     }
 
 
-    bool prevailingMap(const Crit3DRasterGrid& inputMap,  Crit3DRasterGrid *outputMap)
+    /*!
+     * \brief value at the center of the output cell (row, col): nearest, bilinear or cubic
+     * (nodata if the input cell containing the center is nodata or outside the input grid;
+     * cubic falls back to bilinear near nodata)
+     */
+    static float interpolatedValue(const Crit3DRasterGrid& inputMap, const resampleAxis& rowAxis, const resampleAxis& colAxis,
+                                   int row, int col, resampleMethod method, float flag)
     {
-        int i, j;
-        float value;
-        double x, y;
-        int inputRow, inputCol;
-        int dim = 3;
+        float inputFlag = inputMap.header->flag;
+        int nearestRow = rowAxis.nearest[size_t(row)];
+        int nearestCol = colAxis.nearest[size_t(col)];
+        if (nearestRow < 0 || nearestCol < 0 || inputMap.value[nearestRow][nearestCol] == inputFlag)
+            return flag;
+
+        if (method == resampleNearest)
+            return inputMap.value[nearestRow][nearestCol];
 
-        std::vector <float> valuesList;
-        double step = outputMap->header->cellSize / (2*dim+1);
+        if (method == resampleCubic)
+        {
+            const int* rows = &(rowAxis.neighbours[size_t(row) * 4]);
+            const int* cols = &(colAxis.neighbours[size_t(col) * 4]);
+            const float* rowWeight = &(rowAxis.cubicWeights[size_t(row) * 4]);
+            const float* colWeight = &(colAxis.cubicWeights[size_t(col) * 4]);
+
+            float sum = 0;
+            bool isValid = true;
+            for (int r = 0; r < 4 && isValid; r++)
+                for (int c = 0; c < 4; c++)
+                {
+                    float value = inputMap.value[rows[r]][cols[c]];
+                    if (value == inputFlag)
+                    {
+                        isValid = false;
+                        break;
+                    }
+                    sum += value * rowWeight[r] * colWeight[c];
+                }
+
+            if (isValid) return sum;
+        }
 
-        for (int row = 0; row < outputMap->header->nrRows ; row++)
-            for (int col = 0; col < outputMap->header->nrCols; col++)
+        return bilinearValue(inputMap, rowAxis, colAxis, row, col, flag);
+    }
+
+
+    /*!
+     * \brief resample a raster on the grid of outputMap (already initialized with the output header)
+     * nearest, bilinear, cubic: value at the output cell center (nodata if the input cell
+     * containing the center is nodata; bilinear on the valid neighbours, cubic falls back
+     * to bilinear near nodata).
+     * mean, min, max, mode: on nrSubSamples x nrSubSamples sub-samples of each output cell
+     * (odd, e.g. 7), nodata if all of them are nodata; the mode ties go to the first
+     * sub-sample by columns, then by rows from the bottom.
+     * The sub-sample and interpolation indexes are precomputed by rows and columns,
+     * output rows are computed in parallel, with no allocation for each cell.
+     * The mode of nrSubSamples 7 is the prevailing value of prevailingMap.
+     */
+    bool resampleGrid(const Crit3DRasterGrid& inputMap, Crit3DRasterGrid* outputMap, resampleMethod method, int nrSubSamples)
+    {
+        if (! inputMap.isLoaded || ! outputMap->isLoaded) return false;
+        if (nrSubSamples < 1) return false;
+
+        const Crit3DRasterHeader& input = *(inputMap.header);
+        const Crit3DRasterHeader& output = *(outputMap->header);
+        bool isAggregation = (method == resampleMean || method == resampleMin
+                              || method == resampleMax || method == resampleMode);
+        int dim = isAggregation ? nrSubSamples / 2 : 0;
+
+        resampleAxis rowAxis, colAxis;
+        initializeRowAxis(input, output, dim, rowAxis);
+        initializeColAxis(input, output, dim, colAxis);
+
+        float inputFlag = input.flag;
+        float flag = output.flag;
+        int nrSamples = rowAxis.nrSamples;
+
+        parallelFor(0, output.nrRows, 4, [&](int firstRow, int lastRow)
+        {
+            modeCounter counter(nrSamples * nrSamples);
+
+            for (int row = firstRow; row < lastRow; row++)
             {
-                /*! center */
-                getUtmXYFromRowCol(*outputMap, row, col, &x, &y);
-                valuesList.resize(0);
+                const int* runRows = &(rowAxis.runIndex[size_t(row) * size_t(nrSamples)]);
+                const int* runRowLengths = &(rowAxis.runLength[size_t(row) * size_t(nrSamples)]);
+                int nrRowRuns = rowAxis.nrRuns[size_t(row)];
+                float* outputRow = outputMap->value[row];
+
+                for (int col = 0; col < output.nrCols; col++)
+                {
+                    if (! isAggregation)
+                    {
+                        outputRow[col] = interpolatedValue(inputMap, rowAxis, colAxis, row, col, method, flag);
+                        continue;
+                    }
 
-                for (i = -dim; i <= dim; i++)
-                    for (j = -dim; j <= dim; j++)
-                        if (! gis::isOutOfGridXY(x+(i*step), y+(j*step), inputMap.header))
+                    // aggregation of the sub-samples, by columns then by rows:
+                    // each input cell is read once, weighted by its sub-samples
+                    const int* runCols = &(colAxis.runIndex[size_t(col) * size_t(nrSamples)]);
+                    const int* runColLengths = &(colAxis.runLength[size_t(col) * size_t(nrSamples)]);
+                    int nrColRuns = colAxis.nrRuns[size_t(col)];
+                    double sum = 0;
+                    float minimum = FLT_MAX, maximum = -FLT_MAX;
+                    int nrValues = 0;
+                    counter.clear();
+
+                    for (int i = 0; i < nrColRuns; i++)
+                    {
+                        int inputCol = runCols[i];
+                        for (int j = 0; j < nrRowRuns; j++)
                         {
-                            gis::getRowColFromXY(inputMap, x+(i*step), y+(j*step), &inputRow, &inputCol);
-                            value = inputMap.value[inputRow][inputCol];
-                            if (value != inputMap.header->flag)
-                                valuesList.push_back(value);
+                            float value = inputMap.value[runRows[j]][inputCol];
+                            if (value == inputFlag) continue;
+
+                            int weight = runColLengths[i] * runRowLengths[j];
+                            if (method == resampleMode)
+                                counter.add(value, weight);
+                            sum += double(value) * weight;
+                            minimum = std::min(minimum, value);
+                            maximum = std::max(maximum, value);
+                            nrValues += weight;
                         }
+                    }
 
-                if (valuesList.size() == 0)
-                    outputMap->value[row][col] = outputMap->header->flag;
-                else
-                    outputMap->value[row][col] = prevailingValue(valuesList);
+                    if (nrValues == 0)
+                        outputRow[col] = flag;
+                    else if (method == resampleMean)
+                        outputRow[col] = float(sum / nrValues);
+                    else if (method == resampleMin)
+                        outputRow[col] = minimum;
+                    else if (method == resampleMax)
+                        outputRow[col] = maximum;
+                    else
+                        outputRow[col] = counter.mode();
+                }
             }
+        });
 
+        outputMap->setStatisticsDirty();
         return true;
     }
 
+
+    /*!
+     * \brief cell by cell operation of myMap1 and myMap2 on the grid of myMap1:
+     * with the same header it is a fused expression of the two rasters, otherwise each row
+     * of myMap2 is aligned on the fly (at the cell centers of myMap1, nodata outside myMap2)
+     * in a row buffer and combined by the same row kernel
+     */
+    template <class operation>
+    static bool mapAlgebraRasters(const Crit3DRasterGrid& myMap1, const Crit3DRasterGrid& myMap2,
+                                  Crit3DRasterGrid* myMapOut, resampleMethod alignMethod)
+    {
+        typedef rasterBinary<rasterTerm, rasterTerm, operation> expression;
+
+        if (*(myMap1.header) == *(myMap2.header))
+            return evaluateExpression(expression(raster(myMap1), raster(myMap2)), myMapOut);
+
+        if (! myMap1.isLoaded || ! myMap2.isLoaded || ! myMapOut->isLoaded) return false;
+        if (! (*(myMap1.header) == *(myMapOut->header))) return false;
+
+        resampleAxis rowAxis, colAxis;
+        initializeRowAxis(*(myMap2.header), *(myMap1.header), 0, rowAxis);
+        initializeColAxis(*(myMap2.header), *(myMap1.header), 0, colAxis);
+
+        float flag1 = myMap1.header->flag;
+        float flag2 = myMap2.header->flag;
+        float flag = myMapOut->header->flag;
+        int nrCols = myMap1.header->nrCols;
+
+        parallelFor(0, myMap1.header->nrRows, 16, [&](int firstRow, int lastRow)
+        {
+            std::vector<float> alignedRow(nrCols);
+
+            for (int row = firstRow; row < lastRow; row++)
+            {
+                for (int col = 0; col < nrCols; col++)
+                    alignedRow[size_t(col)] = interpolatedValue(myMap2, rowAxis, colAxis, row, col, alignMethod, flag2);
+
+                evaluateRow(typename expression::rowReader(rasterTerm::rowReader(myMap1.value[row], flag1),
+                                                           rasterTerm::rowReader(alignedRow.data(), flag2)),
+                            myMapOut->value[row], nrCols, flag);
+            }
+        });
+
+        myMapOut->setStatisticsDirty();
+        return true;
+    }
+
+
+    /*!
+     * \brief cell by cell operation of two rasters, on the grid of myMap1 (myMapOut must have its header,
+     * and may be myMap1). Nodata where an operand is nodata, or the divisor is zero.
+     * If myMap2 has a different header it is aligned on myMap1 by alignMethod (nearest, bilinear or cubic).
+     */
+    bool mapAlgebra(Crit3DRasterGrid* myMap1, Crit3DRasterGrid* myMap2, Crit3DRasterGrid* myMapOut,
+                    operationType myOperation, resampleMethod alignMethod)
+    {
+        if (myMap1 == nullptr || myMap2 == nullptr || myMapOut == nullptr) return false;
+        if (alignMethod != resampleNearest && alignMethod != resampleBilinear && alignMethod != resampleCubic)
+            return false;
+
+        switch(myOperation)
+        {
+        case operationMin:
+            return mapAlgebraRasters<minOperation>(*myMap1, *myMap2, myMapOut, alignMethod);
+        case operationMax:
+            return mapAlgebraRasters<maxOperation>(*myMap1, *myMap2, myMapOut, alignMethod);
+        case operationSum:
+            return mapAlgebraRasters<sumOperation>(*myMap1, *myMap2, myMapOut, alignMethod);
+        case operationSubtract:
+            return mapAlgebraRasters<subtractOperation>(*myMap1, *myMap2, myMapOut, alignMethod);
+        case operationProduct:
+            return mapAlgebraRasters<productOperation>(*myMap1, *myMap2, myMapOut, alignMethod);
+        case operationDivide:
+            return mapAlgebraRasters<divideOperation>(*myMap1, *myMap2, myMapOut, alignMethod);
+        }
+
+        return false;
+    }
+
+
+    bool mapAlgebra(Crit3DRasterGrid* myMap1, Crit3DRasterGrid* myMap2, Crit3DRasterGrid* myMapOut, operationType myOperation)
+    {
+        return mapAlgebra(myMap1, myMap2, myMapOut, myOperation, resampleNearest);
+    }
+
+
+    /*!
+     * \brief prevailing value (mode) of 7 x 7 sub-samples of each output cell
+     */
+    bool prevailingMap(const Crit3DRasterGrid& inputMap,  Crit3DRasterGrid *outputMap)
+    {
+        return resampleGrid(inputMap, outputMap, resampleMode, 7);
+    }
+
     float topographicDistance(float X1, float Y1, float Z1, float X2, float Y2, float Z2, float distance,
                               const gis::Crit3DRasterGrid& dem_)
     {
@@ -1224,32 +2594,795 @@ namespace gis
         return maxDeltaZ;
     }
 
+    /*!
+     * \brief the float sums x = x0 + Dx, x + Dx, ... of topographicDistance as x0 + i * step:
+     * while the sums stay in the binade of x0, each one adds Dx rounded to the float spacing
+     * \return false if the sums may leave the binade (or Dx is half way between two spacings)
+     */
+    static bool getFloatSumStep(float x0, float Dx, int nrSteps, double* step)
+    {
+        if (Dx == 0)
+        {
+            *step = 0;
+            return true;
+        }
+        if (fabsf(x0) < FLT_MIN || fabsf(x0) > FLT_MAX || fabsf(Dx) > FLT_MAX) return false;
+
+        int exponent;
+        frexp(double(x0), &exponent);
+        double spacing = ldexp(1., exponent - 24);
+        double ratio = double(Dx) / spacing;
+        if (ratio - floor(ratio) == 0.5) return false;
+        *step = floor(ratio + 0.5) * spacing;
+
+        // first and last sum, and the exact sums before rounding, in [2^(exponent-1), 2^exponent)
+        double sign = (x0 > 0) ? 1 : -1;
+        double first = sign * double(x0);
+        double last = sign * (double(x0) + nrSteps * (*step));
+        double margin = fabs(double(Dx)) + spacing;
+        return (std::min(first, last) - margin >= ldexp(1., exponent - 1)
+                && std::max(first, last) + margin < ldexp(1., exponent));
+    }
+
+
+    /*!
+     * \brief topographicDistance with the samples of the line bounded by a min/max pyramid of the DEM:
+     * the ranges of samples whose blocks are not higher than the highest sample found (or than the
+     * lower end) are skipped, the others are split down to a few samples, evaluated one by one.
+     * The samples are the same float sums of topographicDistance (getFloatSumStep), so is the value;
+     * when they can't be written in that form, topographicDistance itself is called.
+     */
+    static float topographicDistanceBounded(float X1, float Y1, float Z1, float X2, float Y2, float Z2, float distance,
+                                            const Crit3DRasterGrid& dem_, const Crit3DRasterPyramid& pyramid)
+    {
+        const int nrLeafSamples = 32;
+
+        float stepMeter = float(dem_.header->cellSize);
+        if (distance < stepMeter)
+            return 0;
+
+        int nrStep = int(distance / stepMeter);
+
+        // from the lower end, as topographicDistance
+        bool isFirstLower = (Z1 < Z2);
+        float Xi = isFirstLower ? X1 : X2;
+        float Yi = isFirstLower ? Y1 : Y2;
+        float Zi = isFirstLower ? Z1 : Z2;
+        float Xf = isFirstLower ? X2 : X1;
+        float Yf = isFirstLower ? Y2 : Y1;
+        float Dx = (Xf - Xi) / nrStep;
+        float Dy = (Yf - Yi) / nrStep;
+
+        double stepX, stepY;
+        if (! getFloatSumStep(Xi, Dx, nrStep, &stepX) || ! getFloatSumStep(Yi, Dy, nrStep, &stepY))
+            return topographicDistance(X1, Y1, Z1, X2, Y2, Z2, distance, dem_);
+
+        const Crit3DRasterHeader& header = *(dem_.header);
+        auto getSampleCell = [&](int i, int* row, int* col)
+        {
+            getFastRowColFromXY(header, double(Xi) + i * stepX, double(Yi) + i * stepY, row, col);
+        };
+
+        // highest block on the cells of the samples [first, last]: rows and cols are monotone along the line
+        auto getUpperBound = [&](int first, int last)
+        {
+            int row0, col0, row1, col1;
+            getSampleCell(first, &row0, &col0);
+            getSampleCell(last, &row1, &col1);
+            if (row0 > row1) std::swap(row0, row1);
+            if (col0 > col1) std::swap(col0, col1);
+            row0 = std::max(row0, 0);
+            col0 = std::max(col0, 0);
+            row1 = std::min(row1, header.nrRows - 1);
+            col1 = std::min(col1, header.nrCols - 1);
+            if (row0 > row1 || col0 > col1) return -FLT_MAX;
+
+            // blocks of about a quarter of the samples extent (at most 5 x 5)
+            int size = std::max(row1 - row0, col1 - col0) + 1;
+            int level = 0;
+            while (level < pyramid.nrLevels() - 1 && 4 * pyramid.blockSize(level) < size)
+                level++;
+
+            int blockSize = pyramid.blockSize(level);
+            float upperBound = -FLT_MAX;
+            for (int blockRow = row0 / blockSize; blockRow <= row1 / blockSize; blockRow++)
+                for (int blockCol = col0 / blockSize; blockCol <= col1 / blockSize; blockCol++)
+                    upperBound = std::max(upperBound, pyramid.maximum(level, blockRow, blockCol));
+            return upperBound;
+        };
+
+        struct sampleRange
+        {
+            int first, last;
+            float upperBound;
+        };
+
+        // depth first, the higher half first: at most one pending range for each split
+        sampleRange ranges[64];
+        int nrRanges = 0;
+        float highestZ = Zi;
+        ranges[nrRanges++] = {1, nrStep, getUpperBound(1, nrStep)};
+
+        while (nrRanges > 0)
+        {
+            sampleRange range = ranges[--nrRanges];
+            if (range.upperBound <= highestZ) continue;
+
+            if (range.last - range.first < nrLeafSamples)
+            {
+                for (int i = range.first; i <= range.last; i++)
+                {
+                    int row, col;
+                    getSampleCell(i, &row, &col);
+                    float demValue = dem_.getValueFromRowCol(row, col);
+                    if (demValue != header.flag && demValue > highestZ)
+                        highestZ = demValue;
+                }
+                continue;
+            }
+
+            int middle = (range.first + range.last) / 2;
+            sampleRange firstHalf = {range.first, middle, getUpperBound(range.first, middle)};
+            sampleRange lastHalf = {middle + 1, range.last, getUpperBound(middle + 1, range.last)};
+            if (firstHalf.upperBound > lastHalf.upperBound) std::swap(firstHalf, lastHalf);
+            ranges[nrRanges++] = firstHalf;
+            ranges[nrRanges++] = lastHalf;
+        }
+
+        // the highest sample above the lower end, as the maximum of the differences
+        return (highestZ > Zi) ? highestZ - Zi : 0;
+    }
+
+
+    /*!
+     * \brief map of the topographic distance from a point (see topographicDistance): the same values,
+     * with the samples of each line bounded by a min/max pyramid of the DEM (topographicDistanceBounded),
+     * so that mostly the samples near the highest terrain of the line are read instead of all of them
+     * (O(cells x distance)). The rows are computed in parallel.
+     */
     bool topographicDistanceMap(Crit3DPoint point_, const gis::Crit3DRasterGrid& dem_, Crit3DRasterGrid* map_)
     {
+        if (! dem_.isLoaded) return false;
+        if (! map_->initializeGrid(dem_)) return false;
 
-        int row, col;
-        float distance;
-        double gridX, gridY;
-        float demValue;
+        Crit3DRasterPyramid pyramid;
+        if (! pyramid.initialize(dem_)) return false;
+
+        parallelFor(0, dem_.header->nrRows, 1, [&](int firstRow, int lastRow)
+        {
+            float distance;
+            double gridX, gridY;
+            float demValue;
+
+            for (int row = firstRow; row < lastRow; row++)
+                for (int col = 0; col < dem_.header->nrCols; col++)
+                {
+                    demValue = dem_.value[row][col];
+                    if (demValue != dem_.header->flag)
+                    {
+                        gis::getUtmXYFromRowCol(dem_, row, col, &gridX, &gridY);
+                        distance = computeDistance(float(gridX), float(gridY), float(point_.utm.x), float(point_.utm.y));
+                        map_->value[row][col] = topographicDistanceBounded(float(gridX), float(gridY), demValue,
+                                                                           float(point_.utm.x), float(point_.utm.y),
+                                                                           float(point_.z), distance, dem_, pyramid);
+                    }
+                    else
+                        map_->value[row][col] = map_->header->flag;
+                }
+        });
+
+        gis::updateMinMaxRasterGrid(map_);
+        return true;
+    }
+
+
+    /*!
+     * \brief sector of the radial sweep: the rays to the border cells [firstIndex, lastIndex)
+     * of a window border (0 left, 1 right, 2 top, 3 bottom; corners belong to the left and right borders).
+     * A cell belongs to the sector of the border cell nearest to the point where the line
+     * from the center through the cell crosses the border (integer arithmetic, no rounding).
+     */
+    struct radialSweepSector
+    {
+        const Crit3DRasterWindow* window;
+        int centerRow, centerCol;
+        int border;
+        int firstIndex, lastIndex;
+        bool isFirst, isLast;           // first and last sector of the border: no lower or upper limit
+
+        radialSweepSector(const Crit3DRasterWindow& sweepWindow, int row, int col, int sector)
+        {
+            const int nrBorderSectors = std::max(RADIAL_SWEEP_SECTORS / 4, 1);
+            int part = sector % nrBorderSectors;
+            window = &sweepWindow;
+            centerRow = row;
+            centerCol = col;
+            border = sector / nrBorderSectors;
+            int borderLength = (border < 2) ? window->v[1].row - window->v[0].row + 1
+                                            : std::max(window->v[1].col - window->v[0].col - 1, 0);
+            firstIndex = int((long long)(part) * borderLength / nrBorderSectors);
+            lastIndex = int((long long)(part + 1) * borderLength / nrBorderSectors);
+            isFirst = (part == 0);
+            isLast = (part == nrBorderSectors - 1);
+        }
+
+        // ray from the center to the border cell i
+        void getRay(int i, int* dRow, int* dCol) const
+        {
+            if (border < 2)
+            {
+                *dRow = window->v[0].row + i - centerRow;
+                *dCol = ((border == 0) ? window->v[0].col : window->v[1].col) - centerCol;
+            }
+            else
+            {
+                *dRow = ((border == 2) ? window->v[0].row : window->v[1].row) - centerRow;
+                *dCol = window->v[0].col + i + 1 - centerCol;
+            }
+        }
+
+        bool contains(int row, int col) const
+        {
+            long long dRow = row - centerRow;
+            long long dCol = col - centerCol;
+            if (dRow == 0 && dCol == 0) return false;
+
+            long long colDistance = (dCol > 0) ? window->v[1].col - centerCol : centerCol - window->v[0].col;
+            long long rowDistance = (dRow > 0) ? window->v[1].row - centerRow : centerRow - window->v[0].row;
+            bool isColBorder = (dCol != 0 && colDistance * llabs(dRow) <= rowDistance * llabs(dCol));
+
+            // crossing on the border, relative to the center: minor * distance / major
+            long long minor, major, distance, firstCell;
+            if (isColBorder)
+            {
+                if (border != ((dCol < 0) ? 0 : 1)) return false;
+                minor = dRow;
+                major = llabs(dCol);
+                distance = colDistance;
+                firstCell = window->v[0].row - centerRow;
+            }
+            else
+            {
+                if (border != ((dRow < 0) ? 2 : 3)) return false;
+                minor = dCol;
+                major = llabs(dRow);
+                distance = rowDistance;
+                firstCell = window->v[0].col + 1 - centerCol;
+            }
+
+            // nearest border cell: floor(crossing + 0.5), compared with the sector limits
+            long long crossing = 2 * minor * distance + major;
+            if (! isFirst && crossing < 2 * (firstCell + firstIndex) * major) return false;
+            if (! isLast && crossing >= 2 * (firstCell + lastIndex) * major) return false;
+            return true;
+        }
+    };
+
+
+    /*!
+     * \brief geometry of a radial sweep (see radialSweep): the ray steps storing their value and the
+     * distance of the nearest ray from each cell center. It depends only on the window size and on
+     * the position of the center in it, so it is shared by the sweeps of windows with the same shape.
+     */
+    struct radialSweepRays
+    {
+        Crit3DRasterWindow window;
+        int centerRow, centerCol;
+        std::vector< std::vector<bool> > isStoredStep;  /*!< steps storing their value, in sweep order, by sector */
+        std::vector<float> deviation;                   /*!< distance [cells] of the nearest ray from each cell center
+                                                             (by rows), FLT_MAX on the cells reached by no ray */
+
+        radialSweepRays() : centerRow(NODATA), centerCol(NODATA) {}
+
+        bool isSameShape(const Crit3DRasterWindow& otherWindow, int otherRow, int otherCol) const
+        {
+            return (centerRow != NODATA
+                    && otherWindow.v[0].row - otherRow == window.v[0].row - centerRow
+                    && otherWindow.v[0].col - otherCol == window.v[0].col - centerCol
+                    && otherWindow.v[1].row - otherRow == window.v[1].row - centerRow
+                    && otherWindow.v[1].col - otherCol == window.v[1].col - centerCol);
+        }
+    };
 
-        map_->initializeGrid(dem_);
 
-        for (row = 0; row < dem_.header->nrRows; row++)
-            for (col = 0; col < dem_.header->nrCols; col++)
+    /*!
+     * \brief radial sweep (R2): rays from the center cell to each cell of the window border.
+     * Each ray walks one cell for each step along its major axis, carrying a state
+     * (e.g. the maximum slope found so far): value = step(state, row, col, rayRow, rayCol) is stored
+     * for the cells on which the ray passes nearest to the cell center.
+     * The rays are grouped in RADIAL_SWEEP_SECTORS sectors (consecutive border cells of each border),
+     * swept in parallel if isParallel: each sector reads and writes only its own cells (radialSweepSector).
+     * The geometry is computed during the sweep and kept in rays, unless rays already has the
+     * shape of the window: then the stored steps are read from it.
+     * Cost: O(border cells x distance), i.e. O(cells) on windows not too elongated.
+     * \param window       first and last cell (included) of the swept window, containing the center
+     * \param rays         [in/out] geometry of the sweep
+     * \param values       [out] values of the window cells (by rows), not set on the cells reached by no ray
+     */
+    template <class rayState, class rayStep>
+    static void radialSweep(const Crit3DRasterWindow& window, int centerRow, int centerCol, const rayStep& step,
+                            bool isParallel, radialSweepRays& rays, std::vector<float>& values)
+    {
+        int nrCols = window.v[1].col - window.v[0].col + 1;
+        size_t nrCells = size_t(window.v[1].row - window.v[0].row + 1) * size_t(nrCols);
+        int nrSectors = 4 * std::max(RADIAL_SWEEP_SECTORS / 4, 1);
+        values.resize(nrCells);
+
+        bool isKnownShape = rays.isSameShape(window, centerRow, centerCol);
+        if (! isKnownShape)
+        {
+            rays.window = window;
+            rays.centerRow = centerRow;
+            rays.centerCol = centerCol;
+            rays.isStoredStep.assign(size_t(nrSectors), std::vector<bool>());
+            rays.deviation.assign(nrCells, FLT_MAX);
+        }
+
+        auto sweepSectors = [&](int firstSector, int lastSector)
+        {
+            for (int sector = firstSector; sector < lastSector; sector++)
             {
-                demValue = dem_.value[row][col];
-                if (demValue != dem_.header->flag)
+                radialSweepSector sweepSector(window, centerRow, centerCol, sector);
+                std::vector<bool>& isStored = rays.isStoredStep[size_t(sector)];
+                size_t stepIndex = 0;
+
+                for (int i = sweepSector.firstIndex; i < sweepSector.lastIndex; i++)
                 {
-                    gis::getUtmXYFromRowCol(dem_, row, col, &gridX, &gridY);
-                    distance = computeDistance(float(gridX), float(gridY), float(point_.utm.x), float(point_.utm.y));
-                    map_->value[row][col] = topographicDistance((float)gridX, (float)gridY, demValue, (float)(point_.utm.x), (float)(point_.utm.y), (float)(point_.z), distance, dem_);
+                    int dRow, dCol;
+                    sweepSector.getRay(i, &dRow, &dCol);
+                    int nrSteps = std::max(abs(dRow), abs(dCol));
+                    rayState state;
+
+                    for (int j = 1; j <= nrSteps; j++, stepIndex++)
+                    {
+                        double rayRow = centerRow + double(dRow) * j / nrSteps;
+                        double rayCol = centerCol + double(dCol) * j / nrSteps;
+                        int row = int(floor(rayRow + 0.5));
+                        int col = int(floor(rayCol + 0.5));
+
+                        float value = step(state, row, col, rayRow, rayCol);
+
+                        size_t index = size_t(row - window.v[0].row) * size_t(nrCols) + size_t(col - window.v[0].col);
+                        if (isKnownShape)
+                        {
+                            if (isStored[stepIndex])
+                                values[index] = value;
+                            continue;
+                        }
+
+                        // the cells of the other sectors are written by other threads: not read
+                        isStored.push_back(false);
+                        if (! sweepSector.contains(row, col)) continue;
+
+                        float distance = float(fabs(rayRow - row) + fabs(rayCol - col));
+                        if (distance < rays.deviation[index])
+                        {
+                            rays.deviation[index] = distance;
+                            values[index] = value;
+                            isStored.back() = true;
+                        }
+                    }
                 }
-                else
-                    map_->value[row][col] = map_->header->flag;
             }
+        };
+
+        if (isParallel)
+            parallelFor(0, nrSectors, 1, sweepSectors);
+        else
+            sweepSectors(0, nrSectors);
+    }
 
+
+    /*!
+     * \brief visibility of a cell along the direct line of sight from the observer,
+     * walked one cell for each row or column as the rays of the radial sweep
+     */
+    static bool isVisibleCell(const Crit3DRasterGrid& dem, int observerRow, int observerCol, float observerZ,
+                              int row, int col, float targetHeight)
+    {
+        float flag = dem.header->flag;
+        float cellSize = float(dem.header->cellSize);
+        int dRow = row - observerRow;
+        int dCol = col - observerCol;
+        int nrSteps = std::max(abs(dRow), abs(dCol));
+        float maxSlope = -FLT_MAX;
+
+        for (int j = 1; j < nrSteps; j++)
+        {
+            int stepRow = int(floor(observerRow + double(dRow) * j / nrSteps + 0.5));
+            int stepCol = int(floor(observerCol + double(dCol) * j / nrSteps + 0.5));
+            float z = dem.value[stepRow][stepCol];
+            if (z == flag) continue;
+
+            float stepDistance = cellSize * sqrtf(float(stepRow - observerRow) * float(stepRow - observerRow)
+                                                  + float(stepCol - observerCol) * float(stepCol - observerCol));
+            maxSlope = std::max(maxSlope, (z - observerZ) / stepDistance);
+        }
+
+        float distance = cellSize * sqrtf(float(dRow) * float(dRow) + float(dCol) * float(dCol));
+        return (dem.value[row][col] + targetHeight - observerZ) / distance >= maxSlope;
+    }
+
+
+    static bool getObserverCell(const Crit3DRasterGrid& dem, const Crit3DUtmPoint& observer, float observerHeight,
+                                int* row, int* col, float* observerZ)
+    {
+        getRowColFromXY(dem, observer.x, observer.y, row, col);
+        if (isOutOfGridRowCol(*row, *col, dem)) return false;
+
+        float z = dem.value[*row][*col];
+        if (z == dem.header->flag) return false;
+
+        *observerZ = z + observerHeight;
         return true;
     }
 
-}
 
+    /*!
+     * \brief window of the cells within maxDistance [m] from a cell; the whole grid if maxDistance <= 0
+     */
+    static Crit3DRasterWindow getViewshedWindow(const Crit3DRasterHeader& header, int row, int col, float maxDistance)
+    {
+        if (maxDistance <= 0)
+            return Crit3DRasterWindow(0, 0, header.nrRows - 1, header.nrCols - 1);
+
+        double maxRadius = std::max(header.nrRows, header.nrCols);
+        int radius = int(std::min(ceil(maxDistance / header.cellSize), maxRadius));
+        return Crit3DRasterWindow(std::max(row - radius, 0), std::max(col - radius, 0),
+                                  std::min(row + radius, header.nrRows - 1), std::min(col + radius, header.nrCols - 1));
+    }
+
+
+    /*!
+     * \brief viewshed of an observer cell on a window: 1 visible, 0 not visible or nodata (by rows of the window)
+     * Radial sweep from the observer: a cell is visible if the slope of the target above it
+     * is not lower than the maximum slope of the terrain before it, along its line of sight
+     * walked as in isVisibleCell. The line of sight of a cell reached by a ray at step j walks
+     * the same cells as the ray, except at the steps k where the ray passes at less than
+     * 0.5 k / j cells from the border of its cell, on the side of the target: there it may walk
+     * the side cell. Each ray carries bounds of the maximum slope (the side cells kept with
+     * the last step they can reach): most cells are decided by the bounds, the others by the
+     * cells stored along the ray, so the result is the same as isVisibleCell on each cell.
+     */
+    static void computeViewshedWindow(const Crit3DRasterGrid& dem, int observerRow, int observerCol, float observerZ,
+                                      float targetHeight, float maxDistance, const Crit3DRasterWindow& window,
+                                      bool isParallel, radialSweepRays& rays, std::vector<float>& values)
+    {
+        float flag = dem.header->flag;
+        float cellSize = float(dem.header->cellSize);
+
+        typedef std::pair<float, double> slopeReach;
+        typedef std::pair<double, float> reachSlope;
+        typedef std::priority_queue<reachSlope, std::vector<reachSlope>, std::greater<reachSlope> > reachQueue;
+
+        // a step of the ray
+        struct rayCell
+        {
+            float slope;
+            float sideSlope;
+            int minorOffset;        /*!< offset of the cell from the observer, along the minor axis */
+            int side;               /*!< side cell: +1 or -1 along the minor axis, 0 none */
+        };
+
+        // bounds for the targets with the line of sight on each side of the ray (0 lower, 1 upper) or on the ray (2)
+        struct maximumSlope
+        {
+            float raySlope;                                 /*!< highest slope of the ray cells */
+            float lowerSlope[3];                            /*!< lower bound of the maximum slope */
+            float sideSlope[3];                             /*!< highest side cell reachable by any target */
+            std::priority_queue<slopeReach> sideSlopes[2];  /*!< side cells higher than the ray, highest first */
+            reachQueue raySlopes[2];                        /*!< ray cells higher than the side cell, by reach */
+            std::vector<rayCell> cells;
+            maximumSlope() : raySlope(-FLT_MAX)
+            {
+                for (int i = 0; i < 3; i++)
+                    lowerSlope[i] = sideSlope[i] = -FLT_MAX;
+            }
+        };
+
+        // slope of the terrain from the observer, -FLT_MAX on nodata (computed as in isVisibleCell)
+        auto getSlope = [&](int row, int col)
+        {
+            float z = dem.value[row][col];
+            if (z == flag) return -FLT_MAX;
+
+            float dRow = float(row - observerRow);
+            float dCol = float(col - observerCol);
+            return (z - observerZ) / (cellSize * sqrtf(dRow * dRow + dCol * dCol));
+        };
+
+        radialSweep<maximumSlope>(window, observerRow, observerCol,
+                                  [&](maximumSlope& state, int row, int col, double rayRow, double rayCol)
+                                  {
+                                      int step = int(state.cells.size()) + 1;
+
+                                      // offset of the ray from the cell center, along the minor axis
+                                      bool isRowMajor = (fabs(rayRow - observerRow) >= fabs(rayCol - observerCol));
+                                      int minorOffset = isRowMajor ? col - observerCol : row - observerRow;
+                                      double offset = isRowMajor ? rayCol - col : rayRow - row;
+                                      int bound = (offset == 0) ? 2 : (offset < 0 ? 1 : 0);
+
+                                      // bounds for this cell: side cells out of reach are dropped
+                                      float upperSlope = std::max(state.raySlope, state.sideSlope[bound]);
+                                      if (bound < 2)
+                                      {
+                                          reachQueue& raySlopes = state.raySlopes[bound];
+                                          while (! raySlopes.empty() && raySlopes.top().first < step)
+                                          {
+                                              state.lowerSlope[bound] = std::max(state.lowerSlope[bound], raySlopes.top().second);
+                                              raySlopes.pop();
+                                          }
+                                          std::priority_queue<slopeReach>& sideSlopes = state.sideSlopes[bound];
+                                          while (! sideSlopes.empty() && sideSlopes.top().second < step)
+                                              sideSlopes.pop();
+                                          if (! sideSlopes.empty())
+                                              upperSlope = std::max(upperSlope, sideSlopes.top().first);
+                                      }
+
+                                      rayCell cell;
+                                      cell.slope = -FLT_MAX;
+                                      cell.minorOffset = minorOffset;
+                                      cell.side = 0;
+
+                                      float value = 0;
+                                      float z = dem.value[row][col];
+                                      if (z != flag)
+                                      {
+                                          float dRow = float(row - observerRow);
+                                          float dCol = float(col - observerCol);
+                                          float distance = cellSize * sqrtf(dRow * dRow + dCol * dCol);
+                                          cell.slope = (z - observerZ) / distance;
+                                          float targetSlope = (z + targetHeight - observerZ) / distance;
+                                          if (targetSlope >= upperSlope)
+                                              value = 1;
+                                          else if (targetSlope >= state.lowerSlope[bound])
+                                          {
+                                              // between the bounds: line of sight on the stored cells
+                                              value = 1;
+                                              long long j = step;
+                                              for (size_t i = 0; i < state.cells.size(); i++)
+                                              {
+                                                  const rayCell& cell = state.cells[i];
+                                                  long long k = (long long)(i) + 1;
+                                                  bool isSide = (cell.side > 0) ? (2 * k * minorOffset >= (2 * cell.minorOffset + 1) * j)
+                                                                                : (cell.side < 0 && 2 * k * minorOffset < (2 * cell.minorOffset - 1) * j);
+                                                  if (targetSlope < (isSide ? cell.sideSlope : cell.slope))
+                                                  {
+                                                      value = 0;
+                                                      break;
+                                                  }
+                                              }
+                                          }
+                                      }
+
+                                      cell.sideSlope = cell.slope;
+                                      state.raySlope = std::max(state.raySlope, cell.slope);
+
+                                      // side cell towards the ray
+                                      int side = (offset > 0) ? 1 : -1;
+                                      int sideRow = isRowMajor ? row : row + side;
+                                      int sideCol = isRowMajor ? col + side : col;
+                                      double border = 0.5 - fabs(offset) - 1E-6;
+                                      if (offset == 0 || sideRow < window.v[0].row || sideRow > window.v[1].row
+                                          || sideCol < window.v[0].col || sideCol > window.v[1].col)
+                                      {
+                                          for (int i = 0; i < 3; i++)
+                                              state.lowerSlope[i] = std::max(state.lowerSlope[i], cell.slope);
+                                          state.cells.push_back(cell);
+                                          return value;
+                                      }
+
+                                      cell.sideSlope = getSlope(sideRow, sideCol);
+                                      cell.side = side;
+                                      state.cells.push_back(cell);
+
+                                      float lowerSlope = std::min(cell.slope, cell.sideSlope);
+                                      int sideBound = (side > 0) ? 1 : 0;
+                                      if (border <= 0)
+                                      {
+                                          // on the border: any target may walk the side cell
+                                          for (int i = 0; i < 3; i++)
+                                          {
+                                              state.lowerSlope[i] = std::max(state.lowerSlope[i], lowerSlope);
+                                              state.sideSlope[i] = std::max(state.sideSlope[i], cell.sideSlope);
+                                          }
+                                      }
+                                      else if (0.5 * step < border * (step + 1))
+                                      {
+                                          // no target reaches the side cell
+                                          for (int i = 0; i < 3; i++)
+                                              state.lowerSlope[i] = std::max(state.lowerSlope[i], cell.slope);
+                                      }
+                                      else
+                                      {
+                                          // last step that can walk the side cell
+                                          double reach = 0.5 * step / border;
+                                          state.lowerSlope[1 - sideBound] = std::max(state.lowerSlope[1 - sideBound], cell.slope);
+                                          state.lowerSlope[2] = std::max(state.lowerSlope[2], cell.slope);
+                                          state.lowerSlope[sideBound] = std::max(state.lowerSlope[sideBound], lowerSlope);
+                                          if (cell.sideSlope > state.raySlope)
+                                              state.sideSlopes[sideBound].push(slopeReach(cell.sideSlope, reach));
+                                          else if (cell.slope > cell.sideSlope && cell.slope > state.lowerSlope[sideBound])
+                                              state.raySlopes[sideBound].push(reachSlope(reach, cell.slope));
+                                      }
+
+                                      return value;
+                                  },
+                                  isParallel, rays, values);
+
+        // observer cell, nodata cells, cells beyond maxDistance or reached by no ray
+        float maxCellDistance2 = (maxDistance > 0) ? (maxDistance / cellSize) * (maxDistance / cellSize) : FLT_MAX;
+        int nrCols = window.v[1].col - window.v[0].col + 1;
+
+        auto checkRows = [&](int firstRow, int lastRow)
+        {
+            for (int row = firstRow; row < lastRow; row++)
+                for (int col = window.v[0].col; col <= window.v[1].col; col++)
+                {
+                    size_t index = size_t(row - window.v[0].row) * size_t(nrCols) + size_t(col - window.v[0].col);
+                    float dRow = float(row - observerRow);
+                    float dCol = float(col - observerCol);
+
+                    if (row == observerRow && col == observerCol)
+                        values[index] = 1;
+                    else if (dem.value[row][col] == flag || dRow * dRow + dCol * dCol > maxCellDistance2)
+                        values[index] = 0;
+                    else if (rays.deviation[index] == FLT_MAX)
+                        values[index] = isVisibleCell(dem, observerRow, observerCol, observerZ, row, col, targetHeight) ? 1 : 0;
+                }
+        };
+
+        if (isParallel)
+            parallelFor(window.v[0].row, window.v[1].row + 1, 16, checkRows);
+        else
+            checkRows(window.v[0].row, window.v[1].row + 1);
+    }
+
+
+    /*!
+     * \brief viewshed: cells visible from an observer (1) or not (0), nodata on the nodata cells of the DEM.
+     * A cell is visible if the line from the observer (observerHeight above the DEM) to the
+     * target (targetHeight above the cell) passes above the terrain in between, walked one cell
+     * for each row or column. Radial sweep from the observer cell (see computeViewshedWindow):
+     * the same result as casting a ray to each cell, mostly in O(cells) instead of O(cells x distance).
+     * \param maxDistance   [m] the cells farther from the observer are not visible; 0 = no limit
+     * \return false if the observer is outside the DEM or on a nodata cell
+     */
+    bool computeViewshed(const Crit3DRasterGrid& dem, const Crit3DUtmPoint& observer, float observerHeight,
+                         float targetHeight, float maxDistance, Crit3DRasterGrid* viewshedMap)
+    {
+        if (! dem.isLoaded) return false;
+
+        int observerRow, observerCol;
+        float observerZ;
+        if (! getObserverCell(dem, observer, observerHeight, &observerRow, &observerCol, &observerZ))
+            return false;
+
+        if (! viewshedMap->initializeGrid(dem)) return false;
+
+        Crit3DRasterWindow window = getViewshedWindow(*(dem.header), observerRow, observerCol, maxDistance);
+        radialSweepRays rays;
+        std::vector<float> values;
+        computeViewshedWindow(dem, observerRow, observerCol, observerZ, targetHeight, maxDistance, window,
+                              true, rays, values);
+
+        float flag = dem.header->flag;
+        int nrCols = dem.header->nrCols;
+        int nrWindowCols = window.v[1].col - window.v[0].col + 1;
+
+        parallelFor(0, dem.header->nrRows, 16, [&](int firstRow, int lastRow)
+        {
+            for (int row = firstRow; row < lastRow; row++)
+            {
+                bool isWindowRow = (row >= window.v[0].row && row <= window.v[1].row);
+                for (int col = 0; col < nrCols; col++)
+                {
+                    if (dem.value[row][col] == flag) continue;
+
+                    if (isWindowRow && col >= window.v[0].col && col <= window.v[1].col)
+                        viewshedMap->value[row][col] = values[size_t(row - window.v[0].row) * size_t(nrWindowCols)
+                                                              + size_t(col - window.v[0].col)];
+                    else
+                        viewshedMap->value[row][col] = 0;
+                }
+            }
+        });
+
+        gis::updateMinMaxRasterGrid(viewshedMap);
+        return true;
+    }
+
+
+    /*!
+     * \brief batch viewshed: number of observers from which each cell is visible (see computeViewshed),
+     * nodata on the nodata cells of the DEM; observers outside the DEM or on nodata cells are skipped.
+     * The geometry of the sweep (radialSweepRays) depends only on the window of maxDistance around
+     * the observer: it is computed once for the windows not clipped by the grid and shared by
+     * their observers; the other ones reuse it between consecutive observers with the same window.
+     * The rest of the sweep depends on the observer elevation and is done for each observer.
+     * The observers are distributed on the threads, the sweep buffers are reused by each block
+     * of observers and the counts are added by row bands.
+     * \return false if no observer is valid
+     */
+    bool computeViewshedCount(const Crit3DRasterGrid& dem, const std::vector<Crit3DUtmPoint>& observers,
+                              float observerHeight, float targetHeight, float maxDistance, Crit3DRasterGrid* countMap)
+    {
+        if (! dem.isLoaded) return false;
+        if (! countMap->initializeGrid(dem, 0)) return false;
+
+        const int bandRows = 64;
+        int nrRows = dem.header->nrRows;
+        int nrCols = dem.header->nrCols;
+        std::vector<std::mutex> bandMutex(size_t(nrRows / bandRows + 1));
+        std::atomic<int> nrValidObservers(0);
+
+        // sweep geometry of the first window centered on its observer (all the windows inside the grid)
+        radialSweepRays centeredRays;
+        for (size_t i = 0; i < observers.size(); i++)
+        {
+            int observerRow, observerCol;
+            float observerZ;
+            if (! getObserverCell(dem, observers[i], observerHeight, &observerRow, &observerCol, &observerZ))
+                continue;
+
+            Crit3DRasterWindow window = getViewshedWindow(*(dem.header), observerRow, observerCol, maxDistance);
+            if (observerRow - window.v[0].row == window.v[1].row - observerRow
+                && observerCol - window.v[0].col == window.v[1].col - observerCol)
+            {
+                std::vector<float> values;
+                radialSweep<int>(window, observerRow, observerCol, [](int&, int, int, double, double) { return 0.f; },
+                                 true, centeredRays, values);
+                break;
+            }
+        }
+
+        parallelFor(0, int(observers.size()), 1, [&](int firstObserver, int lastObserver)
+        {
+            std::vector<float> values;
+            radialSweepRays blockRays;
+            for (int i = firstObserver; i < lastObserver; i++)
+            {
+                int observerRow, observerCol;
+                float observerZ;
+                if (! getObserverCell(dem, observers[size_t(i)], observerHeight, &observerRow, &observerCol, &observerZ))
+                    continue;
+                nrValidObservers++;
+
+                Crit3DRasterWindow window = getViewshedWindow(*(dem.header), observerRow, observerCol, maxDistance);
+                // centeredRays has the shape of the window: only read by the sweep
+                bool isCentered = centeredRays.isSameShape(window, observerRow, observerCol);
+                computeViewshedWindow(dem, observerRow, observerCol, observerZ, targetHeight, maxDistance, window,
+                                      false, isCentered ? centeredRays : blockRays, values);
+
+                int nrWindowCols = window.v[1].col - window.v[0].col + 1;
+                for (int band = window.v[0].row / bandRows; band <= window.v[1].row / bandRows; band++)
+                {
+                    int firstRow = std::max(band * bandRows, window.v[0].row);
+                    int lastRow = std::min((band + 1) * bandRows - 1, window.v[1].row);
+
+                    std::lock_guard<std::mutex> lock(bandMutex[size_t(band)]);
+                    for (int row = firstRow; row <= lastRow; row++)
+                    {
+                        const float* windowRow = &values[size_t(row - window.v[0].row) * size_t(nrWindowCols)];
+                        float* countRow = &(countMap->value[row][window.v[0].col]);
+                        for (int col = 0; col < nrWindowCols; col++)
+                            countRow[col] += windowRow[col];
+                    }
+                }
+            }
+        });
+
+        float flag = dem.header->flag;
+        parallelFor(0, nrRows, 16, [&](int firstRow, int lastRow)
+        {
+            for (int row = firstRow; row < lastRow; row++)
+                for (int col = 0; col < nrCols; col++)
+                    if (dem.value[row][col] == flag)
+                        countMap->value[row][col] = flag;
+        });
+
+        gis::updateMinMaxRasterGrid(countMap);
+        return (nrValidObservers > 0);
+    }
+
+}
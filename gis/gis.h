@@ -33,12 +33,32 @@
     #ifndef _STRING_
         #include <string>
     #endif
+    #ifndef _FUNCTIONAL_
+        #include <functional>
+    #endif
     #ifndef COLOR_H
         #include "color.h"
     #endif
 
 
+    #ifndef RASTER_ALIGNMENT
+        #define RASTER_ALIGNMENT 64
+    #endif
+
+    #ifndef RASTER_STATISTICS_ROWS
+        #define RASTER_STATISTICS_ROWS 64
+    #endif
+
+    #ifndef RASTER_PYRAMID_BLOCK
+        #define RASTER_PYRAMID_BLOCK 8
+    #endif
+
+    #ifndef RADIAL_SWEEP_SECTORS
+        #define RADIAL_SWEEP_SECTORS 64     /*!< angular sectors of the radial sweep, split among the four borders */
+    #endif
+
     enum operationType {operationMin, operationMax, operationSum, operationSubtract, operationProduct, operationDivide};
+    enum resampleMethod {resampleNearest, resampleBilinear, resampleCubic, resampleMean, resampleMin, resampleMax, resampleMode};
 
     namespace gis
     {
@@ -52,6 +72,7 @@
 
         class Crit3DRasterHeader;
         class Crit3DGridHeader;
+        class Crit3DRasterGrid;
 
         class  Crit3DUtmPoint {
         public:
@@ -132,16 +153,107 @@
         };
 
 
+        /*!
+         * \brief statistics of the valid cells of a raster
+         * standardDeviation is the population one; histogram (if requested) has classes
+         * of equal width from minimum to maximum, the last one includes maximum
+         */
+        class Crit3DRasterStatistics
+        {
+        public:
+            size_t nrValidCells;
+            float minimum, maximum;
+            double mean, standardDeviation;
+            std::vector<size_t> histogram;
+
+            Crit3DRasterStatistics();
+        };
+
+
+        /*!
+         * \brief partial statistics of a band of RASTER_STATISTICS_ROWS rows (statistics cache of a raster)
+         */
+        class Crit3DRasterBandStatistics
+        {
+        public:
+            size_t nrValidCells;
+            float minimum, maximum;
+            double mean;
+            double sumSquaredDeviations;            /*!< sum of the squared deviations from mean */
+            std::vector<size_t> histogram;
+            bool isUpdated, isHistogramUpdated;
+            bool isNormalized;                      /*!< false: rows mapped from a file, not yet checked for NaN and infinite values */
+
+            Crit3DRasterBandStatistics();
+        };
+
+
+        /*!
+         * \brief min/max pyramid of a raster: level 0 holds the minimum and maximum of the valid cells
+         * of blocks of RASTER_PYRAMID_BLOCK x RASTER_PYRAMID_BLOCK cells, each next level of 2 x 2 blocks
+         * of the previous one, up to a single block. Blocks with no valid cells have minimum > maximum.
+         * Window queries visit only the blocks on the window border (and skip the blocks that can't
+         * change the result); the levels can be used directly as bounds, e.g. for LOD or picking.
+         */
+        class Crit3DRasterPyramid
+        {
+        public:
+            Crit3DRasterPyramid();
+
+            bool isLoaded() const { return ! myLevels.empty(); }
+            int nrLevels() const { return int(myLevels.size()); }
+            int blockSize(int level) const { return RASTER_PYRAMID_BLOCK << level; }
+            int nrRows(int level) const { return myLevels[size_t(level)].nrRows; }
+            int nrCols(int level) const { return myLevels[size_t(level)].nrCols; }
+            float minimum(int level, int row, int col) const
+                { return myLevels[size_t(level)].minimum[size_t(row) * size_t(nrCols(level)) + size_t(col)]; }
+            float maximum(int level, int row, int col) const
+                { return myLevels[size_t(level)].maximum[size_t(row) * size_t(nrCols(level)) + size_t(col)]; }
+
+            bool initialize(const Crit3DRasterGrid& myGrid);
+            void update(const Crit3DRasterGrid& myGrid, int row0, int col0, int row1, int col1);
+            bool getMinMax(const Crit3DRasterGrid& myGrid, int row0, int col0, int row1, int col1,
+                           float* myMinimum, float* myMaximum) const;
+            void clear();
+
+        private:
+            struct pyramidLevel
+            {
+                int nrRows, nrCols;
+                std::vector<float> minimum, maximum;
+            };
+
+            std::vector<pyramidLevel> myLevels;
+
+            void updateBlocks(const Crit3DRasterGrid& myGrid, int level, int row0, int col0, int row1, int col1);
+            void addMinMax(const Crit3DRasterGrid& myGrid, int level, int row, int col, int row0, int col0, int row1, int col1,
+                           float* myMinimum, float* myMaximum, std::vector<int>& borderBlocks) const;
+        };
+
+
         class Crit3DRasterGrid
         {
         public:
             Crit3DRasterHeader* header;
             Crit3DColorScale* colorScale;
+            /*! row view: value[row] = data + row * rowStride.
+             * After writing cells through value, call setStatisticsDirty (or its window overload):
+             * otherwise getStatistics, getPyramid and updateColorScale return the cached old values */
             float** value;
+            float* data;                    /*!< single aligned block holding all the cells */
+            int rowStride;                  /*!< floats per row, nrCols padded to the alignment (nrCols if memory-mapped) */
+            void* mappedFile;               /*!< base address of the file mapping, if data is memory-mapped */
+            size_t mappedSize;
             float minimum, maximum;
+            size_t nrValidCells;
             bool isLoaded;
             std::string timeString;
 
+            Crit3DRasterStatistics statistics;                      /*!< cache of getStatistics */
+            std::vector<Crit3DRasterBandStatistics> bandStatistics; /*!< cache by bands of rows */
+            bool isStatisticsUpdated;
+            Crit3DRasterPyramid pyramid;                            /*!< built by getPyramid, kept by setStatisticsDirty */
+
             Crit3DUtmPoint* utmPoint(int myRow, int myCol);
 
             void freeGrid();
@@ -164,10 +276,40 @@
             float getValueFromRowCol(int myRow, int myCol) const;
             float getFastValueXY(double x, double y) const;
 
+            const Crit3DRasterStatistics& getStatistics(int nrHistogramClasses = 0);
+            void updateBandStatistics(int band);
+            void setStatisticsDirty();
+            void setStatisticsDirty(int row0, int col0, int row1, int col1);
+            void setStatisticsDirty(const Crit3DRasterWindow& myWindow);
+            const Crit3DRasterPyramid& getPyramid();
+
             Crit3DPoint mapCenter();
         };
 
 
+        /*!
+         * \brief packed RGBA8 grid with the geometry of a raster: 4 bytes for each cell, by rows
+         * alpha is 0 on the nodata cells
+         */
+        class Crit3DColorGrid
+        {
+        public:
+            int nrRows, nrCols;
+            std::vector<unsigned char> rgba;
+            bool isLoaded;
+
+            Crit3DColorGrid();
+
+            void initialize(int myNrRows, int myNrCols);
+            void clear();
+
+            unsigned char* getRGBA(int myRow, int myCol)
+                { return &rgba[(size_t(myRow) * size_t(nrCols) + size_t(myCol)) * 4]; }
+            const unsigned char* getRGBA(int myRow, int myCol) const
+                { return &rgba[(size_t(myRow) * size_t(nrCols) + size_t(myCol)) * 4]; }
+        };
+
+
         class Crit3DGisSettings
         {
         public:
@@ -188,9 +330,30 @@
             Crit3DEllipsoid();
         };
 
+        /*!
+         * \brief products of computeTerrainDerivatives: nullptr = not requested
+         */
+        class Crit3DTerrainDerivatives
+        {
+        public:
+            Crit3DRasterGrid* slope;                /*!< [degrees] */
+            Crit3DRasterGrid* aspect;               /*!< [degrees] clockwise from north */
+            Crit3DRasterGrid* hillshade;            /*!< [0-255] */
+            Crit3DRasterGrid* profileCurvature;     /*!< [1/m] */
+            Crit3DRasterGrid* planCurvature;        /*!< [1/m] */
+            Crit3DRasterGrid* maximum;              /*!< 1 if isStrictMaximum, 0 otherwise */
+            Crit3DRasterGrid* minimum;              /*!< 1 if isMinimum, 0 otherwise */
+
+            double sunAzimuth;                      /*!< hillshade light [degrees] clockwise from north */
+            double sunElevation;                    /*!< hillshade light [degrees] above the horizon */
+
+            Crit3DTerrainDerivatives();
+        };
+
         float computeDistance(float x1, float y1, float x2, float y2);
         double computeDistancePoint(Crit3DUtmPoint* p0, Crit3DUtmPoint *p1);
         bool updateMinMaxRasterGrid(Crit3DRasterGrid* myGrid);
+        bool setMinMaxFromStatistics(Crit3DRasterGrid* myGrid);
         bool updateColorScale(Crit3DRasterGrid* myGrid, int row0, int col0, int row1, int col1);
         bool updateColorScale(Crit3DRasterGrid* myGrid, const Crit3DRasterWindow& myWindow);
 
@@ -229,10 +392,26 @@
         bool isValidUtmTimeZone(int utmZone, int timeZone);
 
         bool readEsriGrid(std::string myFileName, Crit3DRasterGrid* myGrid, std::string* myError);
+        bool mapEsriGrid(std::string myFileName, Crit3DRasterGrid* myGrid, std::string* myError);
+        void unmapFile(void* address, size_t size);
+        void normalizeRasterRow(float* row, int nrCols, float flag);
+
+        typedef std::function<bool(const Crit3DRasterGrid& inputBand, std::vector<Crit3DRasterGrid*>& outputBands)> rasterBandOperation;
+        bool streamEsriGrid(std::string inputFileName, const std::vector<std::string>& outputFileNames, int bandRows, int haloRows,
+                            const rasterBandOperation& bandOperation, std::string* myError);
         bool writeEsriGrid(std::string myFileName, Crit3DRasterGrid* myGrid, std::string* myError);
 
+        typedef std::function<bool(int firstRow, Crit3DRasterGrid* band)> rasterBandFunction;
+        bool writeEsriGridBands(std::string myFileName, const Crit3DRasterHeader& header, int bandRows,
+                                const rasterBandFunction& fillBand, std::string* myError);
+
         bool mapAlgebra(Crit3DRasterGrid* myMap1, Crit3DRasterGrid* myMap2, Crit3DRasterGrid *myMapOut, operationType myOperation);
+        bool mapAlgebra(Crit3DRasterGrid* myMap1, Crit3DRasterGrid* myMap2, Crit3DRasterGrid *myMapOut, operationType myOperation,
+                        resampleMethod alignMethod);
         bool mapAlgebra(Crit3DRasterGrid* myMap1, float myValue, Crit3DRasterGrid *myMapOut, operationType myOperation);
+        bool mapAlgebra(std::string inputFileName, float myValue, std::string outputFileName, operationType myOperation,
+                        int bandRows, std::string* myError);
+        bool resampleGrid(const Crit3DRasterGrid& inputMap, Crit3DRasterGrid* outputMap, resampleMethod method, int nrSubSamples);
         bool prevailingMap(const Crit3DRasterGrid& inputMap,  Crit3DRasterGrid *outputMap);
         float prevailingValue(const std::vector<float> valueList);
 
@@ -242,6 +421,15 @@
 
         bool computeSlopeAspectMaps(const gis::Crit3DRasterGrid& myDtm,
                                gis::Crit3DRasterGrid* slopeMap, gis::Crit3DRasterGrid* aspectMap);
+        bool computeTerrainDerivatives(const gis::Crit3DRasterGrid& myDtm, Crit3DTerrainDerivatives* products);
+        bool computeSlopeAspectMaps(std::string dtmFileName, std::string slopeFileName, std::string aspectFileName,
+                                    int bandRows, std::string* myError);
+
+        bool computeShadedColorGrid(const Crit3DRasterGrid& myDtm, const Crit3DRasterGrid& slopeMap,
+                                    const Crit3DRasterGrid& aspectMap, float artifactSlope, Crit3DColorGrid* colorGrid);
+
+        bool computeBoundaryMap(const Crit3DRasterGrid& myGrid, Crit3DRasterGrid* boundaryMap);
+        bool computeBoundaryMap(std::string inputFileName, std::string outputFileName, int bandRows, std::string* myError);
 
         bool getGeoExtentsFromUTMHeader(const Crit3DGisSettings& mySettings,
                                         Crit3DRasterHeader *utmHeader, Crit3DGridHeader *latLonHeader);
@@ -252,6 +440,11 @@
         float topographicDistance(float X1, float Y1, float Z1, float X2, float Y2, float Z2, float distance,
                                   const gis::Crit3DRasterGrid& dem_);
         bool topographicDistanceMap(Crit3DPoint point_, const gis::Crit3DRasterGrid& dem_, Crit3DRasterGrid* map_);
+
+        bool computeViewshed(const Crit3DRasterGrid& dem, const Crit3DUtmPoint& observer, float observerHeight,
+                             float targetHeight, float maxDistance, Crit3DRasterGrid* viewshedMap);
+        bool computeViewshedCount(const Crit3DRasterGrid& dem, const std::vector<Crit3DUtmPoint>& observers,
+                                  float observerHeight, float targetHeight, float maxDistance, Crit3DRasterGrid* countMap);
     }
 
 
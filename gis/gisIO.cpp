@@ -24,10 +24,26 @@
 */
 
 
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
 #include <algorithm>
 #include <fstream>
 #include <sstream>
 
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
 #include "commonConstants.h"
 #include "gis.h"
 
@@ -58,17 +74,76 @@ using namespace std;
 namespace gis
     {
 
+    static bool isLittleEndianHost()
+    {
+        const uint32_t one = 1;
+        return *(reinterpret_cast<const unsigned char*>(&one)) == 1;
+    }
+
+
+    /*!
+     * \brief set to flag the NaN and infinite values of a row of cells
+     * the cells are written only if there are such values, so the rows of a mapped file are not copied
+     */
+    void normalizeRasterRow(float* row, int nrCols, float flag)
+    {
+        // branch-free: the compiler can vectorize it
+        size_t nrNotFinite = 0;
+        for (int col = 0; col < nrCols; col++)
+            nrNotFinite += ! (fabsf(row[col]) <= FLT_MAX);
+
+        if (nrNotFinite == 0) return;
+
+        for (int col = 0; col < nrCols; col++)
+            if (! (fabsf(row[col]) <= FLT_MAX))
+                row[col] = flag;
+    }
+
+
+    /*!
+     * \brief ingest a row of cells just read, while it is in cache:
+     * byte swap (if needed) and nodata normalization (NaN and infinite values are set to flag);
+     * when the row completes a band of RASTER_STATISTICS_ROWS rows, the statistics of the band
+     * are computed too, so the statistics cache of the grid is filled without a second pass.
+     * \param myGrid           Crit3DRasterGrid pointer
+     * \param row              row just read
+     * \param isByteSwapped    true if the file byte order differs from the host one
+     */
+    static void ingestRasterRow(gis::Crit3DRasterGrid *myGrid, int row, bool isByteSwapped)
+    {
+        int nrCols = myGrid->header->nrCols;
+        float* rowValue = myGrid->value[row];
+        if (isByteSwapped)
+        {
+            for (int col = 0; col < nrCols; col++)
+            {
+                uint32_t bits;
+                memcpy(&bits, &rowValue[col], sizeof(bits));
+                bits = (bits >> 24) | ((bits >> 8) & 0x0000ff00) | ((bits << 8) & 0x00ff0000) | (bits << 24);
+                memcpy(&rowValue[col], &bits, sizeof(bits));
+            }
+        }
+
+        normalizeRasterRow(rowValue, nrCols, myGrid->header->flag);
+
+        if ((row + 1) % RASTER_STATISTICS_ROWS == 0 || row + 1 == myGrid->header->nrRows)
+            myGrid->updateBandStatistics(row / RASTER_STATISTICS_ROWS);
+    }
+
+
     /*!
      * \brief Read a ESRI grid header file (.hdr)
      * \param myFileName    string
      * \param myHeader      Crit3DRasterHeader pointer
+     * \param isByteSwapped [out] true if the byteorder of the file differs from the host one
      * \param myError       string pointer
      * \return true on success, false otherwise
      */
-    bool readEsriGridHeader(string myFileName, gis::Crit3DRasterHeader *myHeader, string* myError)
+    bool readEsriGridHeader(string myFileName, gis::Crit3DRasterHeader *myHeader, bool* isByteSwapped, string* myError)
     {
         string myLine, myKey, upKey, myValue;
         int nrKeys = 0;
+        bool isLsbFirst = true;
 
         myFileName += ".hdr";
         ifstream  myFile (myFileName.c_str());
@@ -109,10 +184,15 @@ namespace gis
 
                 else if ((upKey == "NODATA_VALUE") || (upKey == "NODATA"))
                     myHeader->flag = float(::atof(myValue.c_str()));
+
+                else if (upKey == "BYTEORDER")
+                    isLsbFirst = (upperCase(myValue) != "MSBFIRST");
             }
         }
         myFile.close();
 
+        *isByteSwapped = (isLsbFirst != isLittleEndianHost());
+
         if (nrKeys < 6)
         {
             *myError = "Key missing in .hdr file.";
@@ -124,12 +204,15 @@ namespace gis
 
     /*!
      * \brief Read a ESRI grid data file (.flt)
+     * Each row is ingested while it is in cache (see ingestRasterRow):
+     * the statistics cache, minimum, maximum and nrValidCells are set without a second pass.
      * \param fileName string name file
      * \param myGrid Crit3DRasterGrid pointer
+     * \param isByteSwapped true if the byteorder of the file differs from the host one
      * \param myError string pointer
      * \return true on success, false otherwise
      */
-    bool readEsriGridFlt(string fileName, gis::Crit3DRasterGrid *myGrid, string *myError)
+    bool readEsriGridFlt(string fileName, gis::Crit3DRasterGrid *myGrid, bool isByteSwapped, string *myError)
     {
         fileName += ".flt";
 
@@ -148,15 +231,144 @@ namespace gis
             return(false);
         }
 
+        int nrCols = myGrid->header->nrCols;
         for (int row = 0; row < myGrid->header->nrRows; row++)
-            fread (myGrid->value[row], sizeof(float), unsigned(myGrid->header->nrCols), filePointer);
+        {
+            if (fread (myGrid->value[row], sizeof(float), unsigned(nrCols), filePointer) != unsigned(nrCols))
+            {
+                fclose (filePointer);
+                *myError = "File .flt error: unexpected end of file.";
+                return(false);
+            }
+            ingestRasterRow(myGrid, row, isByteSwapped);
+        }
 
         fclose (filePointer);
 
+        setMinMaxFromStatistics(myGrid);
+
         return (true);
     }
 
 
+    /*!
+     * \brief map a file in memory, private and copy-on-write:
+     * pages are read from the page cache on first access and copied only
+     * when written, changes are never written back to the file
+     * \param fileName string name file
+     * \param size     size of the mapping [bytes]
+     * \return base address of the mapping, nullptr on error
+     */
+    void* mapFile(string fileName, size_t* size)
+    {
+        void* address = nullptr;
+        *size = 0;
+
+    #ifdef _WIN32
+        HANDLE fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0)
+        {
+            HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            if (mappingHandle != nullptr)
+            {
+                address = MapViewOfFile(mappingHandle, FILE_MAP_COPY, 0, 0, 0);
+                CloseHandle(mappingHandle);
+                if (address != nullptr)
+                    *size = size_t(fileSize.QuadPart);
+            }
+        }
+        CloseHandle(fileHandle);
+    #else
+        int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+        if (fileDescriptor < 0)
+            return nullptr;
+
+        struct stat fileStat;
+        if (fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_size > 0)
+        {
+            address = mmap(nullptr, size_t(fileStat.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fileDescriptor, 0);
+            if (address == MAP_FAILED)
+                address = nullptr;
+            else
+                *size = size_t(fileStat.st_size);
+        }
+        close(fileDescriptor);
+    #endif
+
+        return address;
+    }
+
+
+    void unmapFile(void* address, size_t size)
+    {
+    #ifdef _WIN32
+        (void) size;
+        UnmapViewOfFile(address);
+    #else
+        munmap(address, size);
+    #endif
+    }
+
+
+    /*!
+     * \brief Map a ESRI grid data file (.flt) in memory:
+     * the rows of myGrid point directly into the mapping, no copy is made.
+     * The cells are not read here: the statistics (and the check of NaN and infinite values)
+     * are left to the first getStatistics, band by band.
+     * \param fileName string name file
+     * \param myGrid Crit3DRasterGrid pointer (header already read)
+     * \param myError string pointer
+     * \return true on success, false otherwise
+     */
+    bool mapEsriGridFlt(string fileName, gis::Crit3DRasterGrid *myGrid, string *myError)
+    {
+        fileName += ".flt";
+
+        size_t mappedSize;
+        void* mappedFile = mapFile(fileName, &mappedSize);
+        if (mappedFile == nullptr)
+        {
+            *myError = "File .flt error.";
+            return false;
+        }
+
+        size_t nrValues = size_t(myGrid->header->nrRows) * size_t(myGrid->header->nrCols);
+        if (mappedSize < nrValues * sizeof(float))
+        {
+            unmapFile(mappedFile, mappedSize);
+            *myError = "File .flt error: file is smaller than the header size.";
+            return false;
+        }
+
+        myGrid->value = (float **) calloc(std::max(unsigned(myGrid->header->nrRows), 1u), sizeof(float *));
+        if (myGrid->value == nullptr)
+        {
+            unmapFile(mappedFile, mappedSize);
+            *myError = "Memory error.";
+            return false;
+        }
+
+        myGrid->mappedFile = mappedFile;
+        myGrid->mappedSize = mappedSize;
+        myGrid->data = static_cast<float*>(mappedFile);
+        myGrid->rowStride = myGrid->header->nrCols;
+
+        for (int row = 0; row < myGrid->header->nrRows; row++)
+            myGrid->value[row] = myGrid->data + size_t(row) * size_t(myGrid->rowStride);
+
+        myGrid->setStatisticsDirty();
+        for (size_t i = 0; i < myGrid->bandStatistics.size(); i++)
+            myGrid->bandStatistics[i].isNormalized = false;
+
+        return true;
+    }
+
+
     /*!
      * \brief Write a ESRI grid header file (.hdr)
      * \param myFileName string name file
@@ -193,8 +405,8 @@ namespace gis
         myFile << "NODATA_value  " << myHeader->flag << "\n";
         myFile << "NODATA        " << myHeader->flag << "\n";
 
-        // crucial information
-        myFile << "byteorder     LSBFIRST" << "\n";
+        // crucial information: cells are written in the host byte order
+        myFile << "byteorder     " << (isLittleEndianHost() ? "LSBFIRST" : "MSBFIRST") << "\n";
 
         myFile.close();
 
@@ -229,6 +441,14 @@ namespace gis
         return (true);
     }
 
+    /*!
+     * \brief Read a ESRI grid: the cells are always copied in the aligned block of myGrid
+     * (and checked while read, see readEsriGridFlt); only mapEsriGrid avoids the copy
+     * \param myFileName string name file (without extension)
+     * \param myGrid Crit3DRasterGrid pointer
+     * \param myError string pointer
+     * \return true on success, false otherwise
+     */
     bool readEsriGrid(string myFileName, Crit3DRasterGrid* myGrid, string* myError)
     {
         if (myGrid == nullptr)
@@ -239,16 +459,14 @@ namespace gis
         Crit3DRasterHeader *myHeader;
         myHeader = new Crit3DRasterHeader;
 
-        if(gis::readEsriGridHeader(myFileName, myHeader, myError))
+        bool isByteSwapped;
+        if(gis::readEsriGridHeader(myFileName, myHeader, &isByteSwapped, myError))
         {
             myGrid->freeGrid();
             *(myGrid->header) = *myHeader;
 
-            if (gis::readEsriGridFlt(myFileName, myGrid, myError))
-            {
+            if (gis::readEsriGridFlt(myFileName, myGrid, isByteSwapped, myError))
                 myGrid->isLoaded = true;
-                updateMinMaxRasterGrid(myGrid);
-            }
         }
         else
         {
@@ -259,6 +477,264 @@ namespace gis
     }
 
 
+    /*!
+     * \brief Open a ESRI grid as a read-only memory-mapped raster.
+     * The cells are neither copied nor read: reopening a file already in the page cache
+     * is almost immediate and uses no private memory. minimum, maximum and nrValidCells
+     * are set by the first setMinMaxFromStatistics (or getStatistics), that also sets to flag
+     * the NaN and infinite values: call it before computing on the cells.
+     * Writing in the grid is allowed: the modified pages are privately copied
+     * and the changes are never written back to the file.
+     * Files in the other byte order can't be used in place: they are read as in readEsriGrid.
+     * \param myFileName string name file (without extension)
+     * \param myGrid Crit3DRasterGrid pointer
+     * \param myError string pointer
+     * \return true on success, false otherwise
+     */
+    bool mapEsriGrid(string myFileName, Crit3DRasterGrid* myGrid, string* myError)
+    {
+        if (myGrid == nullptr)
+            return false;
+
+        myGrid->isLoaded = false;
+
+        Crit3DRasterHeader myHeader;
+        bool isByteSwapped;
+        if (! gis::readEsriGridHeader(myFileName, &myHeader, &isByteSwapped, myError))
+            return false;
+
+        myGrid->freeGrid();
+        *(myGrid->header) = myHeader;
+
+        if (isByteSwapped)
+            myGrid->isLoaded = gis::readEsriGridFlt(myFileName, myGrid, isByteSwapped, myError);
+        else
+            myGrid->isLoaded = gis::mapEsriGridFlt(myFileName, myGrid, myError);
+
+        return myGrid->isLoaded;
+    }
+
+
+    /*!
+     * \brief seek a position in a (possibly larger than 2 GB) file
+     */
+    static bool seekFile(FILE* filePointer, long long offset)
+    {
+    #ifdef _WIN32
+        return _fseeki64(filePointer, offset, SEEK_SET) == 0;
+    #else
+        return fseeko(filePointer, off_t(offset), SEEK_SET) == 0;
+    #endif
+    }
+
+
+    /*!
+     * \brief Process a ESRI grid in horizontal bands, without loading it.
+     * Each band holds bandRows rows plus haloRows rows above and below
+     * (clipped at the grid borders), so that stencil operations give the same
+     * results as on the whole grid. bandOperation receives the input band and
+     * must fill the output bands (one for each output file, initialized with
+     * the band header); only the band rows (not the halo) are written.
+     * Peak memory is bounded by (bandRows + 2 * haloRows) * nrCols * (1 + nrOutputs) cells.
+     * \param inputFileName   string name file (without extension)
+     * \param outputFileNames vector of string name files (without extension)
+     * \param bandRows        number of rows computed for each band
+     * \param haloRows        number of rows needed above and below each band
+     * \param bandOperation   function computing the output bands from the input band
+     * \param myError         string pointer
+     * \return true on success, false otherwise
+     */
+    bool streamEsriGrid(string inputFileName, const vector<string>& outputFileNames, int bandRows, int haloRows,
+                        const rasterBandOperation& bandOperation, string* myError)
+    {
+        if (bandRows < 1 || haloRows < 0)
+        {
+            *myError = "Wrong band size.";
+            return false;
+        }
+
+        Crit3DRasterHeader header;
+        bool isByteSwapped;
+        if (! readEsriGridHeader(inputFileName, &header, &isByteSwapped, myError))
+            return false;
+
+        FILE* inputFile = fopen((inputFileName + ".flt").c_str(), "rb");
+        if (inputFile == nullptr)
+        {
+            *myError = "File .flt error.";
+            return false;
+        }
+
+        vector<FILE*> outputFiles;
+        bool isOk = true;
+        for (unsigned int i = 0; i < outputFileNames.size() && isOk; i++)
+        {
+            FILE* outputFile = nullptr;
+            if (writeEsriGridHeader(outputFileNames[i], &header, myError))
+                outputFile = fopen((outputFileNames[i] + ".flt").c_str(), "wb");
+            if (outputFile == nullptr)
+            {
+                *myError = "File .flt error: " + outputFileNames[i];
+                isOk = false;
+            }
+            else
+                outputFiles.push_back(outputFile);
+        }
+
+        Crit3DRasterGrid inputBand;
+        Crit3DUtmPoint* bandCorner = inputBand.header->llCorner;
+        vector<Crit3DRasterGrid> outputGrids(outputFileNames.size());
+        vector<Crit3DRasterGrid*> outputBands;
+        for (unsigned int i = 0; i < outputGrids.size(); i++)
+            outputBands.push_back(&(outputGrids[i]));
+
+        for (int firstRow = 0; firstRow < header.nrRows && isOk; firstRow += bandRows)
+        {
+            int lastRow = std::min(firstRow + bandRows, header.nrRows);
+            int bandFirstRow = std::max(firstRow - haloRows, 0);
+            int bandLastRow = std::min(lastRow + haloRows, header.nrRows);
+
+            // band header: same columns, lower left corner moved to the last band row
+            inputBand.freeGrid();
+            *(inputBand.header) = header;
+            inputBand.header->llCorner = bandCorner;
+            bandCorner->x = header.llCorner->x;
+            bandCorner->y = header.llCorner->y + (header.nrRows - bandLastRow) * header.cellSize;
+            inputBand.header->nrRows = bandLastRow - bandFirstRow;
+
+            if (! inputBand.initializeGrid())
+            {
+                *myError = "Memory error: band too big.";
+                isOk = false;
+                break;
+            }
+
+            if (! seekFile(inputFile, (long long)(bandFirstRow) * header.nrCols * (long long)(sizeof(float))))
+            {
+                *myError = "File .flt error: seek failed.";
+                isOk = false;
+                break;
+            }
+            for (int row = 0; row < inputBand.header->nrRows && isOk; row++)
+            {
+                if (fread(inputBand.value[row], sizeof(float), unsigned(header.nrCols), inputFile) != unsigned(header.nrCols))
+                {
+                    *myError = "File .flt error: unexpected end of file.";
+                    isOk = false;
+                }
+                else
+                    ingestRasterRow(&inputBand, row, isByteSwapped);
+            }
+            if (! isOk) break;
+            setMinMaxFromStatistics(&inputBand);
+            inputBand.isLoaded = true;
+
+            for (unsigned int i = 0; i < outputBands.size() && isOk; i++)
+                if (! outputBands[i]->initializeGrid(inputBand))
+                {
+                    *myError = "Memory error: band too big.";
+                    isOk = false;
+                }
+            if (! isOk) break;
+
+            if (! bandOperation(inputBand, outputBands))
+            {
+                *myError = "Error in band operation.";
+                isOk = false;
+                break;
+            }
+
+            for (unsigned int i = 0; i < outputBands.size() && isOk; i++)
+                for (int row = firstRow - bandFirstRow; row < lastRow - bandFirstRow && isOk; row++)
+                    if (fwrite(outputBands[i]->value[row], sizeof(float), unsigned(header.nrCols), outputFiles[i]) != unsigned(header.nrCols))
+                    {
+                        *myError = "File .flt error: write failed.";
+                        isOk = false;
+                    }
+        }
+
+        fclose(inputFile);
+        for (unsigned int i = 0; i < outputFiles.size(); i++)
+            fclose(outputFiles[i]);
+
+        return isOk;
+    }
+
+
+    /*!
+     * \brief Write a ESRI grid in horizontal bands, without holding it in memory:
+     * fillBand receives the first row of each band and a band initialized
+     * with its header (lower left corner moved to the last band row)
+     * Peak memory is bounded by bandRows * nrCols cells.
+     * \param myFileName      string name file (without extension)
+     * \param header          header of the whole grid
+     * \param bandRows        number of rows of each band
+     * \param fillBand        function computing the band values
+     * \param myError         string pointer
+     * \return true on success, false otherwise
+     */
+    bool writeEsriGridBands(string myFileName, const Crit3DRasterHeader& header, int bandRows,
+                            const rasterBandFunction& fillBand, string* myError)
+    {
+        if (bandRows < 1 || header.nrRows < 1 || header.nrCols < 1)
+        {
+            *myError = "Wrong band size.";
+            return false;
+        }
+
+        Crit3DRasterHeader fileHeader = header;
+        if (! writeEsriGridHeader(myFileName, &fileHeader, myError))
+            return false;
+
+        FILE* outputFile = fopen((myFileName + ".flt").c_str(), "wb");
+        if (outputFile == nullptr)
+        {
+            *myError = "File .flt error.";
+            return false;
+        }
+
+        Crit3DRasterGrid band;
+        Crit3DUtmPoint* bandCorner = band.header->llCorner;
+        bool isOk = true;
+
+        for (int firstRow = 0; firstRow < header.nrRows && isOk; firstRow += bandRows)
+        {
+            int lastRow = std::min(firstRow + bandRows, header.nrRows);
+
+            band.freeGrid();
+            *(band.header) = header;
+            band.header->llCorner = bandCorner;
+            bandCorner->x = header.llCorner->x;
+            bandCorner->y = header.llCorner->y + (header.nrRows - lastRow) * header.cellSize;
+            band.header->nrRows = lastRow - firstRow;
+
+            if (! band.initializeGrid())
+            {
+                *myError = "Memory error: band too big.";
+                isOk = false;
+                break;
+            }
+
+            if (! fillBand(firstRow, &band))
+            {
+                *myError = "Error in band function.";
+                isOk = false;
+                break;
+            }
+
+            for (int row = 0; row < band.header->nrRows && isOk; row++)
+                if (fwrite(band.value[row], sizeof(float), unsigned(header.nrCols), outputFile) != unsigned(header.nrCols))
+                {
+                    *myError = "File .flt error: write failed.";
+                    isOk = false;
+                }
+        }
+
+        fclose(outputFile);
+        return isOk;
+    }
+
+
     bool writeEsriGrid(string myFileName, Crit3DRasterGrid *myGrid, string *myError)
     {
         if (gis::writeEsriGridHeader(myFileName, myGrid->header, myError))
@@ -0,0 +1,196 @@
+/*!
+    \file parallel.cpp
+
+    \abstract Parallel loops on rows (or any index range)
+
+    This file is part of CRITERIA3D.
+
+    CRITERIA3D has been developed by A.R.P.A.E. Emilia-Romagna.
+
+    \copyright
+    CRITERIA3D is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    CRITERIA3D is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License
+    along with CRITERIA3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+
+namespace gis
+{
+    static int nrThreadsSetting = 0;
+
+    /*!
+     * \brief persistent worker threads used by parallelFor
+     * Workers are created on the first call that needs them and then sleep
+     * between jobs, so that a parallelFor costs a wake-up instead of a thread
+     * creation: many callers (one parallelFor for each frame, or for each row
+     * band of a streamed grid) run jobs of a few milliseconds.
+     * One job at a time: a parallelFor called while the pool is busy
+     * (from another thread, or nested in a rangeFunction) runs serially.
+     */
+    class Crit3DThreadPool
+    {
+    public:
+        Crit3DThreadPool()
+            : isBusy(false), isStopping(false), job(nullptr), nrJobWorkers(0), nrPendingWorkers(0), generation(0)
+        { }
+
+        ~Crit3DThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                isStopping = true;
+            }
+            wakeCondition.notify_all();
+            for (unsigned int i = 0; i < workers.size(); i++)
+                workers[i].join();
+        }
+
+        /*!
+         * \brief run work() on the calling thread and on nrWorkers workers
+         * \return false if the pool is busy (nothing is run)
+         */
+        bool run(int nrWorkers, const std::function<void()>& work)
+        {
+            bool wasBusy = false;
+            if (! isBusy.compare_exchange_strong(wasBusy, true))
+                return false;
+
+            std::unique_lock<std::mutex> lock(myMutex);
+            while (int(workers.size()) < nrWorkers)
+                workers.push_back(std::thread(&Crit3DThreadPool::workerLoop, this, int(workers.size())));
+
+            job = &work;
+            nrJobWorkers = nrWorkers;
+            nrPendingWorkers = nrWorkers;
+            generation++;
+            lock.unlock();
+            wakeCondition.notify_all();
+
+            work();
+
+            lock.lock();
+            doneCondition.wait(lock, [this]() { return nrPendingWorkers == 0; });
+            job = nullptr;
+            lock.unlock();
+
+            isBusy = false;
+            return true;
+        }
+
+    private:
+        std::atomic<bool> isBusy;
+        std::mutex myMutex;
+        std::condition_variable wakeCondition;
+        std::condition_variable doneCondition;
+        std::vector<std::thread> workers;
+        bool isStopping;
+        const std::function<void()>* job;
+        int nrJobWorkers;
+        int nrPendingWorkers;
+        unsigned long generation;
+
+        void workerLoop(int workerIndex)
+        {
+            unsigned long lastGeneration = 0;
+            std::unique_lock<std::mutex> lock(myMutex);
+            while (true)
+            {
+                wakeCondition.wait(lock, [&]() { return isStopping || generation != lastGeneration; });
+                if (isStopping) return;
+
+                lastGeneration = generation;
+                // workers beyond the current number of threads sit the job out
+                if (workerIndex >= nrJobWorkers) continue;
+
+                const std::function<void()>* work = job;
+                lock.unlock();
+                (*work)();
+                lock.lock();
+
+                if (--nrPendingWorkers == 0)
+                    doneCondition.notify_one();
+            }
+        }
+    };
+
+    static Crit3DThreadPool& getThreadPool()
+    {
+        static Crit3DThreadPool threadPool;
+        return threadPool;
+    }
+
+
+    /*!
+     * \brief set the number of threads used by parallelFor
+     * \param nrThreads     0 = one thread for each hardware core
+     */
+    void setNrThreads(int nrThreads)
+    {
+        nrThreadsSetting = std::max(nrThreads, 0);
+    }
+
+    int getNrThreads()
+    {
+        if (nrThreadsSetting > 0)
+            return nrThreadsSetting;
+
+        return std::max(int(std::thread::hardware_concurrency()), 1);
+    }
+
+
+    /*!
+     * \brief call rangeFunction(blockFirst, blockLast) on blocks of [first, last)
+     * the blocks are distributed dynamically on getNrThreads() threads
+     * (the calling thread and the persistent workers of the thread pool);
+     * the function returns when all blocks are done.
+     * Small ranges (less than two blocks) and calls made while the pool
+     * is busy (e.g. nested parallelFor) run on the calling thread.
+     * \param first             first index
+     * \param last              last index (excluded)
+     * \param minBlockSize      minimum number of indexes for each block
+     * \param rangeFunction     function(blockFirst, blockLast)
+     */
+    void parallelFor(int first, int last, int minBlockSize, const parallelRangeFunction& rangeFunction)
+    {
+        int nrIndexes = last - first;
+        if (nrIndexes <= 0) return;
+
+        minBlockSize = std::max(minBlockSize, 1);
+        int nrThreads = std::min(getNrThreads(), nrIndexes / minBlockSize);
+        if (nrThreads <= 1)
+        {
+            rangeFunction(first, last);
+            return;
+        }
+
+        // about four blocks for each thread, for load balancing
+        int blockSize = std::max(minBlockSize, nrIndexes / (nrThreads * 4));
+        std::atomic<int> nextIndex(first);
+
+        std::function<void()> worker = [&]()
+        {
+            int blockFirst;
+            while ((blockFirst = nextIndex.fetch_add(blockSize)) < last)
+                rangeFunction(blockFirst, std::min(blockFirst + blockSize, last));
+        };
+
+        if (! getThreadPool().run(nrThreads - 1, worker))
+            rangeFunction(first, last);
+    }
+}
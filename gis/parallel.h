@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+    #ifndef _FUNCTIONAL_
+        #include <functional>
+    #endif
+
+    namespace gis
+    {
+        typedef std::function<void(int first, int last)> parallelRangeFunction;
+
+        void setNrThreads(int nrThreads);
+        int getNrThreads();
+
+        void parallelFor(int first, int last, int minBlockSize, const parallelRangeFunction& rangeFunction);
+    }
+
+#endif // PARALLEL_H
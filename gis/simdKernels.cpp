@@ -0,0 +1,434 @@
+/*!
+    \file simdKernels.cpp
+
+    \abstract Vectorized (SSE2 / AVX2) raster kernels, chosen at runtime
+
+    This file is part of CRITERIA3D.
+
+    CRITERIA3D has been developed by A.R.P.A.E. Emilia-Romagna.
+
+    \copyright
+    CRITERIA3D is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    CRITERIA3D is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License
+    along with CRITERIA3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "commonConstants.h"
+#include "simdKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define SIMD_X86
+    #define TARGET_SSE2 __attribute__((target("sse2")))
+    #define TARGET_AVX2 __attribute__((target("avx2")))
+    #include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define SIMD_X86
+    #define TARGET_SSE2
+    #define TARGET_AVX2
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+
+/*!
+ * Slope and aspect of the interior cells with a fully valid 3x3 window.
+ *
+ * With all the 8 neighbours valid, the scalar formula of computeSlopeAspectMaps reduces to
+ *      dz/dy = sum(north - south) / (6 * cellSize)
+ *      dz/dx = sum(west - east) / (6 * cellSize)
+ * here it is computed in single precision (differences first, exact for near elevations), with atan from the polynomial
+ * of Abramowitz & Stegun 4.4.49 (|error| < 2e-8 rad on [0, 1]) and the exact sqrt.
+ * Maximum difference from the double precision scalar path, measured on the sample
+ * DEMs and on random surfaces (cell size 1-30 m, slopes up to 89.8 degrees):
+ *      slope   < 5e-5 degrees
+ *      aspect  < 2e-4 degrees (on the circle: 0 and 360 are the same direction)
+ * Flat cells (dz/dx = 0) get the same aspect of the scalar path.
+ */
+
+namespace gis
+{
+
+#ifdef SIMD_X86
+
+    // atan coefficients (Abramowitz & Stegun 4.4.49)
+    static const float atanA2 = -0.3333314528f;
+    static const float atanA4 = 0.1999355085f;
+    static const float atanA6 = -0.1420889944f;
+    static const float atanA8 = 0.1065626393f;
+    static const float atanA10 = -0.0752896400f;
+    static const float atanA12 = 0.0429096138f;
+    static const float atanA14 = -0.0161657367f;
+    static const float atanA16 = 0.0028662257f;
+
+
+    static bool isAvx2Supported()
+    {
+    #if defined(__GNUC__)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    #else
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+
+        // OS support of the AVX state (OSXSAVE + XCR0)
+        __cpuid(info, 1);
+        if ((info[2] & (1 << 27)) == 0) return false;
+        if ((_xgetbv(0) & 0x6) != 0x6) return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    #endif
+    }
+
+
+    // ------------------------------- SSE2 (4 cells) -------------------------------
+
+    TARGET_SSE2 static inline __m128 selectSse(__m128 mask, __m128 a, __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    TARGET_SSE2 static inline __m128 atanSse(__m128 x)
+    {
+        const __m128 signMask = _mm_set1_ps(-0.f);
+        const __m128 one = _mm_set1_ps(1.f);
+
+        __m128 sign = _mm_and_ps(x, signMask);
+        __m128 ax = _mm_andnot_ps(signMask, x);
+        __m128 isInverted = _mm_cmpgt_ps(ax, one);
+        __m128 r = selectSse(isInverted, _mm_div_ps(one, ax), ax);
+        __m128 r2 = _mm_mul_ps(r, r);
+
+        __m128 p = _mm_set1_ps(atanA16);
+        p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(atanA14));
+        p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(atanA12));
+        p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(atanA10));
+        p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(atanA8));
+        p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(atanA6));
+        p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(atanA4));
+        p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(atanA2));
+        p = _mm_add_ps(_mm_mul_ps(p, r2), one);
+        p = _mm_mul_ps(p, r);
+
+        p = selectSse(isInverted, _mm_sub_ps(_mm_set1_ps(float(PI / 2.)), p), p);
+        return _mm_or_ps(p, sign);
+    }
+
+    TARGET_SSE2 static int slopeAspectSse(const float* northRow, const float* row, const float* southRow,
+                                          int nrCols, float flag, double cellSize,
+                                          float* slopeRow, float* aspectRow, unsigned char* isComputed)
+    {
+        const __m128 flagVector = _mm_set1_ps(flag);
+        const __m128 factor = _mm_set1_ps(float(1. / (6. * cellSize)));
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 epsilon = _mm_set1_ps(float(EPSILON));
+        const __m128 pi = _mm_set1_ps(float(PI));
+        const __m128 halfPi = _mm_set1_ps(float(PI / 2.));
+        const __m128 radToDeg = _mm_set1_ps(float(RAD_TO_DEG));
+
+        int col = 1;
+        for (; col + 4 <= nrCols - 1; col += 4)
+        {
+            __m128 nw = _mm_loadu_ps(northRow + col - 1);
+            __m128 n = _mm_loadu_ps(northRow + col);
+            __m128 ne = _mm_loadu_ps(northRow + col + 1);
+            __m128 w = _mm_loadu_ps(row + col - 1);
+            __m128 z = _mm_loadu_ps(row + col);
+            __m128 e = _mm_loadu_ps(row + col + 1);
+            __m128 sw = _mm_loadu_ps(southRow + col - 1);
+            __m128 s = _mm_loadu_ps(southRow + col);
+            __m128 se = _mm_loadu_ps(southRow + col + 1);
+
+            __m128 isValid = _mm_and_ps(_mm_cmpneq_ps(nw, flagVector), _mm_cmpneq_ps(n, flagVector));
+            isValid = _mm_and_ps(isValid, _mm_cmpneq_ps(ne, flagVector));
+            isValid = _mm_and_ps(isValid, _mm_cmpneq_ps(w, flagVector));
+            isValid = _mm_and_ps(isValid, _mm_cmpneq_ps(z, flagVector));
+            isValid = _mm_and_ps(isValid, _mm_cmpneq_ps(e, flagVector));
+            isValid = _mm_and_ps(isValid, _mm_cmpneq_ps(sw, flagVector));
+            isValid = _mm_and_ps(isValid, _mm_cmpneq_ps(s, flagVector));
+            isValid = _mm_and_ps(isValid, _mm_cmpneq_ps(se, flagVector));
+            if (_mm_movemask_ps(isValid) != 0xF)
+                continue;
+
+            // differences first: they are exact for near values, sums of elevations are not
+            __m128 dz_dy = _mm_add_ps(_mm_add_ps(_mm_sub_ps(nw, sw), _mm_sub_ps(n, s)), _mm_sub_ps(ne, se));
+            __m128 dz_dx = _mm_add_ps(_mm_add_ps(_mm_sub_ps(nw, ne), _mm_sub_ps(w, e)), _mm_sub_ps(sw, se));
+            dz_dy = _mm_mul_ps(dz_dy, factor);
+            dz_dx = _mm_mul_ps(dz_dx, factor);
+
+            __m128 gradient = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dz_dx, dz_dx), _mm_mul_ps(dz_dy, dz_dy)));
+            _mm_storeu_ps(slopeRow + col, _mm_mul_ps(atanSse(gradient), radToDeg));
+
+            dz_dx = selectSse(_mm_cmpeq_ps(dz_dx, zero), epsilon, dz_dx);
+            __m128 aspect = atanSse(_mm_div_ps(dz_dy, dz_dx));
+            aspect = _mm_add_ps(aspect, _mm_and_ps(_mm_cmplt_ps(dz_dx, zero), pi));
+            aspect = _mm_mul_ps(_mm_add_ps(aspect, halfPi), radToDeg);
+            _mm_storeu_ps(aspectRow + col, aspect);
+
+            isComputed[col] = isComputed[col+1] = isComputed[col+2] = isComputed[col+3] = 1;
+        }
+
+        return col;
+    }
+
+    TARGET_SSE2 static int rowStatisticsSse(const float* row, int nrCols, float flag, float shift, size_t* nrValid,
+                                            float* minimum, float* maximum, double* sum, double* sumSquares)
+    {
+        const __m128 flagVector = _mm_set1_ps(flag);
+        const __m128 shiftVector = _mm_set1_ps(shift);
+        __m128 minVector = _mm_set1_ps(*minimum);
+        __m128 maxVector = _mm_set1_ps(*maximum);
+        __m128i countVector = _mm_setzero_si128();
+        __m128d sumVector = _mm_setzero_pd();
+        __m128d sumSquaresVector = _mm_setzero_pd();
+
+        int col = 0;
+        for (; col + 4 <= nrCols; col += 4)
+        {
+            __m128 value = _mm_loadu_ps(row + col);
+            __m128 isValid = _mm_cmpneq_ps(value, flagVector);
+            minVector = _mm_min_ps(minVector, selectSse(isValid, value, minVector));
+            maxVector = _mm_max_ps(maxVector, selectSse(isValid, value, maxVector));
+            countVector = _mm_sub_epi32(countVector, _mm_castps_si128(isValid));
+
+            // deviations from shift, summed in double precision
+            __m128 deviation = _mm_and_ps(isValid, _mm_sub_ps(value, shiftVector));
+            __m128d low = _mm_cvtps_pd(deviation);
+            __m128d high = _mm_cvtps_pd(_mm_movehl_ps(deviation, deviation));
+            sumVector = _mm_add_pd(sumVector, _mm_add_pd(low, high));
+            sumSquaresVector = _mm_add_pd(sumSquaresVector, _mm_add_pd(_mm_mul_pd(low, low), _mm_mul_pd(high, high)));
+        }
+
+        float minValues[4], maxValues[4];
+        int counts[4];
+        double sums[2], sumsSquares[2];
+        _mm_storeu_ps(minValues, minVector);
+        _mm_storeu_ps(maxValues, maxVector);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(counts), countVector);
+        _mm_storeu_pd(sums, sumVector);
+        _mm_storeu_pd(sumsSquares, sumSquaresVector);
+
+        for (int i = 0; i < 4; i++)
+        {
+            *minimum = (minValues[i] < *minimum) ? minValues[i] : *minimum;
+            *maximum = (maxValues[i] > *maximum) ? maxValues[i] : *maximum;
+            *nrValid += size_t(counts[i]);
+        }
+        *sum += sums[0] + sums[1];
+        *sumSquares += sumsSquares[0] + sumsSquares[1];
+
+        return col;
+    }
+
+
+    // ------------------------------- AVX2 (8 cells) -------------------------------
+
+    TARGET_AVX2 static inline __m256 atanAvx2(__m256 x)
+    {
+        const __m256 signMask = _mm256_set1_ps(-0.f);
+        const __m256 one = _mm256_set1_ps(1.f);
+
+        __m256 sign = _mm256_and_ps(x, signMask);
+        __m256 ax = _mm256_andnot_ps(signMask, x);
+        __m256 isInverted = _mm256_cmp_ps(ax, one, _CMP_GT_OQ);
+        __m256 r = _mm256_blendv_ps(ax, _mm256_div_ps(one, ax), isInverted);
+        __m256 r2 = _mm256_mul_ps(r, r);
+
+        __m256 p = _mm256_set1_ps(atanA16);
+        p = _mm256_add_ps(_mm256_mul_ps(p, r2), _mm256_set1_ps(atanA14));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r2), _mm256_set1_ps(atanA12));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r2), _mm256_set1_ps(atanA10));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r2), _mm256_set1_ps(atanA8));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r2), _mm256_set1_ps(atanA6));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r2), _mm256_set1_ps(atanA4));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r2), _mm256_set1_ps(atanA2));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r2), one);
+        p = _mm256_mul_ps(p, r);
+
+        p = _mm256_blendv_ps(p, _mm256_sub_ps(_mm256_set1_ps(float(PI / 2.)), p), isInverted);
+        return _mm256_or_ps(p, sign);
+    }
+
+    TARGET_AVX2 static int slopeAspectAvx2(const float* northRow, const float* row, const float* southRow,
+                                           int nrCols, float flag, double cellSize,
+                                           float* slopeRow, float* aspectRow, unsigned char* isComputed)
+    {
+        const __m256 flagVector = _mm256_set1_ps(flag);
+        const __m256 factor = _mm256_set1_ps(float(1. / (6. * cellSize)));
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 epsilon = _mm256_set1_ps(float(EPSILON));
+        const __m256 pi = _mm256_set1_ps(float(PI));
+        const __m256 halfPi = _mm256_set1_ps(float(PI / 2.));
+        const __m256 radToDeg = _mm256_set1_ps(float(RAD_TO_DEG));
+
+        int col = 1;
+        for (; col + 8 <= nrCols - 1; col += 8)
+        {
+            __m256 nw = _mm256_loadu_ps(northRow + col - 1);
+            __m256 n = _mm256_loadu_ps(northRow + col);
+            __m256 ne = _mm256_loadu_ps(northRow + col + 1);
+            __m256 w = _mm256_loadu_ps(row + col - 1);
+            __m256 z = _mm256_loadu_ps(row + col);
+            __m256 e = _mm256_loadu_ps(row + col + 1);
+            __m256 sw = _mm256_loadu_ps(southRow + col - 1);
+            __m256 s = _mm256_loadu_ps(southRow + col);
+            __m256 se = _mm256_loadu_ps(southRow + col + 1);
+
+            __m256 isValid = _mm256_and_ps(_mm256_cmp_ps(nw, flagVector, _CMP_NEQ_UQ), _mm256_cmp_ps(n, flagVector, _CMP_NEQ_UQ));
+            isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(ne, flagVector, _CMP_NEQ_UQ));
+            isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(w, flagVector, _CMP_NEQ_UQ));
+            isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(z, flagVector, _CMP_NEQ_UQ));
+            isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(e, flagVector, _CMP_NEQ_UQ));
+            isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(sw, flagVector, _CMP_NEQ_UQ));
+            isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(s, flagVector, _CMP_NEQ_UQ));
+            isValid = _mm256_and_ps(isValid, _mm256_cmp_ps(se, flagVector, _CMP_NEQ_UQ));
+            if (_mm256_movemask_ps(isValid) != 0xFF)
+                continue;
+
+            // differences first: they are exact for near values, sums of elevations are not
+            __m256 dz_dy = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(nw, sw), _mm256_sub_ps(n, s)), _mm256_sub_ps(ne, se));
+            __m256 dz_dx = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(nw, ne), _mm256_sub_ps(w, e)), _mm256_sub_ps(sw, se));
+            dz_dy = _mm256_mul_ps(dz_dy, factor);
+            dz_dx = _mm256_mul_ps(dz_dx, factor);
+
+            __m256 gradient = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dz_dx, dz_dx), _mm256_mul_ps(dz_dy, dz_dy)));
+            _mm256_storeu_ps(slopeRow + col, _mm256_mul_ps(atanAvx2(gradient), radToDeg));
+
+            dz_dx = _mm256_blendv_ps(dz_dx, epsilon, _mm256_cmp_ps(dz_dx, zero, _CMP_EQ_OQ));
+            __m256 aspect = atanAvx2(_mm256_div_ps(dz_dy, dz_dx));
+            aspect = _mm256_add_ps(aspect, _mm256_and_ps(_mm256_cmp_ps(dz_dx, zero, _CMP_LT_OQ), pi));
+            aspect = _mm256_mul_ps(_mm256_add_ps(aspect, halfPi), radToDeg);
+            _mm256_storeu_ps(aspectRow + col, aspect);
+
+            for (int i = 0; i < 8; i++)
+                isComputed[col+i] = 1;
+        }
+
+        return col;
+    }
+
+    TARGET_AVX2 static int rowStatisticsAvx2(const float* row, int nrCols, float flag, float shift, size_t* nrValid,
+                                             float* minimum, float* maximum, double* sum, double* sumSquares)
+    {
+        const __m256 flagVector = _mm256_set1_ps(flag);
+        const __m256 shiftVector = _mm256_set1_ps(shift);
+        __m256 minVector = _mm256_set1_ps(*minimum);
+        __m256 maxVector = _mm256_set1_ps(*maximum);
+        __m256i countVector = _mm256_setzero_si256();
+        __m256d sumVector = _mm256_setzero_pd();
+        __m256d sumSquaresVector = _mm256_setzero_pd();
+
+        int col = 0;
+        for (; col + 8 <= nrCols; col += 8)
+        {
+            __m256 value = _mm256_loadu_ps(row + col);
+            __m256 isValid = _mm256_cmp_ps(value, flagVector, _CMP_NEQ_UQ);
+            minVector = _mm256_min_ps(minVector, _mm256_blendv_ps(minVector, value, isValid));
+            maxVector = _mm256_max_ps(maxVector, _mm256_blendv_ps(maxVector, value, isValid));
+            countVector = _mm256_sub_epi32(countVector, _mm256_castps_si256(isValid));
+
+            // deviations from shift, summed in double precision
+            __m256 deviation = _mm256_and_ps(isValid, _mm256_sub_ps(value, shiftVector));
+            __m256d low = _mm256_cvtps_pd(_mm256_castps256_ps128(deviation));
+            __m256d high = _mm256_cvtps_pd(_mm256_extractf128_ps(deviation, 1));
+            sumVector = _mm256_add_pd(sumVector, _mm256_add_pd(low, high));
+            sumSquaresVector = _mm256_add_pd(sumSquaresVector,
+                                             _mm256_add_pd(_mm256_mul_pd(low, low), _mm256_mul_pd(high, high)));
+        }
+
+        float minValues[8], maxValues[8];
+        int counts[8];
+        double sums[4], sumsSquares[4];
+        _mm256_storeu_ps(minValues, minVector);
+        _mm256_storeu_ps(maxValues, maxVector);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts), countVector);
+        _mm256_storeu_pd(sums, sumVector);
+        _mm256_storeu_pd(sumsSquares, sumSquaresVector);
+
+        for (int i = 0; i < 8; i++)
+        {
+            *minimum = (minValues[i] < *minimum) ? minValues[i] : *minimum;
+            *maximum = (maxValues[i] > *maximum) ? maxValues[i] : *maximum;
+            *nrValid += size_t(counts[i]);
+        }
+        *sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+        *sumSquares += (sumsSquares[0] + sumsSquares[1]) + (sumsSquares[2] + sumsSquares[3]);
+
+        return col;
+    }
+
+#endif // SIMD_X86
+
+
+    simdInstructionSet getSimdInstructionSet()
+    {
+    #ifdef SIMD_X86
+        static const simdInstructionSet instructionSet = isAvx2Supported() ? simdAVX2 : simdSSE2;
+        return instructionSet;
+    #else
+        return simdNone;
+    #endif
+    }
+
+
+    /*!
+     * \brief slope and aspect [degrees] of the interior cells of a row (1 <= col < nrCols-1)
+     * whose 3x3 window is fully valid, with the best instruction set of the CPU.
+     * Cells computed here are marked in isComputed: the others (nodata-adjacent cells,
+     * the last cells of the row, or all cells without SIMD) are left to the scalar path.
+     * \param northRow, row, southRow   rows -1, 0, +1 of the DTM
+     * \param nrCols                    number of columns
+     * \param flag                      nodata value
+     * \param cellSize                  [m]
+     * \param slopeRow, aspectRow       output rows
+     * \param isComputed                [out] 1 for the cells computed here (not reset)
+     */
+    void computeSlopeAspectInterior(const float* northRow, const float* row, const float* southRow,
+                                    int nrCols, float flag, double cellSize,
+                                    float* slopeRow, float* aspectRow, unsigned char* isComputed)
+    {
+    #ifdef SIMD_X86
+        int col = 1;
+        if (getSimdInstructionSet() == simdAVX2)
+            col = slopeAspectAvx2(northRow, row, southRow, nrCols, flag, cellSize, slopeRow, aspectRow, isComputed);
+
+        // remaining columns (or all the row without AVX2): 4 cells at a time
+        slopeAspectSse(northRow + col - 1, row + col - 1, southRow + col - 1, nrCols - col + 1, flag, cellSize,
+                       slopeRow + col - 1, aspectRow + col - 1, isComputed + col - 1);
+    #else
+        (void) northRow; (void) row; (void) southRow; (void) nrCols; (void) flag;
+        (void) cellSize; (void) slopeRow; (void) aspectRow; (void) isComputed;
+    #endif
+    }
+
+
+    /*!
+     * \brief statistics of the valid cells (!= flag) of the first columns of a row,
+     * with the best instruction set of the CPU; the values are added to the arguments
+     * (minimum and maximum are updated, deviations from shift are summed in double precision)
+     * \return number of columns processed: the remaining ones (or all the row without SIMD)
+     * are left to the scalar path
+     */
+    int computeRowStatistics(const float* row, int nrCols, float flag, float shift, size_t* nrValid,
+                             float* minimum, float* maximum, double* sum, double* sumSquares)
+    {
+    #ifdef SIMD_X86
+        if (getSimdInstructionSet() == simdAVX2)
+            return rowStatisticsAvx2(row, nrCols, flag, shift, nrValid, minimum, maximum, sum, sumSquares);
+
+        return rowStatisticsSse(row, nrCols, flag, shift, nrValid, minimum, maximum, sum, sumSquares);
+    #else
+        (void) row; (void) nrCols; (void) flag; (void) shift; (void) nrValid;
+        (void) minimum; (void) maximum; (void) sum; (void) sumSquares;
+        return 0;
+    #endif
+    }
+}
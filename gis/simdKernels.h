@@ -0,0 +1,20 @@
+#ifndef SIMDKERNELS_H
+#define SIMDKERNELS_H
+
+    #include <stddef.h>
+
+    namespace gis
+    {
+        enum simdInstructionSet {simdNone, simdSSE2, simdAVX2};
+
+        simdInstructionSet getSimdInstructionSet();
+
+        void computeSlopeAspectInterior(const float* northRow, const float* row, const float* southRow,
+                                        int nrCols, float flag, double cellSize,
+                                        float* slopeRow, float* aspectRow, unsigned char* isComputed);
+
+        int computeRowStatistics(const float* row, int nrCols, float flag, float shift, size_t* nrValid,
+                                 float* minimum, float* maximum, double* sum, double* sumSquares);
+    }
+
+#endif // SIMDKERNELS_H
@@ -0,0 +1,379 @@
+/*!
+    \file syntheticDtm.cpp
+
+    \abstract Synthetic fractal DTM for scaling tests
+
+    Fractional Brownian motion: a sum of octaves of gradient noise, each with
+    half the wavelength of the previous one and amplitude scaled by roughness.
+    The noise lattice is hashed from (seed, octave, position), so the value of
+    a cell is a pure function of its row and column: no grid is held in memory,
+    the result does not depend on the number of threads or on the band size,
+    and the same seed always gives the same terrain.
+    Nodata holes are the highest areas of a second, low frequency noise.
+
+    This file is part of CRITERIA3D.
+
+    CRITERIA3D has been developed by A.R.P.A.E. Emilia-Romagna.
+
+    \copyright
+    CRITERIA3D is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    CRITERIA3D is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License
+    along with CRITERIA3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+#include "commonConstants.h"
+#include "parallel.h"
+#include "syntheticDtm.h"
+
+#define SYNTHETIC_MAX_OCTAVES 24
+#define SYNTHETIC_NR_SAMPLES 4096
+#define SYNTHETIC_HOLE_SEED 0x5BD1E995u
+
+
+namespace gis
+{
+    Crit3DSyntheticDtmSettings::Crit3DSyntheticDtmSettings()
+    {
+        nrRows = 1000;
+        nrCols = 1000;
+        cellSize = 10;
+        xllCorner = 600000;
+        yllCorner = 4900000;
+        seed = 1;
+
+        minimumElevation = 0;
+        relief = 1500;
+        featureSize = 10000;
+        roughness = 0.5f;
+        nodataFraction = 0;
+    }
+
+
+    static inline uint32_t hashLattice(int32_t ix, int32_t iy, uint32_t seed)
+    {
+        uint32_t h = seed * 0x9E3779B1u;
+        h ^= uint32_t(ix) * 0x85EBCA77u;
+        h = (h << 13) | (h >> 19);
+        h ^= uint32_t(iy) * 0xC2B2AE3Du;
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 12;
+        h *= 0x297A2D39u;
+        h ^= h >> 15;
+        return h;
+    }
+
+
+    static const float gradientX[8] = {1.f, -1.f, 0.f, 0.f, 0.70710678f, 0.70710678f, -0.70710678f, -0.70710678f};
+    static const float gradientY[8] = {0.f, 0.f, 1.f, -1.f, 0.70710678f, -0.70710678f, 0.70710678f, -0.70710678f};
+
+    /*!
+     * \brief dot product of the hashed gradient (8 directions) and the offset
+     */
+    static inline float gradientDot(uint32_t hash, float dx, float dy)
+    {
+        return gradientX[hash & 7] * dx + gradientY[hash & 7] * dy;
+    }
+
+
+    static inline float fade(float t)
+    {
+        return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+    }
+
+
+    /*!
+     * \brief gradient noise, about [-1, 1]: lattice spacing = 1
+     */
+    static float gradientNoise(double x, double y, uint32_t seed)
+    {
+        double xFloor = floor(x);
+        double yFloor = floor(y);
+        int32_t ix = int32_t(int64_t(xFloor));
+        int32_t iy = int32_t(int64_t(yFloor));
+        float dx = float(x - xFloor);
+        float dy = float(y - yFloor);
+
+        float n00 = gradientDot(hashLattice(ix, iy, seed), dx, dy);
+        float n10 = gradientDot(hashLattice(ix + 1, iy, seed), dx - 1.f, dy);
+        float n01 = gradientDot(hashLattice(ix, iy + 1, seed), dx, dy - 1.f);
+        float n11 = gradientDot(hashLattice(ix + 1, iy + 1, seed), dx - 1.f, dy - 1.f);
+
+        float u = fade(dx);
+        float v = fade(dy);
+        float n0 = n00 + u * (n10 - n00);
+        float n1 = n01 + u * (n11 - n01);
+        return 1.41421356f * (n0 + v * (n1 - n0));
+    }
+
+
+    /*!
+     * \brief parameters derived from the settings, shared by all rows
+     */
+    struct syntheticDtmModel
+    {
+        int nrOctaves;
+        double cellStep;                /*!< cell size in lattice units of the first octave */
+        float amplitude[SYNTHETIC_MAX_OCTAVES];
+        float fbmMinimum, fbmRange;
+        double holeScale;
+        float holeThreshold;
+    };
+
+
+    static float fractalNoise(const Crit3DSyntheticDtmSettings& settings, const syntheticDtmModel& model,
+                              double x, double y)
+    {
+        float value = 0;
+        double frequency = 1;
+        for (int octave = 0; octave < model.nrOctaves; octave++)
+        {
+            value += model.amplitude[octave] * gradientNoise(x * frequency, y * frequency, settings.seed + uint32_t(octave) * 1013u);
+            frequency *= 2;
+        }
+        return value;
+    }
+
+
+    static float holeNoise(const Crit3DSyntheticDtmSettings& settings, const syntheticDtmModel& model,
+                           double x, double y)
+    {
+        double xHole = x * model.holeScale;
+        double yHole = y * model.holeScale;
+        return gradientNoise(xHole, yHole, settings.seed ^ SYNTHETIC_HOLE_SEED)
+               + 0.5f * gradientNoise(xHole * 2, yHole * 2, (settings.seed ^ SYNTHETIC_HOLE_SEED) + 1u);
+    }
+
+
+    /*!
+     * \brief octave amplitudes, and elevation range and hole threshold estimated
+     * on a fixed set of hashed sample points: deterministic for each seed
+     */
+    static bool initializeModel(const Crit3DSyntheticDtmSettings& settings, syntheticDtmModel* model)
+    {
+        if (settings.nrRows < 1 || settings.nrCols < 1 || settings.cellSize <= 0
+            || settings.featureSize < settings.cellSize || settings.relief < 0
+            || settings.roughness < 0 || settings.roughness > 1)
+            return false;
+
+        // smallest wavelength: two cells
+        model->nrOctaves = int(floor(log2(settings.featureSize / (2 * settings.cellSize)))) + 1;
+        model->nrOctaves = std::min(std::max(model->nrOctaves, 1), SYNTHETIC_MAX_OCTAVES);
+        model->cellStep = settings.cellSize / settings.featureSize;
+
+        float amplitude = 1;
+        for (int octave = 0; octave < model->nrOctaves; octave++)
+        {
+            model->amplitude[octave] = amplitude;
+            amplitude *= settings.roughness;
+        }
+
+        // holes: about 4 for each landform
+        model->holeScale = 2;
+
+        double xExtent = settings.nrCols * model->cellStep;
+        double yExtent = settings.nrRows * model->cellStep;
+        std::vector<float> elevations(SYNTHETIC_NR_SAMPLES), holes(SYNTHETIC_NR_SAMPLES);
+        for (int i = 0; i < SYNTHETIC_NR_SAMPLES; i++)
+        {
+            double x = xExtent * (hashLattice(i, 0, settings.seed) & 0xFFFFFF) / 16777216.;
+            double y = yExtent * (hashLattice(i, 1, settings.seed) & 0xFFFFFF) / 16777216.;
+            elevations[size_t(i)] = fractalNoise(settings, *model, x, y);
+            holes[size_t(i)] = holeNoise(settings, *model, x, y);
+        }
+
+        // sampled range widened by 5% on each side: few cells are clipped
+        std::sort(elevations.begin(), elevations.end());
+        float margin = 0.05f * (elevations.back() - elevations.front());
+        model->fbmMinimum = elevations.front() - margin;
+        model->fbmRange = std::max(elevations.back() - elevations.front() + 2 * margin, float(EPSILON));
+
+        if (settings.nodataFraction <= 0)
+            model->holeThreshold = FLT_MAX;
+        else
+        {
+            std::sort(holes.begin(), holes.end());
+            float fraction = std::min(settings.nodataFraction, 1.f);
+            int index = int((1.f - fraction) * (SYNTHETIC_NR_SAMPLES - 1));
+            model->holeThreshold = (fraction >= 1) ? -FLT_MAX : holes[size_t(index)];
+        }
+
+        return true;
+    }
+
+
+    /*!
+     * \brief values[col] += amplitude * gradientNoise(x, y, seed) on a row, with x = col * cellStep * scale1 * scale2:
+     * same values as gradientNoise, but the corner hashes are computed once for each lattice cell
+     */
+    static void addGradientNoiseRow(double cellStep, double scale1, double scale2, double y, uint32_t seed,
+                                    float amplitude, int nrCols, float* values)
+    {
+        double yFloor = floor(y);
+        int32_t iy = int32_t(int64_t(yFloor));
+        float dy = float(y - yFloor);
+        float v = fade(dy);
+
+        bool isCached = false;
+        int32_t ixCached = 0;
+        uint32_t h00 = 0, h10 = 0, h01 = 0, h11 = 0;
+
+        for (int col = 0; col < nrCols; col++)
+        {
+            double x = col * cellStep * scale1 * scale2;
+            double xFloor = floor(x);
+            int32_t ix = int32_t(int64_t(xFloor));
+            if (! isCached || ix != ixCached)
+            {
+                h00 = hashLattice(ix, iy, seed);
+                h10 = hashLattice(ix + 1, iy, seed);
+                h01 = hashLattice(ix, iy + 1, seed);
+                h11 = hashLattice(ix + 1, iy + 1, seed);
+                ixCached = ix;
+                isCached = true;
+            }
+            float dx = float(x - xFloor);
+
+            float n00 = gradientDot(h00, dx, dy);
+            float n10 = gradientDot(h10, dx - 1.f, dy);
+            float n01 = gradientDot(h01, dx, dy - 1.f);
+            float n11 = gradientDot(h11, dx - 1.f, dy - 1.f);
+
+            float u = fade(dx);
+            float n0 = n00 + u * (n10 - n00);
+            float n1 = n01 + u * (n11 - n01);
+            values[col] += amplitude * (1.41421356f * (n0 + v * (n1 - n0)));
+        }
+    }
+
+
+    /*!
+     * \brief rows [firstRow, lastRow) of band, i.e. rows from gridFirstRow + firstRow of the grid
+     * computed octave by octave on the whole row (same values as fractalNoise and holeNoise)
+     */
+    static void computeSyntheticRows(const Crit3DSyntheticDtmSettings& settings, const syntheticDtmModel& model,
+                                     int gridFirstRow, Crit3DRasterGrid* band, int firstRow, int lastRow)
+    {
+        float flag = band->header->flag;
+        bool hasHoles = (settings.nodataFraction > 0);
+        int nrCols = settings.nrCols;
+        uint32_t holeSeed = settings.seed ^ SYNTHETIC_HOLE_SEED;
+        std::vector<float> holes(static_cast<size_t>(nrCols));
+
+        for (int row = firstRow; row < lastRow; row++)
+        {
+            float* value = band->value[row];
+            double y = (gridFirstRow + row) * model.cellStep;
+
+            if (hasHoles)
+            {
+                std::fill(holes.begin(), holes.end(), 0.f);
+                double yHole = y * model.holeScale;
+                addGradientNoiseRow(model.cellStep, model.holeScale, 1, yHole, holeSeed, 1.f, nrCols, holes.data());
+                addGradientNoiseRow(model.cellStep, model.holeScale, 2, yHole * 2, holeSeed + 1u, 0.5f, nrCols, holes.data());
+            }
+
+            std::fill(value, value + nrCols, 0.f);
+            double frequency = 1;
+            for (int octave = 0; octave < model.nrOctaves; octave++)
+            {
+                addGradientNoiseRow(model.cellStep, frequency, 1, y * frequency, settings.seed + uint32_t(octave) * 1013u,
+                                    model.amplitude[octave], nrCols, value);
+                frequency *= 2;
+            }
+
+            for (int col = 0; col < nrCols; col++)
+            {
+                if (hasHoles && holes[size_t(col)] >= model.holeThreshold)
+                {
+                    value[col] = flag;
+                    continue;
+                }
+
+                // normalized [0-1], then flatter valleys and steeper peaks
+                float z = (value[col] - model.fbmMinimum) / model.fbmRange;
+                z = std::min(std::max(z, 0.f), 1.f);
+                value[col] = settings.minimumElevation + settings.relief * z * sqrtf(z);
+            }
+        }
+    }
+
+
+    static void initializeSyntheticHeader(const Crit3DSyntheticDtmSettings& settings, Crit3DRasterHeader* header)
+    {
+        header->nrRows = settings.nrRows;
+        header->nrCols = settings.nrCols;
+        header->cellSize = settings.cellSize;
+        header->flag = NODATA;
+        header->llCorner->x = settings.xllCorner;
+        header->llCorner->y = settings.yllCorner;
+    }
+
+
+    /*!
+     * \brief fill dtm with the synthetic terrain (rows computed in parallel)
+     */
+    bool computeSyntheticDtm(const Crit3DSyntheticDtmSettings& settings, Crit3DRasterGrid* dtm)
+    {
+        syntheticDtmModel model;
+        if (! initializeModel(settings, &model)) return false;
+
+        Crit3DRasterHeader header;
+        initializeSyntheticHeader(settings, &header);
+        if (! dtm->initializeGrid(header)) return false;
+
+        parallelFor(0, settings.nrRows, 16, [&](int firstRow, int lastRow)
+        {
+            computeSyntheticRows(settings, model, 0, dtm, firstRow, lastRow);
+        });
+
+        updateMinMaxRasterGrid(dtm);
+        dtm->isLoaded = true;
+        return true;
+    }
+
+
+    /*!
+     * \brief write the synthetic terrain as ESRI grid, band by band:
+     * peak memory is bandRows * nrCols cells, whatever the grid size
+     * \param fileName  string name file (without extension)
+     * \param bandRows  number of rows of each band (computed in parallel)
+     */
+    bool writeSyntheticDtm(std::string fileName, const Crit3DSyntheticDtmSettings& settings,
+                           int bandRows, std::string* myError)
+    {
+        syntheticDtmModel model;
+        if (! initializeModel(settings, &model))
+        {
+            *myError = "Wrong synthetic DTM settings.";
+            return false;
+        }
+
+        Crit3DRasterHeader header;
+        initializeSyntheticHeader(settings, &header);
+
+        return writeEsriGridBands(fileName, header, bandRows,
+                                  [&](int firstRow, Crit3DRasterGrid* band)
+                                  {
+                                      parallelFor(0, band->header->nrRows, 16, [&](int bandFirstRow, int bandLastRow)
+                                      {
+                                          computeSyntheticRows(settings, model, firstRow, band, bandFirstRow, bandLastRow);
+                                      });
+                                      return true;
+                                  },
+                                  myError);
+    }
+}
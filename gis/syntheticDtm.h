@@ -0,0 +1,36 @@
+#ifndef SYNTHETICDTM_H
+#define SYNTHETICDTM_H
+
+    #ifndef GIS_H
+        #include "gis.h"
+    #endif
+
+    namespace gis
+    {
+        /*!
+         * \brief fractal terrain: each cell depends only on the seed and its position,
+         * so grids of any size are reproducible and can be written by bands
+         */
+        class Crit3DSyntheticDtmSettings
+        {
+        public:
+            int nrRows, nrCols;
+            double cellSize;                    /*!< [m] */
+            double xllCorner, yllCorner;        /*!< [m] */
+            unsigned int seed;
+
+            float minimumElevation;             /*!< [m] */
+            float relief;                       /*!< [m] approximate difference between the highest and the lowest cell */
+            double featureSize;                 /*!< [m] wavelength of the largest landforms */
+            float roughness;                    /*!< [0-1] amplitude ratio of the next (half wavelength) octave */
+            float nodataFraction;               /*!< [0-1] approximate fraction of nodata cells, in holes */
+
+            Crit3DSyntheticDtmSettings();
+        };
+
+        bool computeSyntheticDtm(const Crit3DSyntheticDtmSettings& settings, Crit3DRasterGrid* dtm);
+        bool writeSyntheticDtm(std::string fileName, const Crit3DSyntheticDtmSettings& settings,
+                               int bandRows, std::string* myError);
+    }
+
+#endif // SYNTHETICDTM_H
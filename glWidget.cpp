@@ -52,8 +52,6 @@
 #include "commonConstants.h"
 #include "glWidget.h"
 #include <QMouseEvent>
-#include <QOpenGLShaderProgram>
-#include <QOpenGLFunctions_4_0_Core>
 
 
 Crit3DOpenGLWidget::Crit3DOpenGLWidget(Crit3DGeometry *geometry, QWidget *parent)
@@ -63,7 +61,6 @@ Crit3DOpenGLWidget::Crit3DOpenGLWidget(Crit3DGeometry *geometry, QWidget *parent
       m_xTraslation(0),
       m_yTraslation(0),
       m_zoom(1.f),
-      m_program(nullptr),
       m_geometry(geometry)
 { }
 
@@ -75,21 +72,32 @@ Crit3DOpenGLWidget::~Crit3DOpenGLWidget()
 
 void Crit3DOpenGLWidget::clear()
 {
-    if (m_program == nullptr)
+    if (! m_renderer.isInitialized())
         return;
 
     makeCurrent();
-    m_bufferObject.destroy();
-    delete m_program;
-    m_program = nullptr;
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    m_renderer.clear();
     doneCurrent();
 
     m_geometry->clear();
 }
 
 
+/*!
+ * \brief redraw with the current vertex colors of the geometry
+ */
+void Crit3DOpenGLWidget::updateColors()
+{
+    if (! m_renderer.isInitialized())
+        return;
+
+    makeCurrent();
+    m_renderer.updateColors();
+    doneCurrent();
+    update();
+}
+
+
 QSize Crit3DOpenGLWidget::minimumSizeHint() const
 {
     return QSize(100, 100);
@@ -172,75 +180,30 @@ void Crit3DOpenGLWidget::setMagnify(float magnify)
 {
     if (! isEqual(magnify * 0.1f, m_geometry->magnify()))
     {
+        // only the shader uniform changes: no vertex upload
         m_geometry->setMagnify(magnify * 0.1f);
-
-        m_bufferObject.bind();
-        m_bufferObject.allocate(m_geometry->getVertices(), m_geometry->dataCount() * long(sizeof(GLfloat)));
-        m_bufferObject.release();
-
         update();
     }
 }
 
 
-static const char *vertexShaderSource =
-    "#version 330 core\n"
-    "attribute lowp vec4 vertex;\n"
-    "attribute lowp vec4 color;\n"
-    "varying lowp vec4 myCol;\n"
-    "uniform lowp mat4 projMatrix;\n"
-    "uniform lowp mat4 mvMatrix;\n"
-    "void main() {\n"
-    "   myCol = color;\n"
-    "   gl_Position = projMatrix * mvMatrix * vertex;\n"
-    "}\n";
-
-static const char *fragmentShaderSource =
-    "#version 330 core\n"
-    "varying lowp vec4 myCol;\n"
-    "void main() {\n"
-    "   gl_FragColor = myCol;\n"
-    "}\n";
+void Crit3DOpenGLWidget::setHeightmapMode(bool isHeightmapMode)
+{
+    if (isHeightmapMode != m_renderer.isHeightmapMode())
+    {
+        m_renderer.setHeightmapMode(isHeightmapMode);
+        update();
+    }
+}
 
 
 void Crit3DOpenGLWidget::initializeGL()
 {
-    initializeOpenGLFunctions();
-    // blue sky
-    glClearColor(0.52f, 0.81f, 0.92f, 0.f);
-
-    m_program = new QOpenGLShaderProgram;
-    m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource);
-    m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource);
-    m_program->bindAttributeLocation("vertex", 0);
-    m_program->bindAttributeLocation("color", 1);
-    m_program->link();
-
-    m_program->bind();
-    m_projMatrixLoc = m_program->uniformLocation("projMatrix");
-    m_mvMatrixLoc = m_program->uniformLocation("mvMatrix");
-    m_program->release();
-
-    // setup vertex buffer object
-    m_bufferObject.create();
-    m_bufferObject.bind();
-    m_bufferObject.allocate(m_geometry->getVertices(), m_geometry->dataCount() * long(sizeof(GLfloat)));
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), nullptr);
-    m_bufferObject.release();
-
-    // set vertex colors
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, 3 * sizeof(GLubyte), m_geometry->getColors());
+    // shaders, then vertex buffer and tile quadtree (mesh mode) or textures (heightmap mode)
+    m_renderer.initialize(m_geometry);
 
     // set default zoom
     setZoom(m_geometry->defaultDistance());
-
-    glEnable(GL_DEPTH_TEST);
-    // hidden face
-    //glEnable(GL_CULL_FACE);
-    // wireframe
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 }
 
 
@@ -257,18 +220,15 @@ void Crit3DOpenGLWidget::paintGL()
     m_world.rotate(float(m_zRotation / DEGREE_MULTIPLY), 0, 0, 1);
     m_world.translate(m_xTraslation, m_yTraslation, 0);
 
-    m_program->bind();
-    m_program->setUniformValue(m_projMatrixLoc, m_proj);
-    m_program->setUniformValue(m_mvMatrixLoc, m_camera * m_world);
-    glDrawArrays(GL_TRIANGLES, 0, m_geometry->vertexCount());
-    m_program->release();
+    QMatrix4x4 modelView = m_camera * m_world;
+    m_renderer.render(modelView, m_geometry->magnify());
 }
 
 
 void Crit3DOpenGLWidget::resizeGL(int w, int h)
 {
-    m_proj.setToIdentity();
-    m_proj.perspective(45.0f, GLfloat(w) / GLfloat(h), 0.1f, 1000000.0f);
+    // the aspect ratio does not depend on the pixel ratio, the level of detail does
+    m_renderer.setViewport(int(w * devicePixelRatioF()), int(h * devicePixelRatioF()));
 }
 
 void Crit3DOpenGLWidget::mousePressEvent(QMouseEvent *event)
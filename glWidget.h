@@ -2,19 +2,14 @@
 #define GLWIDGET_H
 
 #include <QOpenGLWidget>
-#include <QOpenGLFunctions>
-#include <QOpenGLVertexArrayObject>
-#include <QOpenGLBuffer>
 #include <QMatrix4x4>
 #include "geometry.h"
-
-
-QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
+#include "terrainRenderer.h"
 
 #define DEGREE_MULTIPLY 16
 
 
-class Crit3DOpenGLWidget : public QOpenGLWidget, protected QOpenGLFunctions
+class Crit3DOpenGLWidget : public QOpenGLWidget
 {
     Q_OBJECT
 
@@ -23,6 +18,8 @@ public:
     ~Crit3DOpenGLWidget() override;
 
     void clear();
+    void updateColors();
+    bool isHeightmapMode() const { return m_renderer.isHeightmapMode(); }
 
     QSize minimumSizeHint() const override;
     QSize sizeHint() const override;
@@ -34,6 +31,7 @@ public slots:
     void setYTraslation(float traslation);
     void setZoom(float zoom);
     void setMagnify(float magnify);
+    void setHeightmapMode(bool isHeightmapMode);
 
 signals:
     void xRotationChanged(int angle);
@@ -56,14 +54,9 @@ private:
 
     QPoint m_lastPos;
 
-    QOpenGLBuffer m_bufferObject;
-    QOpenGLShaderProgram *m_program;
+    Crit3DTerrainRenderer m_renderer;
     Crit3DGeometry *m_geometry;
 
-    int m_projMatrixLoc;
-    int m_mvMatrixLoc;
-
-    QMatrix4x4 m_proj;
     QMatrix4x4 m_camera;
     QMatrix4x4 m_world;
 };
@@ -1,8 +1,16 @@
 #include <QApplication>
+#include <QSurfaceFormat>
 #include "mainWindow.h"
 
 int main(int argc, char *argv[])
 {
+    // OpenGL 3.3 core profile: shaders and vertex array objects
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setDepthBufferSize(24);
+    QSurfaceFormat::setDefaultFormat(format);
+
     QApplication a(argc, argv);
 
     MainWindow w;
@@ -8,6 +8,7 @@
 #include <QMenuBar>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QInputDialog>
 
 MainWindow::MainWindow()
 {
@@ -29,6 +30,17 @@ MainWindow::MainWindow()
     QAction* openDtm = new QAction(tr("&Open Digital Terrain Model..."), this);
     fileMenu->addAction(openDtm);
     connect(openDtm, &QAction::triggered, this, &MainWindow::on_actionOpenDTM);
+
+    QMenu *analysisMenu = new QMenu("Analysis");
+    menuBar->addMenu(analysisMenu);
+
+    QAction* viewshed = new QAction(tr("&Viewshed..."), this);
+    analysisMenu->addAction(viewshed);
+    connect(viewshed, &QAction::triggered, this, &MainWindow::on_actionViewshed);
+
+    QAction* clearViewshed = new QAction(tr("&Clear viewshed"), this);
+    analysisMenu->addAction(clearViewshed);
+    connect(clearViewshed, &QAction::triggered, this, &MainWindow::on_actionClearViewshed);
 }
 
 
@@ -40,12 +52,15 @@ void MainWindow::on_actionOpenDTM()
     fileName = fileName.left(fileName.length()-4);
 
     std::string error;
-    if (! gis::readEsriGrid(fileName.toStdString(), &m_dtm, &error))
+    if (! gis::mapEsriGrid(fileName.toStdString(), &m_dtm, &error))
     {
         QMessageBox::critical(this, "Error in load DTM", QString::fromStdString(error));
         return;
     }
 
+    // statistics of the mapped cells (and nodata check), before computing on them
+    gis::setMinMaxFromStatistics(&m_dtm);
+
     if (!gis::computeSlopeAspectMaps(m_dtm, &m_slopeMap, &m_aspectMap))
     {
         QMessageBox::critical(this, "Error in compute slope & aspect", QString::fromStdString(error));
@@ -54,119 +69,78 @@ void MainWindow::on_actionOpenDTM()
 
     setDefaultDTMScale(m_dtm.colorScale);
 
+    // the new viewer keeps the rendering mode
+    bool isHeightmapMode = false;
     if (m_viewer3D != nullptr)
     {
+        isHeightmapMode = m_viewer3D->glWidget->isHeightmapMode();
         m_viewer3D->glWidget->clear();
         m_viewer3D->close();
     }
 
     initializeGeometry();
-    m_viewer3D = new Viewer3D(&m_geometry);
+    m_viewer3D = new Viewer3D(&m_geometry, isHeightmapMode);
     m_viewer3D->show();
 }
 
 
-void MainWindow::shadowColor(const Crit3DColor &colorIn, Crit3DColor &colorOut, int row, int col)
+bool MainWindow::initializeGeometry()
 {
-    colorOut.red = colorIn.red;
-    colorOut.green = colorIn.green;
-    colorOut.blue = colorIn.blue;
+    return buildTerrainGeometry(m_dtm, m_slopeMap, m_aspectMap, &m_shadedColors, &m_geometry);
+}
+
 
-    float aspect = m_aspectMap.getValueFromRowCol(row, col);
-    if (! isEqual(aspect, m_aspectMap.header->flag))
+/*!
+ * \brief compute the viewshed of an observer and drape it on the 3D terrain
+ */
+void MainWindow::on_actionViewshed()
+{
+    if (m_viewer3D == nullptr || ! m_dtm.isLoaded)
     {
-        float slope = m_slopeMap.getValueFromRowCol(row, col);
-        if (! isEqual(slope, m_slopeMap.header->flag))
-        {
-            float slopeAmplification = 120.f / std::max(m_slopeMap.maximum, 1.f);
-            float shadow = -cos(aspect * float(DEG_TO_RAD)) * std::max(5.f, slope * slopeAmplification);
-            colorOut.red = std::min(255, std::max(0, int(colorOut.red + shadow)));
-            colorOut.green = std::min(255, std::max(0, int(colorOut.green + shadow)));
-            colorOut.blue = std::min(255, std::max(0, int(colorOut.blue + shadow)));
-            if (slope > m_geometry.artifactSlope())
-            {
-                colorOut.red = std::min(255, std::max(0, int((colorOut.red + 256) / 2)));
-                colorOut.green = std::min(255, std::max(0, int((colorOut.green + 256) / 2)));
-                colorOut.blue = std::min(255, std::max(0, int((colorOut.blue + 256) / 2)));
-            }
-        }
+        QMessageBox::information(this, "Viewshed", "Open a Digital Terrain Model first.");
+        return;
     }
-}
 
+    // default observer: 2 m above the DTM center
+    gis::Crit3DPoint center = m_dtm.mapCenter();
+    QString defaultObserver = QString::number(center.utm.x, 'f', 1) + " " + QString::number(center.utm.y, 'f', 1) + " 2";
 
-bool MainWindow::initializeGeometry()
-{
-    if (! m_dtm.isLoaded)
-        return false;
-
-    m_geometry.clear();
-
-    // set center
-    double xCenter, yCenter;
-    gis::getUtmXYFromRowCol(m_dtm, m_dtm.header->nrRows / 2, m_dtm.header->nrCols / 2, &xCenter, &yCenter);
-    gis::updateMinMaxRasterGrid(&m_dtm);
-    float zCenter = (m_dtm.maximum + m_dtm.minimum) * 0.5f;
-    m_geometry.setCenter(float(xCenter), float(yCenter), zCenter);
-
-    // set dimension
-    float dx = float(m_dtm.header->nrCols * m_dtm.header->cellSize);
-    float dy = float(m_dtm.header->nrRows * m_dtm.header->cellSize);
-    float dz = m_dtm.maximum + m_dtm.minimum;
-    m_geometry.setDimension(dx, dy);
-
-    // set magnify
-    float magnify = ((dx + dy) * 0.5f) / (dz * 10.f);
-    m_geometry.setMagnify(std::min(5.f, std::max(1.f, magnify)));
-
-    // set triangles
-    double x, y;
-    float z1, z2, z3;
-    gis::Crit3DPoint p1, p2, p3;
-    Crit3DColor *c1, *c2, *c3;
-    Crit3DColor sc1, sc2, sc3;
-    for (long row = 0; row < m_dtm.header->nrRows; row++)
+    bool isOk;
+    QString text = QInputDialog::getText(this, "Viewshed", "Observer x y [m] and height above the terrain [m]:",
+                                         QLineEdit::Normal, defaultObserver, &isOk);
+    if (! isOk) return;
+
+    QStringList values = text.simplified().split(" ");
+    bool isOkX = false, isOkY = false, isOkHeight = false;
+    double x = 0, y = 0, height = 0;
+    if (values.size() == 3)
     {
-        for (long col = 0; col < m_dtm.header->nrCols; col++)
-        {
-            z1 = m_dtm.getValueFromRowCol(row, col);
-            if (! isEqual(z1, m_dtm.header->flag))
-            {
-                gis::getUtmXYFromRowCol(m_dtm, row, col, &x, &y);
-                p1 = gis::Crit3DPoint(x, y, z1);
-                c1 = m_dtm.colorScale->getColor(z1);
-                shadowColor(*c1, sc1, row, col);
-
-                z3 = m_dtm.getValueFromRowCol(row+1, col+1);
-                if (! isEqual(z3, m_dtm.header->flag))
-                {
-                    gis::getUtmXYFromRowCol(m_dtm, row+1, col+1, &x, &y);
-                    p3 = gis::Crit3DPoint(x, y, z3);
-                    c3 = m_dtm.colorScale->getColor(z3);
-                    shadowColor(*c3, sc3, row+1, col+1);
-
-                    z2 = m_dtm.getValueFromRowCol(row+1, col);
-                    if (! isEqual(z2, m_dtm.header->flag))
-                    {
-                        gis::getUtmXYFromRowCol(m_dtm, row+1, col, &x, &y);
-                        p2 = gis::Crit3DPoint(x, y, z2);
-                        c2 = m_dtm.colorScale->getColor(z2);
-                        shadowColor(*c2, sc2, row+1, col);
-                        m_geometry.addTriangle(p1, p2, p3, sc1, sc2, sc3);
-                    }
-
-                    z2 = m_dtm.getValueFromRowCol(row, col+1);
-                    if (! isEqual(z2, m_dtm.header->flag))
-                    {
-                        gis::getUtmXYFromRowCol(m_dtm, row, col+1, &x, &y);
-                        p2 = gis::Crit3DPoint(x, y, z2);
-                        c2 = m_dtm.colorScale->getColor(z2);
-                        shadowColor(*c2, sc2, row, col+1);
-                        m_geometry.addTriangle(p3, p2, p1, sc3, sc2, sc1);
-                    }
-                }
-            }
-        }
+        x = values[0].toDouble(&isOkX);
+        y = values[1].toDouble(&isOkY);
+        height = values[2].toDouble(&isOkHeight);
     }
+    if (! isOkX || ! isOkY || ! isOkHeight)
+    {
+        QMessageBox::critical(this, "Error in viewshed", "Wrong observer: " + text);
+        return;
+    }
+
+    gis::Crit3DRasterGrid viewshedMap;
+    if (! gis::computeViewshed(m_dtm, gis::Crit3DUtmPoint(x, y), float(height), 0, 0, &viewshedMap))
+    {
+        QMessageBox::critical(this, "Error in viewshed", "The observer is outside the DTM or on a nodata cell.");
+        return;
+    }
+
+    if (drapeVisibilityMap(&viewshedMap, m_shadedColors, &m_geometry))
+        m_viewer3D->glWidget->updateColors();
+}
+
+
+void MainWindow::on_actionClearViewshed()
+{
+    if (m_viewer3D == nullptr) return;
 
-    return true;
+    if (drapeVisibilityMap(nullptr, m_shadedColors, &m_geometry))
+        m_viewer3D->glWidget->updateColors();
 }
@@ -2,6 +2,7 @@
 #define MAINWINDOW_H
 
     #include <QWidget>
+    #include <QPointer>
     #include "geometry.h"
     #include "gis.h"
     #include "viewer3D.h"
@@ -14,15 +15,17 @@
         MainWindow();
 
     private:
-        Viewer3D* m_viewer3D;
+        QPointer<Viewer3D> m_viewer3D;
         Crit3DGeometry m_geometry;
         gis::Crit3DRasterGrid m_slopeMap;
         gis::Crit3DRasterGrid m_aspectMap;
         gis::Crit3DRasterGrid m_dtm;
+        gis::Crit3DColorGrid m_shadedColors;
 
         bool initializeGeometry();
         void on_actionOpenDTM();
-        void shadowColor(const Crit3DColor &colorIn, Crit3DColor &colorOut, int row, int col);
+        void on_actionViewshed();
+        void on_actionClearViewshed();
     };
 
 #endif // MAINWINDOW_H
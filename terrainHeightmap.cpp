@@ -0,0 +1,260 @@
+/*!
+    \file terrainHeightmap.cpp
+
+    \abstract Terrain rendering from a heightmap texture
+
+    The DTM is uploaded as a R32F texture (4 bytes for each cell) and the
+    shaded colors as a RGBA8 texture (4 bytes for each cell), straight from
+    the rasters of the geometry: the mesh of the geometry is not needed.
+    The only mesh is a constant patch of HEIGHTMAP_PATCH_SIZE x HEIGHTMAP_PATCH_SIZE
+    quads, drawn once for each patch of the grid (instancing) and displaced
+    in the vertex shader. Swapping DTM means uploading new textures.
+
+    The lighting is already baked in the shaded colors (computeShadedColorGrid),
+    so no normals are needed. Triangles with a nodata corner are discarded,
+    as in the mesh renderer.
+*/
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QSize>
+#include "terrainHeightmap.h"
+
+
+static const char *heightmapVertexShaderSource =
+    "#version 330 core\n"
+    "layout(location = 0) in vec2 patchVertex;\n"
+    "uniform sampler2D heightMap;\n"
+    "uniform sampler2D colorMap;\n"
+    "uniform ivec2 gridSize;\n"
+    "uniform int nrPatchCols;\n"
+    "uniform int patchSize;\n"
+    "uniform vec2 firstCell;\n"
+    "uniform float cellSize;\n"
+    "uniform float zCenter;\n"
+    "uniform float magnify;\n"
+    "uniform mat4 projMatrix;\n"
+    "uniform mat4 mvMatrix;\n"
+    "out vec4 myCol;\n"
+    "out float isValid;\n"
+    "void main() {\n"
+    "   ivec2 patchOrigin = patchSize * ivec2(gl_InstanceID % nrPatchCols, gl_InstanceID / nrPatchCols);\n"
+    "   ivec2 cell = min(ivec2(patchVertex) + patchOrigin, gridSize - 1);\n"
+    "   vec4 color = texelFetch(colorMap, cell, 0);\n"
+    "   float z = (color.a > 0.5) ? texelFetch(heightMap, cell, 0).r - zCenter : 0.0;\n"
+    "   myCol = vec4(color.rgb, 1.0);\n"
+    "   isValid = color.a;\n"
+    "   vec3 position = vec3(firstCell.x + float(cell.x) * cellSize, firstCell.y - float(cell.y) * cellSize, z * magnify);\n"
+    "   gl_Position = projMatrix * mvMatrix * vec4(position, 1.0);\n"
+    "}\n";
+
+static const char *heightmapFragmentShaderSource =
+    "#version 330 core\n"
+    "in vec4 myCol;\n"
+    "in float isValid;\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "   if (isValid < 0.999) discard;\n"
+    "   fragColor = myCol;\n"
+    "}\n";
+
+
+Crit3DTerrainHeightmap::Crit3DTerrainHeightmap()
+    : m_program(nullptr),
+      m_heightTexture(nullptr),
+      m_colorTexture(nullptr),
+      m_patchVertices(QOpenGLBuffer::VertexBuffer),
+      m_patchIndices(QOpenGLBuffer::IndexBuffer),
+      m_patchIndexCount(0),
+      m_nrRows(0), m_nrCols(0),
+      m_nrPatchRows(0), m_nrPatchCols(0),
+      m_cellSize(0),
+      m_xFirst(0), m_yFirst(0), m_zCenter(0)
+{ }
+
+
+/*!
+ * \brief compile the shaders, build the grid patch and upload the textures
+ * (requires the current GL context)
+ * \return false if the shaders fail or the grid exceeds the maximum texture size
+ */
+bool Crit3DTerrainHeightmap::initialize(const Crit3DGeometry *geometry)
+{
+    clear();
+
+    m_program = new QOpenGLShaderProgram;
+    if (! m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, heightmapVertexShaderSource)
+        || ! m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, heightmapFragmentShaderSource)
+        || ! m_program->link())
+    {
+        clear();
+        return false;
+    }
+
+    // grid patch: (col, row) of the vertices, strips separated by the restart index
+    int nrSamples = HEIGHTMAP_PATCH_SIZE + 1;
+    std::vector<GLfloat> vertices;
+    vertices.reserve(size_t(nrSamples * nrSamples * 2));
+    for (int row = 0; row < nrSamples; row++)
+        for (int col = 0; col < nrSamples; col++)
+        {
+            vertices.push_back(GLfloat(col));
+            vertices.push_back(GLfloat(row));
+        }
+
+    std::vector<GLuint> indices;
+    std::vector<GLuint> upper(size_t(nrSamples)), lower(size_t(nrSamples));
+    for (int row = 0; row < nrSamples - 1; row++)
+    {
+        for (int col = 0; col < nrSamples; col++)
+        {
+            upper[size_t(col)] = GLuint(row * nrSamples + col);
+            lower[size_t(col)] = GLuint((row + 1) * nrSamples + col);
+        }
+        Crit3DGeometry::appendStrips(upper.data(), lower.data(), nrSamples, indices);
+    }
+    m_patchIndexCount = GLsizei(indices.size());
+
+    m_vao.create();
+    QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+
+    m_patchVertices.create();
+    m_patchVertices.bind();
+    m_patchVertices.allocate(vertices.data(), int(vertices.size() * sizeof(GLfloat)));
+    f->glEnableVertexAttribArray(0);
+    f->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), nullptr);
+
+    m_patchIndices.create();
+    m_patchIndices.bind();
+    m_patchIndices.allocate(indices.data(), int(indices.size() * sizeof(GLuint)));
+
+    if (! uploadTextures(geometry))
+    {
+        clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+void Crit3DTerrainHeightmap::deleteTextures()
+{
+    delete m_heightTexture;
+    m_heightTexture = nullptr;
+    delete m_colorTexture;
+    m_colorTexture = nullptr;
+}
+
+
+/*!
+ * \brief upload heights and colors from the rasters of the geometry: the only work needed to swap DTM
+ */
+bool Crit3DTerrainHeightmap::uploadTextures(const Crit3DGeometry *geometry)
+{
+    deleteTextures();
+
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    GLint maxTextureSize;
+    f->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+    const gis::Crit3DRasterGrid *dtm = geometry->dtm();
+    if (dtm == nullptr || ! dtm->isLoaded) return false;
+
+    m_nrRows = geometry->nrRows();
+    m_nrCols = geometry->nrCols();
+    if (m_nrRows < 2 || m_nrCols < 2 || m_nrRows > maxTextureSize || m_nrCols > maxTextureSize)
+        return false;
+
+    m_cellSize = geometry->getX(1) - geometry->getX(0);
+    m_xFirst = geometry->getX(0);
+    m_yFirst = geometry->getY(0);
+    m_nrPatchRows = (m_nrRows - 1 + HEIGHTMAP_PATCH_SIZE - 1) / HEIGHTMAP_PATCH_SIZE;
+    m_nrPatchCols = (m_nrCols - 1 + HEIGHTMAP_PATCH_SIZE - 1) / HEIGHTMAP_PATCH_SIZE;
+
+    m_zCenter = geometry->zCenter();
+
+    // heights: one row at a time, the rows of the DTM (e.g. memory-mapped) may not be contiguous
+    m_heightTexture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    m_heightTexture->setFormat(QOpenGLTexture::R32F);
+    m_heightTexture->setSize(m_nrCols, m_nrRows);
+    m_heightTexture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    m_heightTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    m_heightTexture->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::Float32);
+    m_heightTexture->bind();
+    for (int row = 0; row < m_nrRows; row++)
+        f->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, m_nrCols, 1, GL_RED, GL_FLOAT, dtm->value[row]);
+    m_heightTexture->release();
+
+    m_colorTexture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    m_colorTexture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    m_colorTexture->setSize(m_nrCols, m_nrRows);
+    m_colorTexture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    m_colorTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    m_colorTexture->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+
+    return uploadColors(geometry);
+}
+
+
+/*!
+ * \brief upload again the displayed colors of the geometry (e.g. a map draped on the terrain)
+ */
+bool Crit3DTerrainHeightmap::uploadColors(const Crit3DGeometry *geometry)
+{
+    const gis::Crit3DColorGrid *colors = geometry->colors();
+    if (m_colorTexture == nullptr || colors == nullptr
+        || colors->nrRows != m_nrRows || colors->nrCols != m_nrCols)
+        return false;
+
+    m_colorTexture->setData(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, colors->rgba.data());
+    return true;
+}
+
+
+void Crit3DTerrainHeightmap::draw(const QMatrix4x4 &projection, const QMatrix4x4 &modelView, float magnify)
+{
+    if (m_program == nullptr || m_heightTexture == nullptr) return;
+
+    m_program->bind();
+    m_program->setUniformValue("projMatrix", projection);
+    m_program->setUniformValue("mvMatrix", modelView);
+    m_program->setUniformValue("magnify", magnify);
+    m_program->setUniformValue("gridSize", QSize(m_nrCols, m_nrRows));
+    m_program->setUniformValue("nrPatchCols", m_nrPatchCols);
+    m_program->setUniformValue("patchSize", HEIGHTMAP_PATCH_SIZE);
+    m_program->setUniformValue("firstCell", m_xFirst, m_yFirst);
+    m_program->setUniformValue("cellSize", m_cellSize);
+    m_program->setUniformValue("zCenter", m_zCenter);
+    m_program->setUniformValue("heightMap", 0);
+    m_program->setUniformValue("colorMap", 1);
+
+    m_heightTexture->bind(0);
+    m_colorTexture->bind(1);
+
+    QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glDrawElementsInstanced(GL_TRIANGLE_STRIP, m_patchIndexCount, GL_UNSIGNED_INT, nullptr,
+                               m_nrPatchRows * m_nrPatchCols);
+
+    m_colorTexture->release(1);
+    m_heightTexture->release(0);
+    m_program->release();
+}
+
+
+/*!
+ * \brief release all the GL resources (requires the current GL context)
+ */
+void Crit3DTerrainHeightmap::clear()
+{
+    deleteTextures();
+    m_vao.destroy();
+    m_patchVertices.destroy();
+    m_patchIndices.destroy();
+    m_patchIndexCount = 0;
+
+    delete m_program;
+    m_program = nullptr;
+}
@@ -0,0 +1,53 @@
+#ifndef TERRAINHEIGHTMAP_H
+#define TERRAINHEIGHTMAP_H
+
+    #include <QMatrix4x4>
+    #include <QOpenGLBuffer>
+    #include <QOpenGLShaderProgram>
+    #include <QOpenGLTexture>
+    #include <QOpenGLVertexArrayObject>
+
+    #ifndef GEOMETRY_H
+        #include "geometry.h"
+    #endif
+
+    /*! quads for each side of the instanced grid patch */
+    #define HEIGHTMAP_PATCH_SIZE 64
+
+    /*!
+     * \brief terrain drawn from textures: heights (R32F) and shaded colors (RGBA8),
+     * uploaded from the rasters of the geometry, displace the instances of a constant
+     * grid patch in the vertex shader
+     */
+    class Crit3DTerrainHeightmap
+    {
+    public:
+        Crit3DTerrainHeightmap();
+
+        bool initialize(const Crit3DGeometry *geometry);
+        bool uploadTextures(const Crit3DGeometry *geometry);
+        bool uploadColors(const Crit3DGeometry *geometry);
+        void draw(const QMatrix4x4 &projection, const QMatrix4x4 &modelView, float magnify);
+        void clear();
+
+        bool isInitialized() const { return m_program != nullptr; }
+
+    private:
+        QOpenGLShaderProgram *m_program;
+        QOpenGLTexture *m_heightTexture;
+        QOpenGLTexture *m_colorTexture;
+        QOpenGLVertexArrayObject m_vao;
+        QOpenGLBuffer m_patchVertices;
+        QOpenGLBuffer m_patchIndices;
+        GLsizei m_patchIndexCount;
+
+        int m_nrRows, m_nrCols;
+        int m_nrPatchRows, m_nrPatchCols;
+        float m_cellSize;
+        float m_xFirst, m_yFirst, m_zCenter;
+
+        void deleteTextures();
+    };
+
+
+#endif // TERRAINHEIGHTMAP_H
@@ -0,0 +1,503 @@
+/*!
+    \file terrainLOD.cpp
+
+    \abstract Chunked level of detail of the terrain mesh
+
+    The DTM is covered by a quadtree of tiles: every node is a square of
+    LOD_TILE_SIZE x LOD_TILE_SIZE quads, sampled every stride cells
+    (stride 1 on the leaves, doubling at each upper level).
+    All tiles index the same shared vertex buffer of Crit3DGeometry:
+    only the index buffers depend on the level of detail.
+
+    Every frame the quadtree is refined while the screen-space error
+    of a node is greater than LOD_MAX_PIXEL_ERROR, so the number of drawn
+    triangles depends on the screen resolution and not on the DTM size.
+    Nodes whose bounding box is outside the view frustum are skipped
+    with all their subtree.
+    Cracks between tiles at different strides are avoided by snapping
+    the border vertices of the finer tile to the samples of the coarser
+    neighbour (degenerate triangles are harmless in the strips).
+*/
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include "terrainLOD.h"
+
+
+/*!
+ * \brief positions first, first+step, ... and always last
+ */
+static std::vector<int> samplePositions(int first, int step, int last)
+{
+    std::vector<int> positions;
+    for (int i = first; i < last; i += step)
+        positions.push_back(i);
+    positions.push_back(last);
+    return positions;
+}
+
+
+/*!
+ * \brief nearest sample of a coarser tile: multiples of stride and last
+ */
+static int snapPosition(int position, int stride, int last)
+{
+    int low = (position / stride) * stride;
+    int high = std::min(low + stride, last);
+    return (position - low <= high - position) ? low : high;
+}
+
+
+/*!
+ * \brief extract the frustum planes from the clip matrix (Gribb & Hartmann)
+ */
+void Crit3DFrustum::setPlanes(const QMatrix4x4 &modelViewProjection)
+{
+    QVector4D row0 = modelViewProjection.row(0);
+    QVector4D row1 = modelViewProjection.row(1);
+    QVector4D row2 = modelViewProjection.row(2);
+    QVector4D row3 = modelViewProjection.row(3);
+
+    m_planes[0] = row3 + row0;      // left
+    m_planes[1] = row3 - row0;      // right
+    m_planes[2] = row3 + row1;      // bottom
+    m_planes[3] = row3 - row1;      // top
+    m_planes[4] = row3 + row2;      // near
+    m_planes[5] = row3 - row2;      // far
+}
+
+
+/*!
+ * \brief test an axis aligned box against the planes of planeMask
+ * \param planeMask    [input/output] planes still to be tested: the planes
+ * that contain the whole box are removed, so the children skip them
+ * \return true if the box is completely outside a plane
+ */
+bool Crit3DFrustum::isOutside(const QVector3D &boxMin, const QVector3D &boxMax, int *planeMask) const
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (! (*planeMask & (1 << i))) continue;
+
+        const QVector4D &plane = m_planes[i];
+
+        // farthest corner along the plane normal
+        float x = plane.x() >= 0 ? boxMax.x() : boxMin.x();
+        float y = plane.y() >= 0 ? boxMax.y() : boxMin.y();
+        float z = plane.z() >= 0 ? boxMax.z() : boxMin.z();
+        if (plane.x() * x + plane.y() * y + plane.z() * z + plane.w() < 0)
+            return true;
+
+        // nearest corner inside: the whole box is inside this plane
+        x = plane.x() >= 0 ? boxMin.x() : boxMax.x();
+        y = plane.y() >= 0 ? boxMin.y() : boxMax.y();
+        z = plane.z() >= 0 ? boxMin.z() : boxMax.z();
+        if (plane.x() * x + plane.y() * y + plane.z() * z + plane.w() >= 0)
+            *planeMask &= ~(1 << i);
+    }
+
+    return false;
+}
+
+
+Crit3DTerrainLOD::Crit3DTerrainLOD()
+{
+    m_geometry = nullptr;
+    m_frame = 0;
+}
+
+
+/*!
+ * \brief release the quadtree and the cached index buffers (requires the current GL context)
+ */
+void Crit3DTerrainLOD::clear()
+{
+    for (std::list<Crit3DTileBuffer>::iterator it = m_cache.begin(); it != m_cache.end(); ++it)
+        it->buffer.destroy();
+
+    m_cache.clear();
+    m_cacheMap.clear();
+    m_nodes.clear();
+    m_isSelected.clear();
+    m_frame = 0;
+}
+
+
+/*!
+ * \brief build the quadtree of the geometry grid: z bounds and errors of all nodes
+ */
+void Crit3DTerrainLOD::initialize(const Crit3DGeometry *geometry)
+{
+    clear();
+    m_geometry = geometry;
+
+    int nrQuads = std::max(geometry->nrRows(), geometry->nrCols()) - 1;
+    if (nrQuads < 1) return;
+
+    int rootStride = 1;
+    while (LOD_TILE_SIZE * rootStride < nrQuads)
+        rootStride *= 2;
+
+    buildNode(0, 0, rootStride);
+    m_isSelected.resize(m_nodes.size(), 0);
+}
+
+
+bool Crit3DTerrainLOD::getZ(int row, int col, float *z) const
+{
+    GLuint index = m_geometry->vertexIndex(row, col);
+    if (index == NODATA_VERTEX) return false;
+
+    *z = m_geometry->getVertices()[index].z;
+    return true;
+}
+
+
+/*!
+ * \brief add the node and its subtree
+ * \return node index, -1 if the node is outside the grid
+ */
+int Crit3DTerrainLOD::buildNode(int firstRow, int firstCol, int stride)
+{
+    int nrRows = m_geometry->nrRows();
+    int nrCols = m_geometry->nrCols();
+    if (firstRow >= nrRows - 1 || firstCol >= nrCols - 1) return -1;
+
+    Crit3DTerrainNode node;
+    node.firstRow = firstRow;
+    node.firstCol = firstCol;
+    node.lastRow = std::min(firstRow + LOD_TILE_SIZE * stride, nrRows - 1);
+    node.lastCol = std::min(firstCol + LOD_TILE_SIZE * stride, nrCols - 1);
+    node.stride = stride;
+    for (int i = 0; i < 4; i++)
+        node.children[i] = -1;
+    node.zMin = std::numeric_limits<float>::max();
+    node.zMax = std::numeric_limits<float>::lowest();
+    node.error = 0;
+
+    int index = int(m_nodes.size());
+    m_nodes.push_back(node);
+
+    if (stride == 1)
+    {
+        float z;
+        for (int row = node.firstRow; row <= node.lastRow; row++)
+            for (int col = node.firstCol; col <= node.lastCol; col++)
+                if (getZ(row, col, &z))
+                {
+                    node.zMin = std::min(node.zMin, z);
+                    node.zMax = std::max(node.zMax, z);
+                }
+
+        m_nodes[unsigned(index)] = node;
+        return index;
+    }
+
+    int half = stride / 2;
+    int size = LOD_TILE_SIZE * half;
+    node.children[0] = buildNode(firstRow, firstCol, half);
+    node.children[1] = buildNode(firstRow, firstCol + size, half);
+    node.children[2] = buildNode(firstRow + size, firstCol, half);
+    node.children[3] = buildNode(firstRow + size, firstCol + size, half);
+
+    // the error of the children is added to the decimation error of this node
+    float childError = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (node.children[i] == -1) continue;
+
+        const Crit3DTerrainNode &child = m_nodes[unsigned(node.children[i])];
+        node.zMin = std::min(node.zMin, child.zMin);
+        node.zMax = std::max(node.zMax, child.zMax);
+        childError = std::max(childError, child.error);
+    }
+    node.error = decimationError(node) + childError;
+
+    m_nodes[unsigned(index)] = node;
+    return index;
+}
+
+
+/*!
+ * \brief maximum vertical distance between the vertices at stride/2 and
+ * the triangles of the node at its stride (same diagonal of the strips)
+ */
+float Crit3DTerrainLOD::decimationError(const Crit3DTerrainNode &node) const
+{
+    std::vector<int> rows = samplePositions(node.firstRow, node.stride, node.lastRow);
+    std::vector<int> cols = samplePositions(node.firstCol, node.stride, node.lastCol);
+    std::vector<int> fineRows = samplePositions(node.firstRow, node.stride / 2, node.lastRow);
+    std::vector<int> fineCols = samplePositions(node.firstCol, node.stride / 2, node.lastCol);
+
+    float maxError = 0;
+    float z, zA, zB, zC, zD, zInterpolated;
+    unsigned i = 0;
+    for (unsigned fineRow = 0; fineRow < fineRows.size(); fineRow++)
+    {
+        int row = fineRows[fineRow];
+        while (i + 2 < rows.size() && rows[i+1] <= row) i++;
+        int row0 = rows[i];
+        int row1 = rows[i+1];
+
+        unsigned j = 0;
+        for (unsigned fineCol = 0; fineCol < fineCols.size(); fineCol++)
+        {
+            int col = fineCols[fineCol];
+            while (j + 2 < cols.size() && cols[j+1] <= col) j++;
+            int col0 = cols[j];
+            int col1 = cols[j+1];
+
+            if ((row == row0 || row == row1) && (col == col0 || col == col1)) continue;
+            if (! getZ(row, col, &z)) continue;
+
+            // quad A (row0, col0), B (row1, col0), C (row1, col1), D (row0, col1): diagonal A - C
+            float v = float(row - row0) / float(row1 - row0);
+            float u = float(col - col0) / float(col1 - col0);
+            if (! getZ(row0, col0, &zA) || ! getZ(row1, col1, &zC)) continue;
+            if (v >= u)
+            {
+                if (! getZ(row1, col0, &zB)) continue;
+                zInterpolated = zA + v * (zB - zA) + u * (zC - zB);
+            }
+            else
+            {
+                if (! getZ(row0, col1, &zD)) continue;
+                zInterpolated = zA + u * (zD - zA) + v * (zC - zD);
+            }
+
+            maxError = std::max(maxError, fabsf(z - zInterpolated));
+        }
+    }
+
+    return maxError;
+}
+
+
+/*!
+ * \brief bounding box of the node in model coordinates (magnified z)
+ */
+void Crit3DTerrainLOD::getBox(const Crit3DTerrainNode &node, float magnify, QVector3D *boxMin, QVector3D *boxMax) const
+{
+    *boxMin = QVector3D(m_geometry->getX(node.firstCol), m_geometry->getY(node.lastRow), node.zMin * magnify);
+    *boxMax = QVector3D(m_geometry->getX(node.lastCol), m_geometry->getY(node.firstRow), node.zMax * magnify);
+}
+
+
+/*!
+ * \brief select the tiles to draw: visible tiles, refined while the screen-space error is too large
+ * \param modelViewProjection   clip matrix of the magnified model coordinates
+ * \param cameraPosition    camera in model coordinates (z already magnified)
+ * \param magnify           vertical exaggeration of the shader
+ * \param pixelFactor       viewport height / (2 tan(fov/2)): pixels of a unit size at unit distance
+ * \param tiles             selected tiles, with the strides of the coarser neighbours
+ */
+void Crit3DTerrainLOD::selectTiles(const QMatrix4x4 &modelViewProjection, const QVector3D &cameraPosition,
+                                   float magnify, float pixelFactor, std::vector<Crit3DTerrainTile> &tiles)
+{
+    tiles.clear();
+    m_frame++;
+    if (m_nodes.empty()) return;
+
+    m_frustum.setPlanes(modelViewProjection);
+    std::fill(m_isSelected.begin(), m_isSelected.end(), 0);
+    selectNode(0, 0x3F, cameraPosition, magnify, pixelFactor, tiles);
+
+    // stride of the neighbours: probe a cell just outside the middle of each edge
+    int nrRows = m_geometry->nrRows();
+    int nrCols = m_geometry->nrCols();
+    for (unsigned i = 0; i < tiles.size(); i++)
+    {
+        const Crit3DTerrainNode &node = m_nodes[unsigned(tiles[i].node)];
+        int size = LOD_TILE_SIZE * node.stride;
+        int middleRow = (node.firstRow + node.lastRow) / 2;
+        int middleCol = (node.firstCol + node.lastCol) / 2;
+
+        int neighbourStride[4] = {0, 0, 0, 0};
+        if (node.firstCol > 0)
+            neighbourStride[edgeLeft] = selectedStride(middleRow, node.firstCol - 1);
+        if (node.firstRow > 0)
+            neighbourStride[edgeTop] = selectedStride(node.firstRow - 1, middleCol);
+        if (node.lastCol < nrCols - 1)
+            neighbourStride[edgeRight] = selectedStride(middleRow, node.firstCol + size);
+        if (node.lastRow < nrRows - 1)
+            neighbourStride[edgeBottom] = selectedStride(node.firstRow + size, middleCol);
+
+        for (int edge = 0; edge < 4; edge++)
+            tiles[i].edgeStride[edge] = std::max(node.stride, neighbourStride[edge]);
+    }
+}
+
+
+/*!
+ * \param planeMask    frustum planes that don't contain the parent node yet
+ */
+void Crit3DTerrainLOD::selectNode(int index, int planeMask, const QVector3D &cameraPosition, float magnify,
+                                  float pixelFactor, std::vector<Crit3DTerrainTile> &tiles)
+{
+    const Crit3DTerrainNode &node = m_nodes[unsigned(index)];
+
+    // no valid vertices
+    if (node.zMin > node.zMax) return;
+
+    QVector3D boxMin, boxMax;
+    getBox(node, magnify, &boxMin, &boxMax);
+
+    // view frustum culling
+    if (planeMask != 0 && m_frustum.isOutside(boxMin, boxMax, &planeMask)) return;
+
+    bool isRefined = false;
+    if (node.stride > 1 && node.error > 0)
+    {
+        // distance from the camera to the bounding box of the node
+        float dx = std::max(0.f, std::max(boxMin.x() - cameraPosition.x(), cameraPosition.x() - boxMax.x()));
+        float dy = std::max(0.f, std::max(boxMin.y() - cameraPosition.y(), cameraPosition.y() - boxMax.y()));
+        float dz = std::max(0.f, std::max(boxMin.z() - cameraPosition.z(), cameraPosition.z() - boxMax.z()));
+        float distance = sqrtf(dx*dx + dy*dy + dz*dz);
+
+        isRefined = (node.error * magnify * pixelFactor > LOD_MAX_PIXEL_ERROR * distance);
+    }
+
+    if (! isRefined)
+    {
+        Crit3DTerrainTile tile;
+        tile.node = index;
+        for (int edge = 0; edge < 4; edge++)
+            tile.edgeStride[edge] = node.stride;
+
+        m_isSelected[unsigned(index)] = 1;
+        tiles.push_back(tile);
+        return;
+    }
+
+    for (int i = 0; i < 4; i++)
+        if (node.children[i] != -1)
+            selectNode(node.children[i], planeMask, cameraPosition, magnify, pixelFactor, tiles);
+}
+
+
+/*!
+ * \brief stride of the selected tile containing the cell, 0 if none
+ */
+int Crit3DTerrainLOD::selectedStride(int row, int col) const
+{
+    int index = 0;
+    while (index != -1)
+    {
+        const Crit3DTerrainNode &node = m_nodes[unsigned(index)];
+        if (m_isSelected[unsigned(index)])
+            return node.stride;
+        if (node.stride == 1)
+            return 0;
+
+        int size = LOD_TILE_SIZE * node.stride / 2;
+        int child = (row >= node.firstRow + size ? 2 : 0) + (col >= node.firstCol + size ? 1 : 0);
+        index = node.children[child];
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief triangle strips of a tile at its stride
+ * the border vertices towards a coarser neighbour are snapped to its samples
+ */
+void Crit3DTerrainLOD::buildTileIndices(const Crit3DTerrainTile &tile, std::vector<GLuint> &indices) const
+{
+    const Crit3DTerrainNode &node = m_nodes[unsigned(tile.node)];
+    int lastGridRow = m_geometry->nrRows() - 1;
+    int lastGridCol = m_geometry->nrCols() - 1;
+
+    std::vector<int> rows = samplePositions(node.firstRow, node.stride, node.lastRow);
+    std::vector<int> cols = samplePositions(node.firstCol, node.stride, node.lastCol);
+    unsigned lastRowSample = unsigned(rows.size()) - 1;
+    unsigned lastColSample = unsigned(cols.size()) - 1;
+
+    std::vector<GLuint> upper(cols.size());
+    std::vector<GLuint> lower(cols.size());
+
+    indices.clear();
+    indices.reserve(rows.size() * (2 * cols.size() + 2));
+
+    for (unsigned i = 0; i < rows.size(); i++)
+    {
+        for (unsigned j = 0; j < cols.size(); j++)
+        {
+            int row = rows[i];
+            int col = cols[j];
+
+            if (j == 0 && tile.edgeStride[edgeLeft] > node.stride)
+                row = snapPosition(row, tile.edgeStride[edgeLeft], lastGridRow);
+            if (j == lastColSample && tile.edgeStride[edgeRight] > node.stride)
+                row = snapPosition(row, tile.edgeStride[edgeRight], lastGridRow);
+            if (i == 0 && tile.edgeStride[edgeTop] > node.stride)
+                col = snapPosition(col, tile.edgeStride[edgeTop], lastGridCol);
+            if (i == lastRowSample && tile.edgeStride[edgeBottom] > node.stride)
+                col = snapPosition(col, tile.edgeStride[edgeBottom], lastGridCol);
+
+            lower[j] = m_geometry->vertexIndex(row, col);
+        }
+
+        if (i > 0)
+            Crit3DGeometry::appendStrips(upper.data(), lower.data(), int(cols.size()), indices);
+
+        upper.swap(lower);
+    }
+}
+
+
+/*!
+ * \brief index buffer of a tile: built at the first request, then kept
+ * in a least recently used cache of LOD_CACHE_SIZE buffers
+ * (buffers used in the current frame are never released)
+ * \param indexCount    [output] number of indices, 0 = nothing to draw
+ */
+QOpenGLBuffer *Crit3DTerrainLOD::getIndexBuffer(const Crit3DTerrainTile &tile, GLsizei *indexCount)
+{
+    const Crit3DTerrainNode &node = m_nodes[unsigned(tile.node)];
+    unsigned long long key = (unsigned long long)(tile.node) << 16;
+    for (int edge = 0; edge < 4; edge++)
+    {
+        unsigned long long ratioLog2 = 0;
+        while ((node.stride << ratioLog2) < tile.edgeStride[edge])
+            ratioLog2++;
+        key |= ratioLog2 << (edge * 4);
+    }
+
+    std::unordered_map<unsigned long long, std::list<Crit3DTileBuffer>::iterator>::iterator it = m_cacheMap.find(key);
+    if (it != m_cacheMap.end())
+    {
+        m_cache.splice(m_cache.begin(), m_cache, it->second);
+        m_cache.front().frame = m_frame;
+        *indexCount = m_cache.front().indexCount;
+        return &(m_cache.front().buffer);
+    }
+
+    std::vector<GLuint> indices;
+    buildTileIndices(tile, indices);
+
+    m_cache.push_front(Crit3DTileBuffer());
+    Crit3DTileBuffer &entry = m_cache.front();
+    entry.key = key;
+    entry.buffer = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+    entry.indexCount = GLsizei(indices.size());
+    entry.frame = m_frame;
+    if (! indices.empty())
+    {
+        entry.buffer.create();
+        entry.buffer.bind();
+        entry.buffer.allocate(indices.data(), int(indices.size() * sizeof(GLuint)));
+    }
+    m_cacheMap[key] = m_cache.begin();
+
+    while (m_cache.size() > LOD_CACHE_SIZE && m_cache.back().frame != m_frame)
+    {
+        m_cacheMap.erase(m_cache.back().key);
+        m_cache.back().buffer.destroy();
+        m_cache.pop_back();
+    }
+
+    *indexCount = entry.indexCount;
+    return &(entry.buffer);
+}
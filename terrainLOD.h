@@ -0,0 +1,105 @@
+#ifndef TERRAINLOD_H
+#define TERRAINLOD_H
+
+    #include <QOpenGLBuffer>
+    #include <QMatrix4x4>
+    #include <QVector3D>
+    #include <QVector4D>
+    #include <list>
+    #include <unordered_map>
+    #include <vector>
+
+    #ifndef GEOMETRY_H
+        #include "geometry.h"
+    #endif
+
+    /*! quads for each side of a tile, at every level of detail */
+    #define LOD_TILE_SIZE 64
+    /*! maximum screen-space error of the selected tiles [pixels] */
+    #define LOD_MAX_PIXEL_ERROR 1.5f
+    /*! maximum number of tile index buffers kept on the GPU */
+    #define LOD_CACHE_SIZE 1024
+
+    enum tileEdge {edgeLeft, edgeTop, edgeRight, edgeBottom};
+
+    /*!
+     * \brief quadtree node: a square of LOD_TILE_SIZE quads sampled every stride cells
+     */
+    struct Crit3DTerrainNode
+    {
+        int firstRow, firstCol;
+        int lastRow, lastCol;           /*!< clipped to the grid */
+        int stride;
+        int children[4];                /*!< -1 = none */
+        float zMin, zMax;               /*!< unscaled z of the valid vertices */
+        float error;                    /*!< maximum vertical error with respect to the full resolution */
+    };
+
+    /*!
+     * \brief selected node and the stride of its edges (coarser neighbours)
+     */
+    struct Crit3DTerrainTile
+    {
+        int node;
+        int edgeStride[4];
+    };
+
+    /*!
+     * \brief view frustum in model coordinates: six planes, inside if a*x + b*y + c*z + d >= 0
+     */
+    class Crit3DFrustum
+    {
+    public:
+        void setPlanes(const QMatrix4x4 &modelViewProjection);
+        bool isOutside(const QVector3D &boxMin, const QVector3D &boxMax, int *planeMask) const;
+
+    private:
+        QVector4D m_planes[6];
+    };
+
+    class Crit3DTerrainLOD
+    {
+    public:
+        Crit3DTerrainLOD();
+
+        void clear();
+        void initialize(const Crit3DGeometry *geometry);
+
+        void selectTiles(const QMatrix4x4 &modelViewProjection, const QVector3D &cameraPosition,
+                         float magnify, float pixelFactor, std::vector<Crit3DTerrainTile> &tiles);
+        QOpenGLBuffer *getIndexBuffer(const Crit3DTerrainTile &tile, GLsizei *indexCount);
+
+        void buildTileIndices(const Crit3DTerrainTile &tile, std::vector<GLuint> &indices) const;
+
+        const std::vector<Crit3DTerrainNode> &getNodes() const { return m_nodes; }
+
+    private:
+        struct Crit3DTileBuffer
+        {
+            unsigned long long key;
+            QOpenGLBuffer buffer;
+            GLsizei indexCount;
+            unsigned long frame;
+        };
+
+        const Crit3DGeometry *m_geometry;
+        std::vector<Crit3DTerrainNode> m_nodes;
+        std::vector<char> m_isSelected;
+        Crit3DFrustum m_frustum;
+
+        std::list<Crit3DTileBuffer> m_cache;
+        std::unordered_map<unsigned long long, std::list<Crit3DTileBuffer>::iterator> m_cacheMap;
+        unsigned long m_frame;
+
+        int buildNode(int firstRow, int firstCol, int stride);
+        float decimationError(const Crit3DTerrainNode &node) const;
+        bool getZ(int row, int col, float *z) const;
+
+        void getBox(const Crit3DTerrainNode &node, float magnify, QVector3D *boxMin, QVector3D *boxMax) const;
+        void selectNode(int index, int planeMask, const QVector3D &cameraPosition, float magnify, float pixelFactor,
+                        std::vector<Crit3DTerrainTile> &tiles);
+        int selectedStride(int row, int col) const;
+    };
+
+
+#endif // TERRAINLOD_H
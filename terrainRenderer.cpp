@@ -0,0 +1,262 @@
+/*!
+    \file terrainRenderer.cpp
+
+    \abstract GL drawing of the terrain
+
+    Mesh mode: the shared vertices of Crit3DGeometry in one interleaved
+    vertex buffer, drawn by tiles selected by Crit3DTerrainLOD.
+    Heightmap mode: Crit3DTerrainHeightmap, textures of the DTM and colors rasters.
+    Each mode is initialized at its first use: in heightmap mode the mesh
+    is not built, nor uploaded.
+    The viewer widget and the offscreen benchmark use the same renderer.
+*/
+
+#include <math.h>
+#include <cstddef>
+#include <QOpenGLContext>
+#include "commonConstants.h"
+#include "terrainRenderer.h"
+
+#ifndef GL_PRIMITIVE_RESTART
+    #define GL_PRIMITIVE_RESTART 0x8F9D
+#endif
+#ifndef GL_PRIMITIVE_RESTART_FIXED_INDEX
+    #define GL_PRIMITIVE_RESTART_FIXED_INDEX 0x8D69
+#endif
+
+
+static const char *vertexShaderSource =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 vertex;\n"
+    "layout(location = 1) in vec4 color;\n"
+    "out vec4 myCol;\n"
+    "uniform mat4 projMatrix;\n"
+    "uniform mat4 mvMatrix;\n"
+    "uniform float magnify;\n"
+    "void main() {\n"
+    "   myCol = color;\n"
+    "   gl_Position = projMatrix * mvMatrix * vec4(vertex.xy, vertex.z * magnify, 1.0);\n"
+    "}\n";
+
+static const char *fragmentShaderSource =
+    "#version 330 core\n"
+    "in vec4 myCol;\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "   fragColor = myCol;\n"
+    "}\n";
+
+
+Crit3DTerrainRenderer::Crit3DTerrainRenderer()
+    : m_geometry(nullptr),
+      m_program(nullptr),
+      m_isHeightmapMode(false),
+      m_projMatrixLoc(-1),
+      m_mvMatrixLoc(-1),
+      m_magnifyLoc(-1),
+      m_viewportHeight(1.f)
+{ }
+
+
+/*!
+ * \brief compile the shaders and initialize the current mode (see initializeMesh, initializeHeightmap):
+ * heightmap mode falls back to mesh mode if the grid exceeds the maximum texture size
+ */
+bool Crit3DTerrainRenderer::initialize(Crit3DGeometry *geometry)
+{
+    clear();
+
+    initializeOpenGLFunctions();
+    m_geometry = geometry;
+
+    // blue sky
+    glClearColor(0.52f, 0.81f, 0.92f, 0.f);
+
+    m_program = new QOpenGLShaderProgram;
+    m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource);
+    m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource);
+    m_program->bindAttributeLocation("vertex", 0);
+    m_program->bindAttributeLocation("color", 1);
+    if (! m_program->link())
+    {
+        clear();
+        return false;
+    }
+
+    m_program->bind();
+    m_projMatrixLoc = m_program->uniformLocation("projMatrix");
+    m_mvMatrixLoc = m_program->uniformLocation("mvMatrix");
+    m_magnifyLoc = m_program->uniformLocation("magnify");
+    m_program->release();
+
+    glEnable(GL_DEPTH_TEST);
+    // hidden face
+    //glEnable(GL_CULL_FACE);
+    // wireframe
+    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+
+    if (m_isHeightmapMode && initializeHeightmap())
+        return true;
+
+    m_isHeightmapMode = false;
+    return initializeMesh();
+}
+
+
+/*!
+ * \brief build the mesh of the geometry if needed, upload the vertex buffer and build the tile quadtree
+ */
+bool Crit3DTerrainRenderer::initializeMesh()
+{
+    if (m_bufferObject.isCreated()) return true;
+    if (! m_geometry->isMeshBuilt() && ! buildTerrainMesh(m_geometry)) return false;
+
+    // setup vertex array object: vertex buffer, attributes and index buffer are uploaded once
+    m_vao.create();
+    QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+
+    // interleaved vertex buffer: position (3 x float) and color (4 x unsigned byte)
+    m_bufferObject.create();
+    m_bufferObject.bind();
+    m_bufferObject.allocate(m_geometry->getVertices(), m_geometry->vertexCount() * long(sizeof(Crit3DVertex)));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Crit3DVertex),
+                          reinterpret_cast<void *>(offsetof(Crit3DVertex, x)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Crit3DVertex),
+                          reinterpret_cast<void *>(offsetof(Crit3DVertex, red)));
+
+    // tile quadtree: index buffers (triangle strips separated by the restart index) are built on demand
+    m_terrainLOD.initialize(m_geometry);
+    enablePrimitiveRestart();
+
+    return true;
+}
+
+
+/*!
+ * \brief upload the heightmap textures from the rasters of the geometry
+ * \return false if the grid exceeds the maximum texture size
+ */
+bool Crit3DTerrainRenderer::initializeHeightmap()
+{
+    if (m_geometry == nullptr) return false;
+    if (m_heightmap.isInitialized()) return true;
+
+    return m_heightmap.initialize(m_geometry);
+}
+
+
+void Crit3DTerrainRenderer::clear()
+{
+    if (m_program == nullptr)
+        return;
+
+    m_vao.destroy();
+    m_bufferObject.destroy();
+    m_terrainLOD.clear();
+    m_heightmap.clear();
+    m_tiles.clear();
+    delete m_program;
+    m_program = nullptr;
+    m_geometry = nullptr;
+}
+
+
+/*!
+ * \brief upload again the colors of the geometry (e.g. a map draped on the terrain):
+ * the vertex buffer is rewritten in place (the tile quadtree is unchanged), the color texture is uploaded
+ */
+void Crit3DTerrainRenderer::updateColors()
+{
+    if (m_program == nullptr) return;
+
+    if (m_bufferObject.isCreated())
+    {
+        m_bufferObject.bind();
+        m_bufferObject.write(0, m_geometry->getVertices(), int(m_geometry->vertexCount() * long(sizeof(Crit3DVertex))));
+        m_bufferObject.release();
+    }
+
+    if (m_heightmap.isInitialized())
+        m_heightmap.uploadColors(m_geometry);
+}
+
+
+/*!
+ * \brief set the projection of a viewport [pixels]
+ */
+void Crit3DTerrainRenderer::setViewport(int width, int height)
+{
+    height = std::max(height, 1);
+    m_proj.setToIdentity();
+    m_proj.perspective(FIELD_OF_VIEW, GLfloat(width) / GLfloat(height), 0.1f, 1000000.0f);
+    m_viewportHeight = float(height);
+}
+
+
+void Crit3DTerrainRenderer::render(const QMatrix4x4 &modelView, float magnify)
+{
+    if (m_program == nullptr) return;
+
+    // each mode is initialized at its first frame
+    if (m_isHeightmapMode)
+    {
+        if (initializeHeightmap())
+        {
+            m_tiles.clear();
+            m_heightmap.draw(m_proj, modelView, magnify);
+            return;
+        }
+        // grid larger than the maximum texture size: mesh mode
+        m_isHeightmapMode = false;
+    }
+
+    if (! initializeMesh()) return;
+
+    m_program->bind();
+    m_program->setUniformValue(m_projMatrixLoc, m_proj);
+    m_program->setUniformValue(m_mvMatrixLoc, modelView);
+    m_program->setUniformValue(m_magnifyLoc, magnify);
+
+    // visible tiles and level of detail: camera position in model coordinates
+    QVector3D cameraPosition = modelView.inverted().map(QVector3D(0, 0, 0));
+    float pixelFactor = m_viewportHeight / (2.f * tanf(FIELD_OF_VIEW * 0.5f * float(DEG_TO_RAD)));
+    m_terrainLOD.selectTiles(m_proj * modelView, cameraPosition, magnify, pixelFactor, m_tiles);
+
+    QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+    for (unsigned i = 0; i < m_tiles.size(); i++)
+    {
+        GLsizei indexCount;
+        QOpenGLBuffer *indexBuffer = m_terrainLOD.getIndexBuffer(m_tiles[i], &indexCount);
+        if (indexCount == 0) continue;
+
+        indexBuffer->bind();
+        glDrawElements(GL_TRIANGLE_STRIP, indexCount, GL_UNSIGNED_INT, nullptr);
+    }
+    m_program->release();
+}
+
+
+/*!
+ * \brief enable the restart of triangle strips at PRIMITIVE_RESTART_INDEX
+ * fixed index on OpenGL 4.3 and ES 3.0, explicit restart index on OpenGL 3.1
+ */
+void Crit3DTerrainRenderer::enablePrimitiveRestart()
+{
+    QOpenGLContext *glContext = QOpenGLContext::currentContext();
+    if (glContext->isOpenGLES() || glContext->format().version() >= qMakePair(4, 3))
+    {
+        glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+        return;
+    }
+
+    typedef void (QOPENGLF_APIENTRYP primitiveRestartIndexFunction)(GLuint index);
+    primitiveRestartIndexFunction glPrimitiveRestartIndex =
+            reinterpret_cast<primitiveRestartIndexFunction>(glContext->getProcAddress("glPrimitiveRestartIndex"));
+    if (glPrimitiveRestartIndex != nullptr)
+    {
+        glPrimitiveRestartIndex(PRIMITIVE_RESTART_INDEX);
+        glEnable(GL_PRIMITIVE_RESTART);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef TERRAINRENDERER_H
+#define TERRAINRENDERER_H
+
+    #include <QOpenGLFunctions>
+    #include <QOpenGLVertexArrayObject>
+    #include <QOpenGLBuffer>
+    #include <QOpenGLShaderProgram>
+    #include <QMatrix4x4>
+    #include <vector>
+
+    #include "geometry.h"
+    #include "terrainLOD.h"
+    #include "terrainHeightmap.h"
+
+    #define FIELD_OF_VIEW 45.f
+
+    /*!
+     * \brief GL drawing of the terrain, shared by the viewer widget and the benchmark:
+     * mesh mode (shared vertex buffer, tile LOD and culling) or heightmap mode
+     * (textures of the rasters, no mesh). All methods require the current GL context.
+     */
+    class Crit3DTerrainRenderer : protected QOpenGLFunctions
+    {
+    public:
+        Crit3DTerrainRenderer();
+
+        bool initialize(Crit3DGeometry *geometry);
+        void clear();
+        void updateColors();
+
+        void setViewport(int width, int height);
+        void render(const QMatrix4x4 &modelView, float magnify);
+
+        void setHeightmapMode(bool isHeightmapMode) { m_isHeightmapMode = isHeightmapMode; }
+        bool isHeightmapMode() const { return m_isHeightmapMode; }
+        bool isInitialized() const { return m_program != nullptr; }
+        long nrDrawnTiles() const { return long(m_tiles.size()); }
+
+    private:
+        Crit3DGeometry *m_geometry;
+        QOpenGLShaderProgram *m_program;
+        QOpenGLVertexArrayObject m_vao;
+        QOpenGLBuffer m_bufferObject;
+
+        Crit3DTerrainLOD m_terrainLOD;
+        std::vector<Crit3DTerrainTile> m_tiles;
+        Crit3DTerrainHeightmap m_heightmap;
+        bool m_isHeightmapMode;
+
+        int m_projMatrixLoc;
+        int m_mvMatrixLoc;
+        int m_magnifyLoc;
+
+        QMatrix4x4 m_proj;
+        float m_viewportHeight;
+
+        bool initializeMesh();
+        bool initializeHeightmap();
+        void enablePrimitiveRestart();
+    };
+
+
+#endif // TERRAINRENDERER_H
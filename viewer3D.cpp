@@ -28,13 +28,14 @@
 #include "viewer3D.h"
 
 #include <QSlider>
+#include <QCheckBox>
 #include <QLabel>
 #include <QStatusBar>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 
 
-Viewer3D::Viewer3D(Crit3DGeometry *myGeometry)
+Viewer3D::Viewer3D(Crit3DGeometry *myGeometry, bool isHeightmapMode)
 {
     setAttribute(Qt::WA_DeleteOnClose);
     setWindowTitle(tr("Terrain 3D"));
@@ -57,6 +58,9 @@ Viewer3D::Viewer3D(Crit3DGeometry *myGeometry)
     magnifySlider = horizontalSlider(1, 100, 1, 5);
     magnifyLayout->addWidget(magnifySlider);
 
+    QCheckBox *heightmapCheckBox = new QCheckBox("GPU heightmap");
+    magnifyLayout->addWidget(heightmapCheckBox);
+
     QVBoxLayout *mainLayout = new QVBoxLayout;
     mainLayout->addLayout(glLayout);
     mainLayout->addLayout(rotateLayout);
@@ -71,10 +75,13 @@ Viewer3D::Viewer3D(Crit3DGeometry *myGeometry)
     connect(rotateSlider, &QSlider::valueChanged, glWidget, &Crit3DOpenGLWidget::setZRotation);
     connect(glWidget, &Crit3DOpenGLWidget::zRotationChanged, rotateSlider, &QSlider::setValue);
     connect(magnifySlider, &QSlider::valueChanged, glWidget, &Crit3DOpenGLWidget::setMagnify);
+    connect(heightmapCheckBox, &QCheckBox::toggled, glWidget, &Crit3DOpenGLWidget::setHeightmapMode);
 
     turnSlider->setValue(30 * DEGREE_MULTIPLY);
     rotateSlider->setValue(0 * DEGREE_MULTIPLY);
     magnifySlider->setValue(myGeometry->magnify() * 10);
+    // before the first frame: in heightmap mode the mesh is not built
+    heightmapCheckBox->setChecked(isHeightmapMode);
 }
 
 
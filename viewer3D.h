@@ -12,7 +12,7 @@
         Q_OBJECT
 
     public:
-        Viewer3D(Crit3DGeometry *myGeometry);
+        Viewer3D(Crit3DGeometry *myGeometry, bool isHeightmapMode);
 
         Crit3DOpenGLWidget *glWidget;
 